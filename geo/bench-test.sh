@@ -3,6 +3,8 @@
 # Purpose: Quickly get benchmark results for geo commands
 # Secondary Purpose: To stress test Redis Geo commands by running
 # them continuously under lldb, gdb, or valgrind.
+# For tail latency under a mixed read/write fleet load, use geo-loadgen
+# (make geo-loadgen; ./geo-loadgen -h).
 
 PATH=~/repos/redis/src:$PATH
 LOOPR=10000
@@ -0,0 +1,643 @@
+#define _GNU_SOURCE /* provides getline() and getopt() on Linux */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "geohash.h"
+#include "geohash_helper.h"
+#include "geoparse.h"
+
+/* ====================================================================
+ * geo-bench: geohash kernel microbenchmarks
+ * ====================================================================
+ * Generates synthetic workloads and times the kernels the geo module
+ * spends its time in:
+ *   - uniform: points spread over the whole encodable globe
+ *   - clustered: points packed around a few dozen "cities"
+ *   - polar: points above 70 degrees north or south, where cells are
+ *     narrowest and radius searches cover the most cells
+ *   - file: "lat long" (or "lat,long") lines read with -f
+ *
+ * Besides the geohash kernels, "parse" times the coordinate parser used for
+ * command arguments against plain strtod() on the same decimal strings.
+ *
+ * Kernels are timed in batches of BENCH_BATCH operations.  We report mean
+ * ns/op and percentiles of per-batch ns/op.  End-to-end radius searches run
+ * against a sorted in-memory array of 52-bit scores the same way georadius
+ * runs against a zset: cells, merged ranges, one binary search per range,
+ * then decode and distance filtering of every candidate.  Those are timed
+ * per query and also report candidates, accepted members and ranges per
+ * query.
+ *
+ * Build and run with: make bench (or make geo-bench; ./geo-bench -h) */
+
+#define BENCH_POINTS_DEFAULT 1000000
+#define BENCH_QUERIES_DEFAULT 20000
+#define BENCH_BATCH 1024
+#define BENCH_CITIES 48
+#define BENCH_CITY_SIGMA 0.05 /* degrees, about 5.5 km */
+#define BENCH_MATRIX_SIDE 64
+#define BENCH_TEXT 16
+
+struct point {
+    double latitude;
+    double longitude;
+};
+
+struct workload {
+    const char *name;
+    struct point *points;
+    size_t count;
+    struct point *queries;
+    size_t query_count;
+};
+
+/* Per-workload state shared by the kernels */
+struct bench {
+    struct workload *w;
+    GeoHashBits *z;       /* 26-step Z-order hash of every point */
+    GeoHashBits *hilbert; /* 26-step Hilbert hash of every point */
+    GeoHashBits *cells;   /* 1 km search cell of every point */
+    float *matrix;
+    double *scratch; /* for geohashGetDistanceMatrixWGS84() */
+    char (*text)[BENCH_TEXT]; /* "%.7f" latitude of every point */
+    uint64_t sink; /* keeps the compiler from dropping kernel results */
+};
+
+/* ====================================================================
+ * Random numbers (xorshift64*, reproducible across platforms)
+ * ==================================================================== */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double uniform(double lo, double hi) {
+    return lo + (hi - lo) * ((rng() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double gaussian(void) {
+    double u = uniform(1e-12, 1), v = uniform(0, 1);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double clamp(double v, double lo, double hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+/* ====================================================================
+ * Workloads
+ * ==================================================================== */
+#define LAT_MAX 85.05112878
+
+static void generateUniform(struct point *p, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        p[i].latitude = uniform(-LAT_MAX, LAT_MAX);
+        p[i].longitude = uniform(-180, 180);
+    }
+}
+
+static void generateClustered(struct point *p, size_t count) {
+    static struct point cities[BENCH_CITIES];
+    static bool placed = false;
+
+    /* Queries and points share cities */
+    if (!placed) {
+        for (int i = 0; i < BENCH_CITIES; i++) {
+            cities[i].latitude = uniform(-60, 60);
+            cities[i].longitude = uniform(-180, 180);
+        }
+        placed = true;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct point *city = cities + rng() % BENCH_CITIES;
+        p[i].latitude = clamp(city->latitude + gaussian() * BENCH_CITY_SIGMA,
+                              -LAT_MAX, LAT_MAX);
+        p[i].longitude = clamp(
+            city->longitude + gaussian() * BENCH_CITY_SIGMA, -180, 180);
+    }
+}
+
+static void generatePolar(struct point *p, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        double latitude = uniform(70, LAT_MAX);
+        p[i].latitude = rng() & 1 ? latitude : -latitude;
+        p[i].longitude = uniform(-180, 180);
+    }
+}
+
+/* Read up to 'max' coordinate pairs.  Returns pairs read. */
+static size_t loadFile(const char *path, struct point *p, size_t max) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    char *line = NULL;
+    size_t len = 0, count = 0;
+    while (count < max && getline(&line, &len, fp) != -1) {
+        char *end;
+        double latitude = strtod(line, &end);
+        if (end == line)
+            continue;
+        while (*end == ',' || *end == ' ' || *end == '\t')
+            end++;
+
+        char *start = end;
+        double longitude = strtod(start, &end);
+        if (end == start || fabs(latitude) > LAT_MAX ||
+            fabs(longitude) > 180)
+            continue;
+
+        p[count].latitude = latitude;
+        p[count].longitude = longitude;
+        count++;
+    }
+
+    free(line);
+    fclose(fp);
+    return count;
+}
+
+/* ====================================================================
+ * Timing and reporting
+ * ==================================================================== */
+static long long nstime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int sort_double_asc(const void *a, const void *b) {
+    double da = *(const double *)a, db = *(const double *)b;
+    return da < db ? -1 : da > db;
+}
+
+/* Sorts 'samples' */
+static double percentile(double *samples, size_t count, double p) {
+    return count ? samples[(size_t)(p * (count - 1))] : 0;
+}
+
+static void reportHeader(void) {
+    printf("%-10s %-22s %10s %10s %10s %10s %10s  %s\n", "workload",
+           "kernel", "ns/op", "p50", "p90", "p99", "p999", "per query");
+}
+
+static void report(const char *workload, const char *kernel, double mean,
+                   double *samples, size_t count, const char *extra) {
+    qsort(samples, count, sizeof(*samples), sort_double_asc);
+    printf("%-10s %-22s %10.2f %10.2f %10.2f %10.2f %10.2f  %s\n", workload,
+           kernel, mean, percentile(samples, count, 0.50),
+           percentile(samples, count, 0.90), percentile(samples, count, 0.99),
+           percentile(samples, count, 0.999), extra ? extra : "");
+}
+
+/* ====================================================================
+ * Kernels
+ * ==================================================================== */
+/* A kernel runs operations [from, to) and returns something to sink */
+typedef uint64_t benchKernel(struct bench *b, size_t from, size_t to);
+
+static uint64_t kernelEncode(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        struct point *p = b->w->points + i;
+        GeoHashBits hash;
+        geohashEncodeWGS84(p->latitude, p->longitude, GEO_STEP_MAX, &hash);
+        sink ^= hash.bits;
+    }
+    return sink;
+}
+
+static uint64_t kernelEncodeHilbert(struct bench *b, size_t from,
+                                    size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        struct point *p = b->w->points + i;
+        GeoHashBits hash;
+        geohashEncodeType(GEO_WGS84_TYPE | GEO_HILBERT, p->latitude,
+                          p->longitude, GEO_STEP_MAX, &hash);
+        sink ^= hash.bits;
+    }
+    return sink;
+}
+
+static uint64_t kernelDecode(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        double latlong[2];
+        geohashDecodeToLatLongWGS84(b->z[i], latlong);
+        sink += (uint64_t)(latlong[0] * 1e6);
+    }
+    return sink;
+}
+
+static uint64_t kernelDecodeHilbert(struct bench *b, size_t from,
+                                    size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        double latlong[2];
+        geohashDecodeToLatLongType(GEO_WGS84_TYPE | GEO_HILBERT,
+                                   b->hilbert[i], latlong);
+        sink += (uint64_t)(latlong[0] * 1e6);
+    }
+    return sink;
+}
+
+static uint64_t kernelNeighbors(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        GeoHashNeighbors n;
+        geohashNeighbors(b->cells + i, &n);
+        sink ^= n.north.bits ^ n.south_west.bits;
+    }
+    return sink;
+}
+
+static uint64_t kernelAreas(struct bench *b, size_t from, size_t to) {
+    static const double radii[] = {100, 1000, 10000};
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        struct point *p = b->w->points + i;
+        GeoHashRadius n = geohashGetAreasByRadiusWGS84(
+            p->latitude, p->longitude, radii[i % 3]);
+        sink ^= n.hash.bits ^ n.neighbors.east.bits;
+    }
+    return sink;
+}
+
+static uint64_t kernelDistance(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        struct point *p = b->w->points + i;
+        struct point *q = b->w->points + (i + 1) % b->w->count;
+        double distance;
+        sink += geohashGetDistanceIfInRadiusWGS84(
+            p->longitude, p->latitude, q->longitude, q->latitude, 1e6,
+            &distance);
+    }
+    return sink;
+}
+
+static uint64_t kernelParse(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        double value;
+        geoParseDouble(b->text[i], strlen(b->text[i]), &value);
+        sink += (uint64_t)(value * 1e7);
+    }
+    return sink;
+}
+
+static uint64_t kernelParseStrtod(struct bench *b, size_t from, size_t to) {
+    uint64_t sink = 0;
+    for (size_t i = from; i < to; i++) {
+        double value = strtod(b->text[i], NULL);
+        sink += (uint64_t)(value * 1e7);
+    }
+    return sink;
+}
+
+/* Operations are pairs; each batch is one BENCH_MATRIX_SIDE square */
+static uint64_t kernelDistanceMatrix(struct bench *b, size_t from,
+                                     size_t to) {
+    int side = BENCH_MATRIX_SIDE;
+    size_t base = (from / (side * side) * side * 2) % (b->w->count - side * 2);
+    double origins[BENCH_MATRIX_SIDE * 2], destinations[BENCH_MATRIX_SIDE * 2];
+
+    for (int i = 0; i < side; i++) {
+        origins[i * 2] = b->w->points[base + i].latitude;
+        origins[i * 2 + 1] = b->w->points[base + i].longitude;
+        destinations[i * 2] = b->w->points[base + side + i].latitude;
+        destinations[i * 2 + 1] = b->w->points[base + side + i].longitude;
+    }
+
+    geohashGetDistanceMatrixWGS84(origins, side, destinations, side, 1,
+                                  b->matrix, b->scratch);
+    return (uint64_t)b->matrix[side + 1];
+}
+
+static void runKernel(struct bench *b, const char *name, benchKernel *kernel,
+                      size_t batch) {
+    size_t count = b->w->count;
+    size_t batches = count / batch;
+    if (!batches)
+        return;
+
+    double *samples = malloc(sizeof(*samples) * batches);
+    long long total = 0;
+
+    for (size_t i = 0; i < batches; i++) {
+        long long start = nstime();
+        b->sink += kernel(b, i * batch, (i + 1) * batch);
+        long long elapsed = nstime() - start;
+        total += elapsed;
+        samples[i] = (double)elapsed / batch;
+    }
+
+    report(b->w->name, name, (double)total / (batches * batch), samples,
+           batches, NULL);
+    free(samples);
+}
+
+/* ====================================================================
+ * End-to-end radius filtering
+ * ==================================================================== */
+static int sort_u64_asc(const void *a, const void *b) {
+    uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+    return ua < ub ? -1 : ua > ub;
+}
+
+/* First index of 'scores' >= 'min' */
+static size_t lowerBound(const uint64_t *scores, size_t count, uint64_t min) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (scores[mid] < min)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+struct radiusResult {
+    long candidates;
+    long accepted;
+    int ranges;
+};
+
+/* One georadius against sorted 'scores', minus the reply */
+static struct radiusResult radiusSearch(uint8_t coord_type,
+                                        const uint64_t *scores, size_t count,
+                                        struct point *center, double radius) {
+    struct radiusResult r = {0};
+    GeoHashRadius n = geohashGetAreasByRadius(coord_type, center->latitude,
+                                              center->longitude, radius);
+    GeoHashBits cells[9] = {n.hash,
+                            n.neighbors.north,
+                            n.neighbors.south,
+                            n.neighbors.east,
+                            n.neighbors.west,
+                            n.neighbors.north_east,
+                            n.neighbors.north_west,
+                            n.neighbors.south_east,
+                            n.neighbors.south_west};
+    uint64_t ranges[9][2];
+    int found = 0;
+
+    for (int i = 0; i < 9; i++) {
+        if (HASHISZERO(cells[i]))
+            continue;
+        ranges[found][0] = geohashAlign52Bits(cells[i]);
+        cells[i].bits++;
+        ranges[found++][1] = geohashAlign52Bits(cells[i]);
+    }
+
+    qsort(ranges, found, sizeof(*ranges), sort_u64_asc);
+    for (int i = 1; i < found; i++) {
+        if (ranges[i][0] <= ranges[r.ranges][1]) {
+            if (ranges[i][1] > ranges[r.ranges][1])
+                ranges[r.ranges][1] = ranges[i][1];
+        } else {
+            r.ranges++;
+            ranges[r.ranges][0] = ranges[i][0];
+            ranges[r.ranges][1] = ranges[i][1];
+        }
+    }
+    if (found)
+        r.ranges++;
+
+    for (int i = 0; i < r.ranges; i++) {
+        for (size_t j = lowerBound(scores, count, ranges[i][0]);
+             j < count && scores[j] < ranges[i][1]; j++) {
+            GeoHashBits hash = {.bits = scores[j], .step = GEO_STEP_MAX};
+            double latlong[2], distance;
+
+            r.candidates++;
+            geohashDecodeToLatLongType(coord_type, hash, latlong);
+            r.accepted += geohashGetDistanceIfInRadius(
+                coord_type, center->longitude, center->latitude, latlong[1],
+                latlong[0], radius, &distance);
+        }
+    }
+
+    return r;
+}
+
+static void runRadius(struct bench *b, const char *name, uint8_t coord_type,
+                      const uint64_t *scores, double radius) {
+    size_t queries = b->w->query_count;
+    double *samples = malloc(sizeof(*samples) * queries);
+    long long total = 0;
+    long candidates = 0, accepted = 0, ranges = 0;
+
+    for (size_t i = 0; i < queries; i++) {
+        long long start = nstime();
+        struct radiusResult r = radiusSearch(coord_type, scores, b->w->count,
+                                             b->w->queries + i, radius);
+        long long elapsed = nstime() - start;
+
+        total += elapsed;
+        samples[i] = elapsed;
+        candidates += r.candidates;
+        accepted += r.accepted;
+        ranges += r.ranges;
+    }
+
+    char kernel[64], extra[128];
+    snprintf(kernel, sizeof(kernel), "%s %gkm", name, radius / 1000);
+    snprintf(extra, sizeof(extra),
+             "candidates %.1f accepted %.1f ranges %.2f",
+             (double)candidates / queries, (double)accepted / queries,
+             (double)ranges / queries);
+    report(b->w->name, kernel, (double)total / queries, samples, queries,
+           extra);
+    free(samples);
+}
+
+/* ====================================================================
+ * Driver
+ * ==================================================================== */
+static bool selected(const char *filter, const char *name) {
+    return !filter || strstr(name, filter);
+}
+
+static void runWorkload(struct workload *w, const char *filter) {
+    struct bench b = {.w = w};
+    size_t count = w->count;
+
+    b.z = malloc(sizeof(*b.z) * count);
+    b.hilbert = malloc(sizeof(*b.hilbert) * count);
+    b.cells = malloc(sizeof(*b.cells) * count);
+    b.matrix = malloc(sizeof(*b.matrix) * BENCH_MATRIX_SIDE *
+                      BENCH_MATRIX_SIDE);
+    b.scratch = malloc(sizeof(*b.scratch) *
+                       GEO_DISTANCE_MATRIX_SCRATCH(BENCH_MATRIX_SIDE,
+                                                   BENCH_MATRIX_SIDE));
+
+    b.text = malloc(sizeof(*b.text) * count);
+
+    uint64_t *z_scores = malloc(sizeof(*z_scores) * count);
+    uint64_t *hilbert_scores = malloc(sizeof(*hilbert_scores) * count);
+    uint8_t cell_step = geohashEstimateStepsByRadius(1000);
+
+    for (size_t i = 0; i < count; i++) {
+        struct point *p = w->points + i;
+        geohashEncodeWGS84(p->latitude, p->longitude, GEO_STEP_MAX, b.z + i);
+        geohashEncodeType(GEO_WGS84_TYPE | GEO_HILBERT, p->latitude,
+                          p->longitude, GEO_STEP_MAX, b.hilbert + i);
+        geohashEncodeWGS84(p->latitude, p->longitude, cell_step,
+                           b.cells + i);
+        snprintf(b.text[i], BENCH_TEXT, "%.7f", p->latitude);
+        z_scores[i] = b.z[i].bits;
+        hilbert_scores[i] = b.hilbert[i].bits;
+    }
+    qsort(z_scores, count, sizeof(*z_scores), sort_u64_asc);
+    qsort(hilbert_scores, count, sizeof(*hilbert_scores), sort_u64_asc);
+
+    static const struct {
+        const char *name;
+        benchKernel *kernel;
+        size_t batch;
+    } kernels[] = {
+        {"encode", kernelEncode, BENCH_BATCH},
+        {"encode-hilbert", kernelEncodeHilbert, BENCH_BATCH},
+        {"decode", kernelDecode, BENCH_BATCH},
+        {"decode-hilbert", kernelDecodeHilbert, BENCH_BATCH},
+        {"neighbors", kernelNeighbors, BENCH_BATCH},
+        {"areas-by-radius", kernelAreas, BENCH_BATCH},
+        {"distance", kernelDistance, BENCH_BATCH},
+        {"parse", kernelParse, BENCH_BATCH},
+        {"parse-strtod", kernelParseStrtod, BENCH_BATCH},
+        {"distance-matrix", kernelDistanceMatrix,
+         BENCH_MATRIX_SIDE * BENCH_MATRIX_SIDE}};
+
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(*kernels); i++)
+        if (selected(filter, kernels[i].name) &&
+            (kernels[i].kernel != kernelDistanceMatrix ||
+             count > BENCH_MATRIX_SIDE * 2))
+            runKernel(&b, kernels[i].name, kernels[i].kernel,
+                      kernels[i].batch);
+
+    static const double radii[] = {100, 1000, 10000};
+    for (size_t i = 0; i < sizeof(radii) / sizeof(*radii); i++) {
+        if (selected(filter, "radius-z"))
+            runRadius(&b, "radius-z", GEO_WGS84_TYPE, z_scores, radii[i]);
+        if (selected(filter, "radius-hilbert"))
+            runRadius(&b, "radius-hilbert", GEO_WGS84_TYPE | GEO_HILBERT,
+                      hilbert_scores, radii[i]);
+    }
+
+    /* Printing the sink keeps every kernel's work observable */
+    fflush(stdout);
+    fprintf(stderr, "(%s sink %" PRIx64 ")\n", w->name, b.sink);
+
+    free(z_scores);
+    free(hilbert_scores);
+    free(b.z);
+    free(b.hilbert);
+    free(b.cells);
+    free(b.matrix);
+    free(b.scratch);
+    free(b.text);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-n points] [-q queries] [-w workload] [-k kernel] "
+            "[-f file] [-s seed]\n"
+            "  -n  points per workload (default %d)\n"
+            "  -q  radius queries per workload (default %d)\n"
+            "  -w  uniform, clustered, polar or file (default: all)\n"
+            "  -k  only run kernels whose name contains this\n"
+            "  -f  also run a workload of \"lat long\" lines from file\n"
+            "  -s  random seed\n",
+            prog, BENCH_POINTS_DEFAULT, BENCH_QUERIES_DEFAULT);
+}
+
+int main(int argc, char *argv[]) {
+    size_t points = BENCH_POINTS_DEFAULT, queries = BENCH_QUERIES_DEFAULT;
+    const char *only = NULL, *filter = NULL, *path = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:q:w:k:f:s:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            points = strtoull(optarg, NULL, 10);
+            break;
+        case 'q':
+            queries = strtoull(optarg, NULL, 10);
+            break;
+        case 'w':
+            only = optarg;
+            break;
+        case 'k':
+            filter = optarg;
+            break;
+        case 'f':
+            path = optarg;
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 10) | 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (!points || !queries) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    static const struct {
+        const char *name;
+        void (*generate)(struct point *p, size_t count);
+    } generators[] = {{"uniform", generateUniform},
+                      {"clustered", generateClustered},
+                      {"polar", generatePolar},
+                      {"file", NULL}};
+
+    reportHeader();
+    for (size_t i = 0; i < sizeof(generators) / sizeof(*generators); i++) {
+        if (only && strcasecmp(only, generators[i].name))
+            continue;
+
+        struct workload w = {.name = generators[i].name};
+        w.points = malloc(sizeof(*w.points) * points);
+        w.queries = malloc(sizeof(*w.queries) * queries);
+
+        if (generators[i].generate) {
+            w.count = points;
+            w.query_count = queries;
+            generators[i].generate(w.points, points);
+            generators[i].generate(w.queries, queries);
+        } else if (path) {
+            /* Query around points of the file itself */
+            w.count = loadFile(path, w.points, points);
+            for (size_t j = 0; w.count && j < queries; j++)
+                w.queries[w.query_count++] = w.points[rng() % w.count];
+        }
+
+        if (w.count && w.query_count)
+            runWorkload(&w, filter);
+
+        free(w.points);
+        free(w.queries);
+    }
+
+    exit(EXIT_SUCCESS);
+}
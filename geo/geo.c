@@ -28,28 +28,153 @@
  */
 
 #include "geo.h"
+#include "geoasync.h"
+#include "geocache.h"
+#include "geofilter.h"
+#include "geofrozen.h"
 #include "geohash_helper.h"
 #include "geojson.h"
+#include "geoload.h"
+#include "geoparse.h"
+#include "geopart.h"
+#include "geostats.h"
+#include "geotrack.h"
+#include "geottl.h"
 #include "zset.h"
+#include <sys/mman.h>
 
 /* ====================================================================
  * Redis Add-on Module: geo
  * Provides commands: geoadd, georadius, georadiusbymember,
- *                    geoencode, geodecode
+ *                    georadiusstore, georadiusbymemberstore,
+ *                    georadiusmulti, geoscan, geoalong, geojoin,
+ *                    geodistmatrix, geoaddbin, geoload, geopartition,
+ *                    geofreeze, geothaw, geoencode, geodecode, geocache,
+ *                    geostats, geotrack, geotrackrange
  * Behaviors:
- *   - geoadd - add coordinates for value to geoset
+ *   - geoadd - add coordinates for value to geoset (optionally expiring)
+ *   - (geoadd and the radius searches take PLANAR for planar y/x meters)
+ *   - (geoadd, geoaddbin, geoload, geojoin and the radius searches take
+ *      HILBERT for Hilbert-ordered scores; like PLANAR, a key must always
+ *      be written and searched with the same choice)
+ *   - (georadius and georadiusbymember take ASYNC to filter large searches
+ *      on worker threads)
+ *   - (georadius and georadiusbymember take FILTER prefix field op value
+ *      to keep members whose hash prefix+member matches)
  *   - georadius - search radius by coordinates in geoset
  *   - georadiusbymember - search radius based on geoset member position
+ *   - georadiusstore, georadiusbymemberstore - write the results of a
+ *     radius search into a zset scored by geohash (or distance with
+ *     STOREDIST)
+ *   - georadiusmulti - search many radius centers in one pass over geoset
+ *   - geoscan - incrementally iterate a radius search with a cursor
+ *   - geoalong - search members within a distance of a path
+ *   - geojoin - find pairs of members of two geosets within a radius
+ *   - geodistmatrix - packed matrix of distances between geoset members
+ *   - geoaddbin - add packed binary coordinates for values to geoset
+ *   - geoload - bulk load a geoset from a CSV or binary file (of at most
+ *     16MB below the server's directory; split larger files into parts)
+ *   - geopartition - shard a geoset into per-cell partitions
+ *     (geoadd, geoaddbin and every search route to partitions)
+ *   - geofreeze - replace a read-mostly geoset with a compact frozen copy
+ *     (every search reads frozen copies, but it's a string to the rest of
+ *     Redis: TYPE says "string" and zset commands reply WRONGTYPE)
+ *   - geothaw - turn a frozen geoset back into a zset (writes thaw too)
  *   - geoencode - encode coordinates to a geohash integer
  *   - geodecode - decode geohash integer to representative coordinates
+ *   - geocache - configure and inspect the georadius result cache
+ *   - geostats - inspect georadius scan efficiency and stage latencies
+ *   - geostatsreset - clear georadius scan statistics
+ *   - geotrack - append a timestamped location to a member's history
+ *   - geotrackrange - read a member's history in a time window
  * ==================================================================== */
 
 /* ====================================================================
  * Helpers
  * ==================================================================== */
-static inline bool decodeGeohash(double bits, double *latlong) {
+static inline bool decodeGeohashType(uint8_t coord_type, double bits,
+                                     double *latlong) {
     GeoHashBits hash = {.bits = (uint64_t)bits, .step = GEO_STEP_MAX};
-    return geohashDecodeToLatLongWGS84(hash, latlong);
+    GEO_STATS_COUNT(decodes, 1);
+    return geohashDecodeToLatLongType(coord_type, hash, latlong);
+}
+
+static inline bool decodeGeohash(double bits, double *latlong) {
+    return decodeGeohashType(GEO_WGS84_TYPE, bits, latlong);
+}
+
+/* Distance test of a search (counted for GEOSTATS) */
+static inline bool distanceIfInRadius(uint8_t coord_type, double x1,
+                                      double y1, double x2, double y2,
+                                      double radius, double *distance) {
+    if (GEO_COORD_BASE(coord_type) == GEO_WGS84_TYPE)
+        GEO_STATS_COUNT(haversines, 1);
+    return geohashGetDistanceIfInRadius(coord_type, x1, y1, x2, y2, radius,
+                                        distance);
+}
+
+/* Input Argument Helper */
+/* PLANAR switches a command from WGS84 lat/long to planar y/x coordinates
+ * in meters (within +/- 20037726.37) with squared euclidean distances.
+ * HILBERT orders scores along the Hilbert curve instead of Z-order. */
+static bool extractCoordTypeOption(char *arg, uint8_t *coord_type) {
+    if (!strcasecmp(arg, "planar"))
+        *coord_type = GEO_MERCATOR_TYPE | (*coord_type & GEO_HILBERT);
+    else if (!strcasecmp(arg, "hilbert"))
+        *coord_type |= GEO_HILBERT;
+    else
+        return false;
+
+    return true;
+}
+
+static uint8_t extractCoordType(robj **argv, int argc) {
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    for (int i = 0; i < argc; i++) {
+        /* FILTER and STORE arguments are never options */
+        if (!strcasecmp(argv[i]->ptr, "filter"))
+            i += 4;
+        else if (!strcasecmp(argv[i]->ptr, "store") ||
+                 !strcasecmp(argv[i]->ptr, "storedist"))
+            i++;
+        else
+            extractCoordTypeOption(argv[i]->ptr, &coord_type);
+    }
+
+    return coord_type;
+}
+
+/* Is FILTER among options 'argv'? */
+static bool extractFilterOption(robj **argv, int argc) {
+    for (int i = 0; i < argc; i++)
+        if (!strcasecmp(argv[i]->ptr, "filter"))
+            return true;
+
+    return false;
+}
+
+/* Destination of STORE or STOREDIST among options 'argv' (or NULL) */
+static robj *extractStoreOption(robj **argv, int argc) {
+    for (int i = 0; i + 1 < argc; i++) {
+        if (!strcasecmp(argv[i]->ptr, "filter"))
+            i += 4;
+        else if (!strcasecmp(argv[i]->ptr, "store") ||
+                 !strcasecmp(argv[i]->ptr, "storedist"))
+            return argv[i + 1];
+    }
+
+    return NULL;
+}
+
+/* Input Argument Helper */
+/* getDoubleFromObject() for coordinate arguments, parsed with the fast
+ * decimal parser instead of strtod() */
+static inline bool extractCoordinate(robj *o, double *value) {
+    if (o->encoding == REDIS_ENCODING_INT) {
+        *value = (long)o->ptr;
+        return true;
+    }
+    return geoParseDouble(o->ptr, sdslen(o->ptr), value);
 }
 
 /* Input Argument Helper */
@@ -57,8 +182,8 @@ static inline bool decodeGeohash(double bits, double *latlong) {
 static inline bool extractLatLongOrReply(redisClient *c, robj **argv,
                                          double *latlong) {
     for (int i = 0; i < 2; i++) {
-        if (getDoubleFromObjectOrReply(c, argv[i], latlong + i, NULL) !=
-            REDIS_OK) {
+        if (!extractCoordinate(argv[i], latlong + i)) {
+            addReplyError(c, "value is not a valid float");
             return false;
         }
     }
@@ -67,42 +192,126 @@ static inline bool extractLatLongOrReply(redisClient *c, robj **argv,
 
 /* Input Argument Helper */
 /* Decode lat/long from a zset member's score */
-static bool latLongFromMember(robj *zobj, robj *member, double *latlong) {
+static bool latLongFromMember(uint8_t coord_type, robj *zobj, robj *member,
+                              double *latlong) {
     double score = 0;
 
     if (!zsetScore(zobj, member, &score))
         return false;
 
-    if (!decodeGeohash(score, latlong))
+    if (!decodeGeohashType(coord_type, score, latlong))
         return false;
 
     return true;
 }
 
-/* Input Argument Helper */
-static double extractDistanceOrReply(redisClient *c, robj **argv,
-                                     double *conversion) {
-    double distance;
-    if (getDoubleFromObjectOrReply(c, argv[0], &distance,
-                                   "need numeric radius") != REDIS_OK) {
-        return -1;
+/* Same for a member of 'key' stored as zset 'zobj', as frozen 'frozen' or
+ * (with 'part_step' set) as partitions */
+static bool latLongFromKeyMember(redisDb *db, robj *key, robj *zobj,
+                                 robj *frozen, int part_step,
+                                 uint8_t coord_type, robj *member,
+                                 double *latlong) {
+    double score;
+
+    if (part_step)
+        return geoPartScore(db, key, member, &score) &&
+               decodeGeohashType(coord_type, score, latlong);
+    else if (frozen)
+        return geoFrozenScore(frozen, member, &score) &&
+               decodeGeohashType(coord_type, score, latlong);
+    else
+        return zobj && latLongFromMember(coord_type, zobj, member, latlong);
+}
+
+/* A geo set being read, stored as a zset, as a frozen copy or (with
+ * 'part_step' set) as partitions.  All of them are NULL (and 0) for a
+ * missing key. */
+struct geoSetRead {
+    redisDb *db;
+    robj *key;
+    robj *zobj;
+    robj *frozen;
+    int part_step;
+};
+
+/* Look up geo set 'key' for reading.  Returns false after replying with
+ * 'reply' if 'key' doesn't exist, or with WRONGTYPE if it isn't a geo set.
+ * With a NULL 'reply' a missing key reads as an empty set. */
+static bool lookupGeoSetReadOrReply(redisClient *c, robj *key, robj *reply,
+                                    struct geoSetRead *set) {
+    robj *o = lookupKeyRead(c->db, key);
+
+    *set = (struct geoSetRead){.db = c->db, .key = key};
+    if ((!o || o->type != REDIS_ZSET) &&
+        geoPartStep(c->db, key, &set->part_step))
+        return true;
+
+    if (!o) {
+        if (reply)
+            addReply(c, reply);
+        return !reply;
     }
 
-    double to_meters;
-    sds units = argv[1]->ptr;
+    if (geoFrozenIs(o))
+        set->frozen = o;
+    else if (checkType(c, o, REDIS_ZSET))
+        return false;
+    else
+        set->zobj = o;
+
+    return true;
+}
+
+static inline bool geoSetExists(struct geoSetRead *set) {
+    return set->zobj || set->frozen || set->part_step;
+}
+
+/* Visit members of 'set' scored in [min, max) in score order.  Returns
+ * false if 'visit' stopped us early. */
+static bool geoSetVisit(struct geoSetRead *set, double min, double max,
+                        zsetRangeVisitor *visit, void *privdata) {
+    if (set->part_step)
+        return geoPartVisit(set->db, set->key, set->part_step, min, max,
+                            visit, privdata);
+    else if (set->frozen)
+        return geoFrozenVisit(set->frozen, min, max, visit, privdata);
+    else if (set->zobj)
+        return geozrangeVisit(set->zobj, min, max, visit, privdata);
+
+    return true;
+}
+
+/* Input Argument Helper */
+/* Returns meters per 'unit' or -1 after replying with an error */
+static double extractUnitOrReply(redisClient *c, robj *unit) {
+    sds units = unit->ptr;
     if (!strcmp(units, "m") || !strncmp(units, "meter", 5)) {
-        to_meters = 1;
+        return 1;
     } else if (!strcmp(units, "ft") || !strncmp(units, "feet", 4)) {
-        to_meters = 0.3048;
+        return 0.3048;
     } else if (!strcmp(units, "mi") || !strncmp(units, "mile", 4)) {
-        to_meters = 1609.34;
+        return 1609.34;
     } else if (!strcmp(units, "km") || !strncmp(units, "kilometer", 9)) {
-        to_meters = 1000;
+        return 1000;
     } else {
         addReplyError(c, "unsupported unit provided. please use meters (m), "
                          "kilometers (km), miles (mi), or feet (ft)");
         return -1;
     }
+}
+
+/* Input Argument Helper */
+static double extractDistanceOrReply(redisClient *c, robj **argv,
+                                     double *conversion) {
+    double distance;
+    if (getDoubleFromObjectOrReply(c, argv[0], &distance,
+                                   "need numeric radius") != REDIS_OK) {
+        return -1;
+    }
+
+    double to_meters = extractUnitOrReply(c, argv[1]);
+    if (to_meters < 0)
+        return -1;
 
     if (conversion)
         *conversion = to_meters;
@@ -122,12 +331,13 @@ static void latLongToGeojsonAndReply(redisClient *c, struct geojsonPoint *gp,
 
 /* Output Reply Helper */
 static void decodeGeohashToGeojsonBoundsAndReply(redisClient *c,
+                                                 uint8_t coord_type,
                                                  uint64_t hashbits,
                                                  struct geojsonPoint *gp) {
     GeoHashArea area = {{0}};
     GeoHashBits hash = {.bits = hashbits, .step = GEO_STEP_MAX};
 
-    geohashDecodeWGS84(hash, &area);
+    geohashDecodeType(coord_type, hash, &area);
 
     sds geojson = geojsonBoxToPolygonFeature(
         area.latitude.min, area.longitude.min, area.latitude.max,
@@ -153,44 +363,102 @@ static void replyGeojsonCollection(redisClient *c, struct geojsonPoint *gp,
     sdsfree(geojson);
 }
 
-/* geohash range+zset access helper */
-/* Obtain all members between the min/max of this geohash bounding box. */
-/* Returns list of results.  List must be listRelease()'d later. */
-static list *membersOfGeoHashBox(robj *zobj, GeoHashBits hash) {
-    GeoHashFix52Bits min, max;
+/* Collect the non-empty cells (self + eight neighbors) of a radius search */
+static int cellsOfRadius(GeoHashRadius n, GeoHashBits *cells) {
+    GeoHashBits all[9] = {n.hash,
+                          n.neighbors.north,
+                          n.neighbors.south,
+                          n.neighbors.east,
+                          n.neighbors.west,
+                          n.neighbors.north_east,
+                          n.neighbors.north_west,
+                          n.neighbors.south_east,
+                          n.neighbors.south_west};
+    int count = 0;
+
+    for (int i = 0; i < sizeof(all) / sizeof(*all); i++)
+        if (!HASHISZERO(all[i]))
+            cells[count++] = all[i];
+
+    return count;
+}
+
+/* A half-open range [min, max) of 52-bit scores.  'query' remembers which
+ * search asked for the range when ranges of many searches are combined. */
+struct geoRange {
+    double min;
+    double max;
+    int query;
+};
+
+/* Append the score ranges covering the cells of a radius search */
+static int rangesOfRadius(GeoHashRadius n, struct geoRange *ranges,
+                          int query) {
+    GeoHashBits cells[9];
+    int count = cellsOfRadius(n, cells);
+
+    for (int i = 0; i < count; i++) {
+        ranges[i].min = geohashAlign52Bits(cells[i]);
+        cells[i].bits++;
+        ranges[i].max = geohashAlign52Bits(cells[i]);
+        ranges[i].query = query;
+    }
+
+    return count;
+}
+
+static int sort_range_asc(const void *a, const void *b) {
+    const struct geoRange *ra = a, *rb = b;
+    if (ra->min > rb->min)
+        return 1;
+    else if (ra->min == rb->min)
+        return 0;
+    else
+        return -1;
+}
+
+/* Sort ranges and merge overlapping or touching ranges in place so the
+ * zset is never scanned twice over the same scores.  Returns the new count. */
+static int mergeRanges(struct geoRange *ranges, int count) {
+    if (!count)
+        return 0;
+
+    qsort(ranges, count, sizeof(*ranges), sort_range_asc);
 
-    min = geohashAlign52Bits(hash);
-    hash.bits++;
-    max = geohashAlign52Bits(hash);
+    int merged = 0;
+    for (int i = 1; i < count; i++) {
+        if (ranges[i].min <= ranges[merged].max) {
+            if (ranges[i].max > ranges[merged].max)
+                ranges[merged].max = ranges[i].max;
+        } else {
+            ranges[++merged] = ranges[i];
+        }
+    }
 
-    return geozrangebyscore(zobj, min, max, -1); /* -1 = no limit */
+    return merged + 1;
 }
 
 /* Search all eight neighbors + self geohash box */
-static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
-                                   double y, double radius) {
+/* Planar searches report squared distances.  Members within 'radius' must
+ * also pass 'filter' (if not NULL). */
+static list *membersOfAllNeighbors(uint8_t coord_type, robj *zobj,
+                                   GeoHashRadius n, double x, double y,
+                                   double radius, struct geoFilter *filter) {
     list *l = NULL;
-    GeoHashBits neighbors[9];
-
-    neighbors[0] = n.hash;
-    neighbors[1] = n.neighbors.north;
-    neighbors[2] = n.neighbors.south;
-    neighbors[3] = n.neighbors.east;
-    neighbors[4] = n.neighbors.west;
-    neighbors[5] = n.neighbors.north_east;
-    neighbors[6] = n.neighbors.north_west;
-    neighbors[7] = n.neighbors.south_east;
-    neighbors[8] = n.neighbors.south_west;
-
-    /* For each neighbor (*and* our own hashbox), get all the matching
-     * members and add them to the potential result list. */
-    for (int i = 0; i < sizeof(neighbors) / sizeof(*neighbors); i++) {
+    struct geoRange ranges[9];
+    int cells = rangesOfRadius(n, ranges, 0);
+    int count = mergeRanges(ranges, cells);
+    GEO_STATS_COUNT(cells, cells);
+    GEO_STATS_COUNT(ranges, count);
+
+    /* For each range of neighbors (*and* our own hashbox), get all the
+     * matching members and add them to the potential result list. */
+    long long stage = geoStatsStageStart();
+    for (int i = 0; i < count; i++) {
         list *r;
 
-        if (HASHISZERO(neighbors[i]))
-            continue;
-
-        r = membersOfGeoHashBox(zobj, neighbors[i]);
+        /* -1 = no limit */
+        r = geozrangebyscore(zobj, ranges[i].min, ranges[i].max, -1);
         if (!r)
             continue;
 
@@ -200,14 +468,18 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
             listJoin(l, r);
         }
     }
+    geoStatsStageEnd(GEO_STATS_SCAN, stage);
 
     /* if no results across any neighbors (*and* ourself, which is unlikely),
      * then just give up. */
     if (!l)
         return NULL;
 
+    GEO_STATS_COUNT(candidates, listLength(l));
+    stage = geoStatsStageStart();
+
     /* Iterate over all matching results in the combined 9-grid search area */
-    /* Remove any results outside of our search radius. */
+    /* Remove any results outside of our search radius (or filtered out). */
     listIter li;
     listNode *ln;
     listRewind(l, &li);
@@ -216,7 +488,8 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
         GeoHashArea area = {{0}};
         GeoHashBits hash = {.bits = (uint64_t)zr->score, .step = GEO_STEP_MAX};
 
-        if (!geohashDecodeWGS84(hash, &area)) {
+        GEO_STATS_COUNT(decodes, 1);
+        if (!geohashDecodeType(coord_type, hash, &area)) {
             /* Perhaps we should delete this node if the decode fails? */
             continue;
         }
@@ -225,8 +498,8 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
         double neighbor_x = (area.longitude.min + area.longitude.max) / 2;
 
         double distance;
-        if (!geohashGetDistanceIfInRadiusWGS84(x, y, neighbor_x, neighbor_y,
-                                               radius, &distance)) {
+        if (!distanceIfInRadius(coord_type, x, y, neighbor_x, neighbor_y,
+                                radius, &distance)) {
             /* If result is in the grid, but not in our radius, remove it. */
             listDelNode(l, ln);
 #ifdef DEBUG
@@ -234,6 +507,15 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
                             "distance %f\n",
                     neighbor_y, neighbor_x, y, x, distance);
 #endif
+        } else if (filter &&
+                   !geoFilterMatch(filter,
+                                   zr->type == ZR_STRING
+                                       ? (unsigned char *)zr->val.s
+                                       : NULL,
+                                   zr->type == ZR_STRING ? sdslen(zr->val.s)
+                                                         : 0,
+                                   zr->val.v)) {
+            listDelNode(l, ln);
         } else {
 /* Else: bueno. */
 #ifdef DEBUG
@@ -245,6 +527,8 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
             zr->distance = distance;
         }
     }
+    geoStatsStageEnd(GEO_STATS_FILTER, stage);
+    GEO_STATS_COUNT(accepted, listLength(l));
 
     /* We found results, but rejected all of them as out of range. Clean up. */
     if (!listLength(l)) {
@@ -256,14 +540,29 @@ static list *membersOfAllNeighbors(robj *zobj, GeoHashRadius n, double x,
     return l;
 }
 
+/* Create a result for a member handed to a zsetRangeVisitor */
+static struct zipresult *visitedResult(double score, unsigned char *str,
+                                       unsigned int len, long long vlong,
+                                       double distance) {
+    struct zipresult *zr =
+        str ? result_str(score, str, len) : result_long(score, vlong);
+    zr->distance = distance;
+    return zr;
+}
+
 /* With no subscribers, each call of this function adds a median latency of 2
  * microseconds. */
 /* We aren't participating in any keyspace/keyevent notifications other than
  * what's provided by the underlying zset itself, but it's probably not useful
  * for clients to get the 52-bit integer geohash as an "update" value. */
+/* Writes propagated as something other than themselves (GEOADD becomes
+ * ZADD) pass the 'dbid' of their key: replicas don't publish the rewritten
+ * commands, so the PUBLISH itself goes to replicas (not the AOF).  It's
+ * queued with alsoPropagate() so replicas get it after the write it
+ * announces.  Writes replicas run as themselves pass -1. */
 static int publishLocationUpdate(const sds zset, const sds member,
                                  const double latitude,
-                                 const double longitude) {
+                                 const double longitude, int dbid) {
     int published;
 
     /* event is: "<latitude> <longitude>" */
@@ -281,6 +580,18 @@ static int publishLocationUpdate(const sds zset, const sds member,
 
     published = pubsubPublishMessage(chanobj, eventobj);
 
+    if (dbid >= 0 && (server.repl_backlog || listLength(server.slaves))) {
+        /* alsoPropagate() takes ownership of 'argv' and its references */
+        robj **argv = zmalloc(sizeof(*argv) * 3);
+        argv[0] = createStringObject("publish", 7);
+        argv[1] = chanobj;
+        argv[2] = eventobj;
+        incrRefCount(chanobj);
+        incrRefCount(eventobj);
+        alsoPropagate(lookupCommandByCString("publish"), dbid, argv, 3,
+                      REDIS_PROPAGATE_REPL);
+    }
+
     decrRefCount(chanobj);
     decrRefCount(eventobj);
 
@@ -307,223 +618,694 @@ static int sort_gp_desc(const void *a, const void *b) {
 /* ====================================================================
  * Commands
  * ==================================================================== */
-void geoAddCommand(redisClient *c) {
-    /* args 0-4: [cmd, key, lat, lng, val]; optional 5-6: [radius, units]
-     * - OR -
-     * args 0-N: [cmd, key, lat, lng, val, lat2, lng2, val2, ...] */
+/* Replace the client's argument vector with 'argv' (taking ownership of
+ * 'argv' and the references it holds).  Used to rewrite what we propagate to
+ * replicas and the AOF. */
+static void replaceClientArgv(redisClient *c, int argc, robj **argv) {
+    for (int i = 0; i < c->argc; i++)
+        decrRefCount(c->argv[i]);
+    zfree(c->argv);
+
+    c->argc = argc;
+    c->argv = argv;
+}
+
+/* Replace frozen 'o' stored at 'key' with a zset copy */
+static robj *geoThaw(redisDb *db, robj *key, robj *o) {
+    o = geoFrozenThaw(o);
+    dbOverwrite(db, key, o);
+    return o;
+}
+
+/* Writes that can't be propagated as themselves (GEOLOAD, GEOADD into
+ * partitions) propagate the commands making the same change instead.  More
+ * than one command is wrapped in MULTI/EXEC (unless we already run inside
+ * a transaction) so they're applied as one.  Every command but the last is
+ * propagated right away; the last one replaces the client's argv so call()
+ * propagates it instead of the write itself. */
+struct geoPropagation {
+    redisClient *c;
+    int remaining; /* commands left, including EXEC */
+    bool wrap;
+};
+
+static robj **geoCommandArgv(int argc, char *cmd) {
+    robj **argv = zmalloc(sizeof(*argv) * argc);
+    argv[0] = createStringObject(cmd, strlen(cmd));
+    return argv;
+}
+
+/* Takes ownership of 'argv' */
+static void geoPropagate(struct geoPropagation *prop, robj **argv,
+                             int argc) {
+    redisClient *c = prop->c;
+
+    if (--prop->remaining) {
+        struct redisCommand *cmd = lookupCommandByCString(argv[0]->ptr);
+        propagate(cmd, c->db->id, argv, argc,
+                  REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+        for (int i = 0; i < argc; i++)
+            decrRefCount(argv[i]);
+        zfree(argv);
+    } else {
+        replaceClientArgv(c, argc, argv);
+    }
+}
+
+static void geoPropagateBegin(struct geoPropagation *prop,
+                                  redisClient *c, int commands) {
+    prop->c = c;
+    prop->wrap = commands > 1 && !(c->flags & REDIS_MULTI);
+    prop->remaining = commands + prop->wrap * 2;
+    if (prop->wrap)
+        geoPropagate(prop, geoCommandArgv(1, "multi"), 1);
+}
+
+static void geoPropagateEnd(struct geoPropagation *prop) {
+    if (prop->wrap)
+        geoPropagate(prop, geoCommandArgv(1, "exec"), 1);
+}
+
+/* Writes turn frozen keys back into zsets first.  Not every write is
+ * propagated as itself (GEOLOAD propagates ZADDs), so replicas and the AOF
+ * get a GEOTHAW ahead of the write.  Partitions left behind by a deleted
+ * root are dropped first, so a new key never sees them. */
+static robj *lookupGeoKeyWrite(redisClient *c, robj *key) {
+    geoPartDropStale(c->db, key);
+
+    robj *o = lookupKeyWrite(c->db, key);
+    if (!o || !geoFrozenIs(o))
+        return o;
+
+    o = geoThaw(c->db, key, o);
+
+    robj *argv[2] = {createStringObject("geothaw", 7), key};
+    propagate(lookupCommandByCString("geothaw"), c->db->id, argv, 2,
+              REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+    decrRefCount(argv[0]);
+    return o;
+}
+
+/* Build [zadd, key, score1, member1, ...] from 'count' members found every
+ * 'stride' entries of 'members' (taking references).  GEOADD propagates
+ * this instead of itself so replicas and the AOF never encode coordinates
+ * (or look at the clock or at MOVE thresholds) on their own. */
+static robj **geoAddZaddArgv(robj *key, GeoHashFix52Bits *scores,
+                             robj **members, int stride, int count) {
+    robj **argv = zmalloc(sizeof(*argv) * (2 + count * 2));
+    int argc = 0;
+
+    argv[argc++] = createStringObject("zadd", 4);
+    argv[argc++] = key;
+    incrRefCount(key);
+    for (int i = 0; i < count; i++) {
+        argv[argc++] = createObject(REDIS_STRING, sdsfromlonglong(scores[i]));
+        argv[argc++] = members[i * stride];
+        incrRefCount(members[i * stride]);
+    }
+
+    return argv;
+}
+
+/* GEOADD MOVE: an existing member whose new score keeps it between its
+ * current skiplist neighbors gets its score updated in place instead of
+ * being removed and re-inserted by ZADD.  Every score change is propagated;
+ * moves of at most 'threshold' meters just aren't published. */
+static void geoAddMove(redisClient *c, int first, int elements,
+                       double *latlong, uint8_t coord_type, uint8_t step,
+                       double threshold) {
     robj *cmd = c->argv[0];
     robj *key = c->argv[1];
 
-    /* Prepare for the three different forms of the add command. */
-    double radius_meters = 0;
-    if (c->argc == 7) {
-        if ((radius_meters = extractDistanceOrReply(c, c->argv + 5, NULL)) <
-            0) {
-            return;
+    robj *zobj = lookupKeyWrite(c->db, key);
+    redisClient *client = NULL; /* fake client for zadd, created on demand */
+    long long dirty = server.dirty;
+    /* Of changed members (on the heap: GEOADD may be given a lot of them) */
+    GeoHashFix52Bits *scores = zmalloc(sizeof(*scores) * elements);
+    robj **members = zmalloc(sizeof(*members) * elements);
+    int added = 0, updated_in_place = 0, changed = 0;
+
+    for (int i = 0; i < elements; i++) {
+        GeoHashBits hash;
+        double latitude = latlong[i * 2];
+        double longitude = latlong[i * 2 + 1];
+        geohashEncodeType(coord_type, latitude, longitude, step, &hash);
+
+        GeoHashFix52Bits bits = geohashAlign52Bits(hash);
+        robj *val = c->argv[first + i * 3 + 2];
+
+        double oldscore;
+        bool in_place = false, publish = true;
+        if (zobj && zsetScore(zobj, val, &oldscore)) {
+            if ((GeoHashFix52Bits)oldscore == bits) {
+                /* Same cell as before.  Nothing to do. */
+                continue;
+            }
+
+            double old_latlong[2], moved;
+            decodeGeohashType(coord_type, oldscore, old_latlong);
+            publish = !geohashGetDistanceIfInRadius(
+                coord_type, old_latlong[1], old_latlong[0], longitude,
+                latitude, threshold, &moved);
+
+            in_place = zsetUpdateScoreInPlace(zobj, val, bits);
+            if (in_place)
+                updated_in_place++;
+        } else {
+            added++;
         }
-    } else if (c->argc == 6) {
-        addReplyError(c, "must provide units when asking for radius encode");
-        return;
-    } else if ((c->argc - 2) % 3 != 0) {
-        /* Need an odd number of arguments if we got this far... */
-        addReplyError(c, "format is: geoadd [key] [lat1] [long1] [member1] "
-                         "[lat2] [long2] [member2] ... ");
-        return;
+
+        /* New member or the member changes position in the zset: use zadd */
+        if (!in_place) {
+            if (!client) {
+                client = createClient(-1);
+                selectDb(client, c->db->id);
+            }
+
+            robj *score = createObject(REDIS_STRING, sdsfromlonglong(bits));
+            rewriteClientCommandVector(client, 4, cmd, key, score, val);
+            decrRefCount(score);
+            zaddCommand(client);
+
+            /* zadd may have created the zset or converted its encoding */
+            zobj = lookupKeyWrite(c->db, key);
+        }
+
+        scores[changed] = bits;
+        members[changed++] = val;
+        if (publish)
+            publishLocationUpdate(key->ptr, val->ptr, latitude, longitude,
+                                  c->db->id);
     }
 
-    redisClient *client = c;
-    int elements = (c->argc - 2) / 3;
-    /* elements will always be correct size (integer math floors for us if we
-     * have 6 or 7 total arguments) */
-    if (elements > 1) {
-        /* We should probably use a static client and not create/free it
-         * for every multi-add */
-        client = createClient(-1); /* fake client for multi-zadd */
+    if (client)
+        freeClient(client);
 
-        /* Tell fake client to use the same DB as our calling client. */
-        selectDb(client, c->db->id);
+    /* In-place updates bypass zadd, so announce the key changed ourselves */
+    if (updated_in_place) {
+        signalModifiedKey(c->db, key);
+        notifyKeyspaceEvent(REDIS_NOTIFY_ZSET, "zadd", key, c->db->id);
     }
 
-    /* Capture all lat/long components up front so if we encounter an error we
-     * return before making any changes to the database. */
-    double latlong[elements * 2];
+    geoCacheKeyModified(c->db, key);
+
+    /* Replicas and the AOF see every changed member as one ZADD of their
+     * new scores.  (Replicas end up with the same zset whether or not we
+     * updated in place.) */
+    server.dirty = dirty + changed;
+    addReplyLongLong(c, added);
+    if (changed)
+        replaceClientArgv(c, 2 + changed * 2,
+                          geoAddZaddArgv(key, scores, members, 1, changed));
+
+    zfree(scores);
+    zfree(members);
+}
+
+/* GEOADD into a partitioned key: each member goes to the partition of its
+ * cell (leaving its old partition if it moved).  With MOVE ('threshold'
+ * isn't negative), moves of at most 'threshold' meters aren't published.
+ * Like unpartitioned GEOADD, replicas and the AOF get the resulting writes
+ * (of the root, partitions and directory) rather than coordinates. */
+static void geoAddPartitioned(redisClient *c, int first, int elements,
+                              double *latlong, uint8_t coord_type,
+                              uint8_t step, int part_step, double threshold) {
+    robj *key = c->argv[1];
+    long added = 0, changed = 0;
+    list *replay = listCreate();
+
     for (int i = 0; i < elements; i++) {
-        if (!extractLatLongOrReply(c, (c->argv + 2) + (i * 3),
-                                   latlong + (i * 2)))
-            return;
+        GeoHashBits hash;
+        double latitude = latlong[i * 2];
+        double longitude = latlong[i * 2 + 1];
+        geohashEncodeType(coord_type, latitude, longitude, step, &hash);
+
+        robj *val = c->argv[first + i * 3 + 2];
+        bool publish = true;
+        double oldscore;
+        if (threshold >= 0 &&
+            geoPartScore(c->db, key, val, &oldscore)) {
+            double old_latlong[2], moved;
+            decodeGeohashType(coord_type, oldscore, old_latlong);
+            publish = !geohashGetDistanceIfInRadius(
+                coord_type, old_latlong[1], old_latlong[0], longitude,
+                latitude, threshold, &moved);
+        }
+
+        bool member_changed;
+        added += geoPartAdd(c->db, key, part_step, val,
+                            geohashAlign52Bits(hash), &member_changed,
+                            replay);
+        changed += member_changed;
+
+        /* MOVE doesn't publish members staying in place either */
+        if (publish && (threshold < 0 || member_changed))
+            publishLocationUpdate(key->ptr, val->ptr, latitude, longitude,
+                                  c->db->id);
     }
 
-    /* Add all (lat, long, value) triples to the requested zset */
-    for (int i = 0; i < elements; i++) {
-        uint8_t step = geohashEstimateStepsByRadius(radius_meters);
+    if (changed) {
+        signalModifiedKey(c->db, key);
+        notifyKeyspaceEvent(REDIS_NOTIFY_ZSET, "zadd", key, c->db->id);
+        server.dirty += changed;
+        geoCacheKeyModified(c->db, key);
+
+        struct geoPropagation prop;
+        geoPropagateBegin(&prop, c, listLength(replay));
+        listIter li;
+        listNode *ln;
+        listRewind(replay, &li);
+        while ((ln = listNext(&li))) {
+            struct geoPartCommand *command = listNodeValue(ln);
+            geoPropagate(&prop, command->argv, command->argc);
+            zfree(command);
+        }
+        geoPropagateEnd(&prop);
+    }
 
-#ifdef DEBUG
-        printf("Adding with step size: %d\n", step);
-#endif
+    listRelease(replay);
+    addReplyLongLong(c, added);
+}
+
+/* Plain GEOADD: every (lat, long, value) triple goes into the zset with one
+ * variadic zadd, which is also what call() propagates when we return.  One
+ * member replies with zadd's count of added members, more reply with the
+ * number of members given (zadd then runs on a fake client). */
+static void geoAddZadd(redisClient *c, int first, int elements,
+                       double *latlong, uint8_t coord_type, uint8_t step) {
+    robj *key = c->argv[1];
+    robj **members = c->argv + first + 2;
+    GeoHashFix52Bits *scores = zmalloc(sizeof(*scores) * elements);
+
+    for (int i = 0; i < elements; i++) {
         GeoHashBits hash;
         int ll_offset = i * 2;
         double latitude = latlong[ll_offset];
         double longitude = latlong[ll_offset + 1];
-        geohashEncodeWGS84(latitude, longitude, step, &hash);
+        geohashEncodeType(coord_type, latitude, longitude, step, &hash);
+        scores[i] = geohashAlign52Bits(hash);
 
-        GeoHashFix52Bits bits = geohashAlign52Bits(hash);
-        robj *score = createObject(REDIS_STRING, sdsfromlonglong(bits));
-        robj *val = c->argv[2 + i * 3 + 2];
-        /* (base args) + (offset for this triple) + (offset of value arg) */
+        /* Before zadd, which may re-encode the member objects */
+        publishLocationUpdate(key->ptr, members[i * 3]->ptr, latitude,
+                              longitude, c->db->id);
+    }
 
-        sds orig_val = sdsdup(val->ptr); /* zadd potentially compresses val */
-        rewriteClientCommandVector(client, 4, cmd, key, score, val);
-        decrRefCount(score);
+    int argc = 2 + elements * 2;
+    if (elements == 1) {
+        replaceClientArgv(c, argc,
+                          geoAddZaddArgv(key, scores, members, 3, elements));
+        zaddCommand(c);
+    } else {
+        redisClient *client = createClient(-1);
+        selectDb(client, c->db->id);
+        replaceClientArgv(client, argc,
+                          geoAddZaddArgv(key, scores, members, 3, elements));
         zaddCommand(client);
-        publishLocationUpdate(key->ptr, orig_val, latitude, longitude);
-        sdsfree(orig_val);
-    }
+        freeClient(client);
 
-    /* If we used a fake client, return a real reply then free fake client. */
-    if (client != c) {
+        replaceClientArgv(c, argc,
+                          geoAddZaddArgv(key, scores, members, 3, elements));
         addReplyLongLong(c, elements);
-        freeClient(client);
     }
-}
 
-#define SORT_NONE 0
-#define SORT_ASC 1
-#define SORT_DESC 2
-
-#define RADIUS_COORDS 1
-#define RADIUS_MEMBER 2
+    zfree(scores);
+    geoCacheKeyModified(c->db, key);
+}
 
-static void geoRadiusGeneric(redisClient *c, int type) {
-    /* type == cords:  [cmd, key, lat, long, radius, units, [optionals]]
-     * type == member: [cmd, key, member,    radius, units, [optionals]] */
+/* GEOADD once its arguments are parsed.  'move_threshold' is negative
+ * without MOVE. */
+static void geoAddLatLongs(redisClient *c, int first, int elements,
+                           double *latlong, uint8_t coord_type, uint8_t step,
+                           double move_threshold, long long expire_seconds) {
     robj *key = c->argv[1];
-
-    /* Look up the requested zset */
-    robj *zobj = NULL;
-    if ((zobj = lookupKeyReadOrReply(c, key, shared.emptymultibulk)) == NULL ||
-        checkType(c, zobj, REDIS_ZSET)) {
-        return;
-    }
-
-    /* Find lat/long to use for radius search based on inquiry type */
-    int base_args;
-    double latlong[2] = {0};
-    if (type == RADIUS_COORDS) {
-        base_args = 6;
-        if (!extractLatLongOrReply(c, c->argv + 2, latlong))
-            return;
-    } else if (type == RADIUS_MEMBER) {
-        base_args = 5;
-        robj *member = c->argv[2];
-        if (!latLongFromMember(zobj, member, latlong)) {
-            addReplyError(c, "could not decode requested zset member");
+    robj *zobj = lookupGeoKeyWrite(c, key);
+    int part_step;
+    if ((!zobj || zobj->type != REDIS_ZSET) &&
+        geoPartStep(c->db, key, &part_step)) {
+        if (expire_seconds) {
+            addReplyError(c, "EX isn't supported by partitioned keys");
             return;
         }
-    } else {
-        addReplyError(c, "unknown georadius search type");
+        geoAddPartitioned(c, first, elements, latlong, coord_type, step,
+                          part_step, move_threshold);
         return;
     }
 
-    /* Extract radius and units from arguments */
-    double radius_meters = 0, conversion = 1;
-    if ((radius_meters = extractDistanceOrReply(c, c->argv + base_args - 2,
-                                                &conversion)) < 0) {
+    if (zobj && checkType(c, zobj, REDIS_ZSET))
         return;
-    }
 
-    sds units = c->argv[base_args - 2 + 1]->ptr;
+    /* Drop expired members first so re-added members get a fresh start.
+     * A new key drops expire times left behind by a deleted one. */
+    if (zobj)
+        geoTtlReap(c->db, key, GEO_TTL_REAP_PER_COMMAND);
+    else
+        geoTtlDelete(c->db, key);
 
-    /* Discover and populate all optional parameters. */
-    bool withdist = false, withhash = false, withcoords = false,
-         withgeojson = false, withgeojsonbounds = false,
-         withgeojsoncollection = false, noproperties = false;
-    int sort = SORT_NONE;
-    if (c->argc > base_args) {
-        int remaining = c->argc - base_args;
-        for (int i = 0; i < remaining; i++) {
-            char *arg = c->argv[base_args + i]->ptr;
-            if (!strncasecmp(arg, "withdist", 8))
-                withdist = true;
-            else if (!strcasecmp(arg, "withhash"))
-                withhash = true;
-            else if (!strncasecmp(arg, "withcoord", 9))
-                withcoords = true;
-            else if (!strncasecmp(arg, "withgeojsonbound", 16))
-                withgeojsonbounds = true;
-            else if (!strncasecmp(arg, "withgeojsoncollection", 21))
-                withgeojsoncollection = true;
-            else if (!strncasecmp(arg, "withgeo", 7) ||
-                     !strcasecmp(arg, "geojson") || !strcasecmp(arg, "json") ||
-                     !strcasecmp(arg, "withjson"))
-                withgeojson = true;
-            else if (!strncasecmp(arg, "noprop", 6) ||
-                     !strncasecmp(arg, "withoutprop", 11))
-                noproperties = true;
-            else if (!strncasecmp(arg, "asc", 3) ||
-                     !strncasecmp(arg, "sort", 4))
-                sort = SORT_ASC;
-            else if (!strncasecmp(arg, "desc", 4))
-                sort = SORT_DESC;
-            else {
-                addReply(c, shared.syntaxerr);
+    /* Members added with EX get a new expire time, others lose theirs. */
+    robj **members = c->argv + first + 2;
+    if (expire_seconds)
+        geoTtlSet(c->db, key, members, 3, elements,
+                  mstime() + expire_seconds * 1000);
+    else
+        geoTtlClear(c->db, key, members, 3, elements);
+
+    if (move_threshold >= 0)
+        geoAddMove(c, first, elements, latlong, coord_type, step,
+                   move_threshold);
+    else
+        geoAddZadd(c, first, elements, latlong, coord_type, step);
+}
+
+void geoAddCommand(redisClient *c) {
+    /* args 0-4: [cmd, key, lat, lng, val]; optional 5-6: [radius, units]
+     * - OR -
+     * args 0-N: [cmd, key, lat, lng, val, lat2, lng2, val2, ...]
+     * - AND -
+     * options between key and lat: [move, threshold, units], [ex, seconds],
+     *                                [planar], [hilbert] */
+
+    /* Discover options preceding the first lat/long/member triple.  Options
+     * are never numeric, so they can't be confused with a latitude. */
+    int first = 2;
+    bool move = false;
+    double move_threshold = 0;
+    long long expire_seconds = 0;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    while (first < c->argc) {
+        char *arg = c->argv[first]->ptr;
+        if (extractCoordTypeOption(arg, &coord_type)) {
+            first++;
+        } else if (!strcasecmp(arg, "move") && first + 2 < c->argc) {
+            if ((move_threshold = extractDistanceOrReply(
+                     c, c->argv + first + 1, NULL)) < 0)
+                return;
+            move = true;
+            first += 3;
+        } else if (!strcasecmp(arg, "ex") && first + 1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c, c->argv[first + 1],
+                                             &expire_seconds, NULL) != REDIS_OK)
+                return;
+            if (expire_seconds <= 0) {
+                addReplyError(c, "invalid expire time in geoadd");
                 return;
             }
+            first += 2;
+        } else {
+            break;
         }
     }
 
-    bool withgeo = withgeojsonbounds || withgeojsoncollection || withgeojson;
+    /* Prepare for the three different forms of the add command. */
+    int remaining = c->argc - first;
+    double radius_meters = 0;
+    if (remaining == 5) {
+        if ((radius_meters = extractDistanceOrReply(c, c->argv + first + 3,
+                                                    NULL)) < 0) {
+            return;
+        }
+    } else if (remaining == 4) {
+        addReplyError(c, "must provide units when asking for radius encode");
+        return;
+    } else if (remaining == 0 || remaining % 3 != 0) {
+        /* Need an odd number of arguments if we got this far... */
+        addReplyError(c, "format is: geoadd [key] [move threshold units] "
+                         "[ex seconds] [planar] [hilbert] [lat1] [long1] "
+                         "[member1] "
+                         "[lat2] [long2] [member2] ... ");
+        return;
+    }
 
-    /* Get all neighbor geohash boxes for our radius search */
-    GeoHashRadius georadius =
-        geohashGetAreasByRadiusWGS84(latlong[0], latlong[1], radius_meters);
+    int elements = remaining / 3;
+    /* elements will always be correct size (integer math floors for us if we
+     * have 4 or 5 remaining arguments) */
 
+    /* Capture all lat/long components up front so if we encounter an error we
+     * return before making any changes to the database.  (On the heap, since
+     * a GEOADD may carry a lot of members.) */
+    double *latlong = zmalloc(sizeof(*latlong) * elements * 2);
+    for (int i = 0; i < elements; i++) {
+        if (!extractLatLongOrReply(c, (c->argv + first) + (i * 3),
+                                   latlong + (i * 2))) {
+            zfree(latlong);
+            return;
+        }
+
+        /* Planar coordinates outside the grid can't be encoded. */
+        if (GEO_COORD_BASE(coord_type) == GEO_MERCATOR_TYPE &&
+            !geohashVerifyCoordinates(coord_type, latlong[i * 2 + 1],
+                                      latlong[i * 2])) {
+            addReplyError(c, "planar coordinates must be within "
+                             "+/- 20037726.37");
+            zfree(latlong);
+            return;
+        }
+    }
+
+    uint8_t step = geohashEstimateStepsByRadius(radius_meters);
 #ifdef DEBUG
-    printf("Searching with step size: %d\n", georadius.hash.step);
+    printf("Adding with step size: %d\n", step);
 #endif
-    /* {Lat, Long} = {y, x} */
-    double y = latlong[0];
-    double x = latlong[1];
 
-    /* Search the zset for all matching points */
-    list *found_matches =
-        membersOfAllNeighbors(zobj, georadius, x, y, radius_meters);
+    geoAddLatLongs(c, first, elements, latlong, coord_type, step,
+                   move ? move_threshold : -1, expire_seconds);
+    zfree(latlong);
+}
 
-    /* If no matching results, the user gets an empty reply. */
-    if (!found_matches) {
-        addReply(c, shared.emptymultibulk);
-        return;
+#define RADIUS_COORDS 1
+#define RADIUS_MEMBER 2
+
+/* Reply options shared by every command returning search results */
+struct geoReplyOptions {
+    bool withdist, withhash, withcoords, withgeojson, withgeojsonbounds,
+        withgeojsoncollection, noproperties;
+    bool async; /* hint: filter large searches on a worker thread */
+    int sort;
+    uint8_t coord_type; /* GEO_MERCATOR_TYPE distances are squared */
+    double conversion;  /* meters per requested unit */
+    char *units;
+    struct geoFilter filter; /* op is GEO_FILTER_NONE without FILTER */
+    robj *store;             /* STORE or STOREDIST destination */
+    bool storedist;
+};
+
+/* Parse [withdist, withhash, withcoords, withgeojson..., asc|desc, planar,
+ * hilbert, async] (and, for radius searches, [filter prefix field op value]
+ * and [store|storedist key]) from 'argv'.  'units' and 'conversion' come
+ * from the distance argument. */
+static bool extractReplyOptionsOrReply(redisClient *c, robj **argv, int argc,
+                                       char *units, double conversion,
+                                       bool radius,
+                                       struct geoReplyOptions *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->sort = SORT_NONE;
+    opts->coord_type = GEO_WGS84_TYPE;
+    opts->units = units;
+    opts->conversion = conversion;
+
+    for (int i = 0; i < argc; i++) {
+        char *arg = argv[i]->ptr;
+        if (!strncasecmp(arg, "withdist", 8))
+            opts->withdist = true;
+        else if (!strcasecmp(arg, "withhash"))
+            opts->withhash = true;
+        else if (!strncasecmp(arg, "withcoord", 9))
+            opts->withcoords = true;
+        else if (!strncasecmp(arg, "withgeojsonbound", 16))
+            opts->withgeojsonbounds = true;
+        else if (!strncasecmp(arg, "withgeojsoncollection", 21))
+            opts->withgeojsoncollection = true;
+        else if (!strncasecmp(arg, "withgeo", 7) ||
+                 !strcasecmp(arg, "geojson") || !strcasecmp(arg, "json") ||
+                 !strcasecmp(arg, "withjson"))
+            opts->withgeojson = true;
+        else if (!strncasecmp(arg, "noprop", 6) ||
+                 !strncasecmp(arg, "withoutprop", 11))
+            opts->noproperties = true;
+        else if (!strncasecmp(arg, "asc", 3) || !strncasecmp(arg, "sort", 4))
+            opts->sort = SORT_ASC;
+        else if (!strncasecmp(arg, "desc", 4))
+            opts->sort = SORT_DESC;
+        else if (!strcasecmp(arg, "async"))
+            opts->async = true;
+        else if (radius && !strcasecmp(arg, "filter")) {
+            if (i + 4 >= argc) {
+                addReply(c, shared.syntaxerr);
+                return false;
+            }
+            if (!geoFilterParseOrReply(c, argv + i + 1, &opts->filter))
+                return false;
+            i += 4;
+        } else if (radius && (!strcasecmp(arg, "store") ||
+                              !strcasecmp(arg, "storedist"))) {
+            if (i + 1 >= argc) {
+                addReply(c, shared.syntaxerr);
+                return false;
+            }
+            opts->storedist = !strcasecmp(arg, "storedist");
+            opts->store = argv[++i];
+        } else if (!extractCoordTypeOption(arg, &opts->coord_type)) {
+            addReply(c, shared.syntaxerr);
+            return false;
+        }
     }
 
-    long result_length = listLength(found_matches);
-    long option_length = 0;
+    /* Stored results have no room for anything but member and score */
+    if (opts->store &&
+        (opts->withdist || opts->withhash || opts->withcoords ||
+         opts->withgeojson || opts->withgeojsonbounds ||
+         opts->withgeojsoncollection)) {
+        addReplyError(c, "STORE and STOREDIST can't be combined with WITH "
+                         "options");
+        return false;
+    }
+
+    /* Geojson coordinates are longitude/latitude, not planar meters */
+    if (GEO_COORD_BASE(opts->coord_type) == GEO_MERCATOR_TYPE &&
+        (opts->withgeojson || opts->withgeojsonbounds ||
+         opts->withgeojsoncollection)) {
+        addReplyError(c, "geojson replies don't support planar coordinates");
+        return false;
+    }
+
+    return true;
+}
+
+/* Distance of 'zr' from the search center in the requested unit */
+static double resultDistance(struct zipresult *zr,
+                             struct geoReplyOptions *opts) {
+    /* Planar searches only take the square root for replies */
+    return GEO_COORD_BASE(opts->coord_type) == GEO_MERCATOR_TYPE
+               ? sqrt(zr->distance) / opts->conversion
+               : zr->distance / opts->conversion;
+}
+
+/* Remove results of 'key' whose expire time has passed */
+static void dropExpiredResults(redisDb *db, robj *key, list *found) {
+    struct geoTtlView view;
+    if (!found || !geoTtlViewInit(db, key, &view))
+        return;
+
+    listIter li;
+    listNode *ln;
+    listRewind(found, &li);
+    while ((ln = listNext(&li))) {
+        struct zipresult *zr = listNodeValue(ln);
+        bool expired =
+            zr->type == ZR_LONG
+                ? geoTtlExpired(&view, NULL, 0, zr->val.v)
+                : geoTtlExpired(&view, (unsigned char *)zr->val.s,
+                                sdslen(zr->val.s), 0);
+        if (!expired)
+            continue;
+
+        /* Lists get their free method just before they're released */
+        if (!listGetFree(found))
+            free_zipresult(zr);
+        listDelNode(found, ln);
+    }
+}
+
+/* Replace 'dest' with a zset of every result in 'found' (scored by geohash
+ * or, for STOREDIST, by distance) and reply with its size.  Without
+ * results, 'dest' is deleted. */
+static void storeResults(redisClient *c, robj *key, list *found,
+                         struct geoReplyOptions *opts) {
+    robj *dest = opts->store;
+    dropExpiredResults(c->db, key, found);
+    size_t count = found ? listLength(found) : 0;
+
+    /* 'dest' is replaced as a whole, including its partitions */
+    geoTtlDelete(c->db, dest);
+    geoPartDrop(c->db, dest);
+    if (!count) {
+        if (dbDelete(c->db, dest)) {
+            signalModifiedKey(c->db, dest);
+            notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC, "del", dest, c->db->id);
+            geoCacheKeyModified(c->db, dest);
+            server.dirty++;
+        }
+        addReply(c, shared.czero);
+        return;
+    }
+
+    struct geoLoadPoint *points = zmalloc(sizeof(*points) * count);
+    listIter li;
+    listRewind(found, &li);
+    for (size_t i = 0; i < count; i++) {
+        struct zipresult *zr = listNodeValue(listNext(&li));
+
+        /* Integer members become strings so every point can point at its
+         * member (free_zipresult() frees either kind). */
+        if (zr->type == ZR_LONG) {
+            zr->val.s = sdsfromlonglong(zr->val.v);
+            zr->type = ZR_STRING;
+        }
+
+        points[i].score =
+            opts->storedist ? resultDistance(zr, opts) : zr->score;
+        points[i].member = zr->val.s;
+        points[i].len = sdslen(zr->val.s);
+        points[i].index = i;
+    }
+
+    /* Members of one search are unique, so this only sorts */
+    count = geoLoadSortUnique(points, count);
+    robj *zobj = geoLoadCreateZset(points, count);
+    setKey(c->db, dest, zobj);
+    decrRefCount(zobj);
+    zfree(points);
+
+    notifyKeyspaceEvent(REDIS_NOTIFY_ZSET, "georadiusstore", dest,
+                        c->db->id);
+    geoCacheKeyModified(c->db, dest);
+    server.dirty += count;
+    addReplyLongLong(c, count);
+}
+
+/* Reply with every result in 'found' (a list of struct zipresult with
+ * distances filled in) formatted according to 'opts'. */
+static void replyResults(redisClient *c, robj *key, list *found,
+                         struct geoReplyOptions *opts) {
+    dropExpiredResults(c->db, key, found);
+
+    /* If no matching results, the user gets an empty reply. */
+    if (!found || !listLength(found)) {
+        addReply(c, shared.emptymultibulk);
+        return;
+    }
+
+    bool withgeo = opts->withgeojsonbounds || opts->withgeojsoncollection ||
+                   opts->withgeojson;
+    long result_length = listLength(found);
+    long option_length = 0;
 
     /* Our options are self-contained nested multibulk replies, so we
      * only need to track how many of those nested replies we return. */
-    if (withdist)
+    if (opts->withdist)
         option_length++;
 
-    if (withcoords)
+    if (opts->withcoords)
         option_length++;
 
-    if (withhash)
+    if (opts->withhash)
         option_length++;
 
-    if (withgeojson)
+    if (opts->withgeojson)
         option_length++;
 
-    if (withgeojsonbounds)
+    if (opts->withgeojsonbounds)
         option_length++;
 
     /* The multibulk len we send is exactly result_length. The result is either
      * all strings of just zset members  *or* a nested multi-bulk reply
      * containing the zset member string _and_ all the additional options the
      * user enabled for this request. */
-    addReplyMultiBulkLen(c, result_length + withgeojsoncollection);
+    addReplyMultiBulkLen(c, result_length + opts->withgeojsoncollection);
 
     /* Iterate over results, populate struct used for sorting and result sending
      */
     listIter li;
-    listRewind(found_matches, &li);
+    listRewind(found, &li);
     struct geojsonPoint *gp = zmalloc(sizeof(*gp) * result_length);
     /* populate gp array from our results */
     for (int i = 0; i < result_length; i++) {
@@ -531,20 +1313,23 @@ static void geoRadiusGeneric(redisClient *c, int type) {
 
         gp[i].member = NULL;
         gp[i].set = key->ptr;
-        gp[i].dist = zr->distance / conversion;
         gp[i].userdata = zr;
+        gp[i].dist = resultDistance(zr, opts);
 
         /* The layout of geojsonPoint allows us to pass the start offset
          * of the struct directly to decodeGeohash. */
-        decodeGeohash(zr->score, (double *)(gp + i));
+        decodeGeohashType(opts->coord_type, zr->score, (double *)(gp + i));
     }
 
     /* Process [optional] requested sorting */
-    if (sort == SORT_ASC) {
+    long long stage = geoStatsStageStart();
+    if (opts->sort == SORT_ASC) {
         qsort(gp, result_length, sizeof(*gp), sort_gp_asc);
-    } else if (sort == SORT_DESC) {
+    } else if (opts->sort == SORT_DESC) {
         qsort(gp, result_length, sizeof(*gp), sort_gp_desc);
     }
+    geoStatsStageEnd(GEO_STATS_SORT, stage);
+    stage = geoStatsStageStart();
 
     /* Finally send results back to the caller */
     for (int i = 0; i < result_length; i++) {
@@ -558,143 +1343,2055 @@ static void geoRadiusGeneric(redisClient *c, int type) {
         switch (zr->type) {
         case ZR_LONG:
             addReplyBulkLongLong(c, zr->val.v);
-            if (withgeo && !noproperties)
+            if (withgeo && !opts->noproperties)
                 gp[i].member = sdscatprintf(sdsempty(), "%llu", zr->val.v);
             break;
         case ZR_STRING:
             addReplyBulkCBuffer(c, zr->val.s, sdslen(zr->val.s));
-            if (withgeo && !noproperties)
+            if (withgeo && !opts->noproperties)
                 gp[i].member = sdsdup(zr->val.s);
             break;
         }
 
-        if (withdist)
+        if (opts->withdist)
             addReplyDoubleNicer(c, gp[i].dist);
 
-        if (withhash)
+        if (opts->withhash)
             addReplyLongLong(c, zr->score);
 
-        if (withcoords) {
+        if (opts->withcoords) {
             addReplyMultiBulkLen(c, 2);
             addReplyDouble(c, gp[i].latitude);
             addReplyDouble(c, gp[i].longitude);
         }
 
-        if (withgeojson)
-            latLongToGeojsonAndReply(c, gp + i, units);
+        if (opts->withgeojson)
+            latLongToGeojsonAndReply(c, gp + i, opts->units);
 
-        if (withgeojsonbounds)
-            decodeGeohashToGeojsonBoundsAndReply(c, zr->score, gp + i);
+        if (opts->withgeojsonbounds)
+            decodeGeohashToGeojsonBoundsAndReply(c, opts->coord_type,
+                                                 zr->score, gp + i);
     }
 
-    if (withgeojsoncollection)
-        replyGeojsonCollection(c, gp, result_length, units);
+    if (opts->withgeojsoncollection)
+        replyGeojsonCollection(c, gp, result_length, opts->units);
 
-    if (withgeo && !noproperties)
+    if (withgeo && !opts->noproperties)
         for (int i = 0; i < result_length; i++)
             sdsfree(gp[i].member);
 
     zfree(gp);
-    listRelease(found_matches);
+    geoStatsStageEnd(GEO_STATS_REPLY, stage);
+}
+
+/* Run the radius search around 'latlong' and reply with all results. */
+static void geoRadiusSearchAndReply(redisClient *c, robj *zobj,
+                                    double *latlong, int base_args) {
+    robj *key = c->argv[1];
+
+    /* Extract radius and units from arguments */
+    double radius_meters = 0, conversion = 1;
+    if ((radius_meters = extractDistanceOrReply(c, c->argv + base_args - 2,
+                                                &conversion)) < 0) {
+        return;
+    }
+
+    /* Discover and populate all optional parameters. */
+    struct geoReplyOptions opts;
+    if (!extractReplyOptionsOrReply(c, c->argv + base_args,
+                                    c->argc - base_args,
+                                    c->argv[base_args - 1]->ptr, conversion,
+                                    true, &opts))
+        return;
+
+    /* Get all neighbor geohash boxes for our radius search */
+    GeoHashRadius georadius = geohashGetAreasByRadius(
+        opts.coord_type, latlong[0], latlong[1], radius_meters);
+
+#ifdef DEBUG
+    printf("Searching with step size: %d\n", georadius.hash.step);
+#endif
+    /* Large searches may be filtered and formatted on a worker thread.
+     * Geojson replies, FILTER (which reads other keys), STORE (which
+     * writes one) and keys with expire times always run inline. */
+    bool withgeo = opts.withgeojson || opts.withgeojsonbounds ||
+                   opts.withgeojsoncollection;
+    bool filtered = opts.filter.op != GEO_FILTER_NONE;
+    if (opts.async && !withgeo && !filtered && !opts.store &&
+        !geoTtlExists(c->db, key) && geoAsyncAllowed(c)) {
+        struct geoRange cells[9];
+        int cell_count = rangesOfRadius(georadius, cells, 0);
+        int count = mergeRanges(cells, cell_count);
+        double ranges[9 * 2];
+        for (int i = 0; i < count; i++) {
+            ranges[i * 2] = cells[i].min;
+            ranges[i * 2 + 1] = cells[i].max;
+        }
+
+        struct geoAsyncQuery query = {.coord_type = opts.coord_type,
+                                      .latitude = latlong[0],
+                                      .longitude = latlong[1],
+                                      .radius = radius_meters,
+                                      .conversion = opts.conversion,
+                                      .sort = opts.sort,
+                                      .withdist = opts.withdist,
+                                      .withhash = opts.withhash,
+                                      .withcoords = opts.withcoords};
+        if (geoAsyncSearchAndReply(c, zobj, ranges, count, &query)) {
+            GEO_STATS_COUNT(cells, cell_count);
+            GEO_STATS_COUNT(ranges, count);
+            return;
+        }
+    }
+
+    /* {Lat, Long} = {y, x} */
+    double y = latlong[0];
+    double x = latlong[1];
+
+    /* Search the zset for all matching points */
+    list *found_matches =
+        membersOfAllNeighbors(opts.coord_type, zobj, georadius, x, y,
+                              radius_meters, filtered ? &opts.filter : NULL);
+
+    if (opts.store)
+        storeResults(c, key, found_matches, &opts);
+    else
+        replyResults(c, key, found_matches, &opts);
+
+    if (found_matches)
+        listRelease(found_matches);
+}
+
+/* Serve the search from the result cache or run it against the cache's
+ * capture client and remember the reply.  Entries are keyed by the exact
+ * center, so a hit replies with the same distances and order the search
+ * itself would. */
+static void geoRadiusCachedAndReply(redisClient *c, robj *zobj,
+                                    double *latlong, int base_args) {
+    /* Cache by center plus everything after the center argument(s) */
+    sds id = geoCacheId(c->db, c->argv[1], latlong, c->argv + base_args - 2,
+                        c->argc - base_args + 2);
+    if (geoCacheReplyIfCached(c, id, zobj)) {
+        sdsfree(id);
+        return;
+    }
+
+    redisClient *capture = geoCacheCaptureClient(c);
+    geoRadiusSearchAndReply(capture, zobj, latlong, base_args);
+    geoCacheStoreAndReply(c, capture, id, zobj);
+}
+
+/* Collects every visited member within 'radius' of the center which
+ * passes 'match' */
+struct geoRadiusFilter {
+    uint8_t coord_type;
+    double latitude;
+    double longitude;
+    double radius;
+    struct geoFilter *match; /* NULL without FILTER */
+    list *found;
+};
+
+static bool geoRadiusFilterVisit(void *privdata, double score,
+                                 unsigned char *str, unsigned int len,
+                                 long long vlong) {
+    struct geoRadiusFilter *filter = privdata;
+    double latlong[2], distance;
+
+    GEO_STATS_COUNT(candidates, 1);
+    decodeGeohashType(filter->coord_type, score, latlong);
+    if (distanceIfInRadius(filter->coord_type, filter->longitude,
+                           filter->latitude, latlong[1], latlong[0],
+                           filter->radius, &distance) &&
+        (!filter->match || geoFilterMatch(filter->match, str, len, vlong))) {
+        GEO_STATS_COUNT(accepted, 1);
+        if (!filter->found)
+            filter->found = listCreate();
+        listAddNodeTail(filter->found,
+                        visitedResult(score, str, len, vlong, distance));
+    }
+
+    return true;
+}
+
+/* Radius search over the partitions of a partitioned key (only partitions
+ * overlapping the search's cells are looked at) or over frozen 'frozen'. */
+static void geoRadiusVisitAndReply(redisClient *c, int step, robj *frozen,
+                                   double *latlong, int base_args) {
+    robj *key = c->argv[1];
+
+    double radius_meters = 0, conversion = 1;
+    if ((radius_meters = extractDistanceOrReply(c, c->argv + base_args - 2,
+                                                &conversion)) < 0)
+        return;
+
+    struct geoReplyOptions opts;
+    if (!extractReplyOptionsOrReply(c, c->argv + base_args,
+                                    c->argc - base_args,
+                                    c->argv[base_args - 1]->ptr, conversion,
+                                    true, &opts))
+        return;
+
+    GeoHashRadius georadius = geohashGetAreasByRadius(
+        opts.coord_type, latlong[0], latlong[1], radius_meters);
+    struct geoRange ranges[9];
+    int cells = rangesOfRadius(georadius, ranges, 0);
+    int count = mergeRanges(ranges, cells);
+    GEO_STATS_COUNT(cells, cells);
+    GEO_STATS_COUNT(ranges, count);
+
+    /* Partitions and frozen blocks are filtered as they're scanned, so
+     * both count as the scan stage. */
+    long long stage = geoStatsStageStart();
+    struct geoRadiusFilter filter = {.coord_type = opts.coord_type,
+                                     .latitude = latlong[0],
+                                     .longitude = latlong[1],
+                                     .radius = radius_meters};
+    if (opts.filter.op != GEO_FILTER_NONE)
+        filter.match = &opts.filter;
+    for (int i = 0; i < count; i++) {
+        if (step)
+            geoPartVisit(c->db, key, step, ranges[i].min, ranges[i].max,
+                         geoRadiusFilterVisit, &filter);
+        else
+            geoFrozenVisit(frozen, ranges[i].min, ranges[i].max,
+                           geoRadiusFilterVisit, &filter);
+    }
+    geoStatsStageEnd(GEO_STATS_SCAN, stage);
+
+    if (opts.store)
+        storeResults(c, key, filter.found, &opts);
+    else
+        replyResults(c, key, filter.found, &opts);
+
+    if (filter.found) {
+        listSetFreeMethod(filter.found,
+                          (void (*)(void *ptr)) & free_zipresult);
+        listRelease(filter.found);
+    }
+}
+
+/* Only the STORE commands (flagged as writes) may pass 'store' */
+static void geoRadiusLocateAndReply(redisClient *c, int type, bool store_ok) {
+    /* type == cords:  [cmd, key, lat, long, radius, units, [optionals]]
+     * type == member: [cmd, key, member,    radius, units, [optionals]] */
+    robj *key = c->argv[1];
+
+    int base_args = type == RADIUS_COORDS ? 6 : 5;
+    robj *store = extractStoreOption(c->argv + base_args, c->argc - base_args);
+    if (store && !store_ok) {
+        addReplyError(c, "STORE and STOREDIST are only supported by "
+                         "GEORADIUSSTORE and GEORADIUSBYMEMBERSTORE");
+        return;
+    }
+
+    /* Look up the requested zset (or the partitions or frozen copy replacing
+     * it) */
+    struct geoSetRead set;
+    if (!lookupGeoSetReadOrReply(c, key, NULL, &set))
+        return;
+
+    if (!geoSetExists(&set)) {
+        if (store) {
+            /* Nothing found replaces the destination with nothing */
+            struct geoReplyOptions opts = {.store = store};
+            storeResults(c, key, NULL, &opts);
+        } else {
+            addReply(c, shared.emptymultibulk);
+        }
+        return;
+    }
+    robj *zobj = set.zobj, *frozen = set.frozen;
+    int part_step = set.part_step;
+
+    /* Find lat/long to use for radius search based on inquiry type */
+    uint8_t coord_type =
+        extractCoordType(c->argv + base_args, c->argc - base_args);
+    double latlong[2] = {0};
+    if (type == RADIUS_COORDS) {
+        if (!extractLatLongOrReply(c, c->argv + 2, latlong))
+            return;
+    } else if (type == RADIUS_MEMBER) {
+        robj *member = c->argv[2];
+        bool found = latLongFromKeyMember(c->db, key, zobj, frozen, part_step,
+                                          coord_type, member, latlong);
+
+        struct geoTtlView view;
+        if (found && geoTtlViewInit(c->db, key, &view) &&
+            geoTtlExpiredObject(&view, member))
+            found = false;
+
+        if (!found) {
+            addReplyError(c, "could not decode requested zset member");
+            return;
+        }
+    } else {
+        addReplyError(c, "unknown georadius search type");
+        return;
+    }
+
+    /* Partitioned and frozen keys skip the cache and ASYNC.  FILTER reads
+     * hashes the cache doesn't watch and STORE replies with a count, so
+     * filtered and stored searches skip it too.  Members expiring change
+     * results without touching the key, so keys with TTLs skip it too. */
+    if (part_step || frozen)
+        geoRadiusVisitAndReply(c, part_step, frozen, latlong, base_args);
+    else if (geoCacheEnabled() && !store && !geoTtlExists(c->db, key) &&
+             !extractFilterOption(c->argv + base_args, c->argc - base_args))
+        geoRadiusCachedAndReply(c, zobj, latlong, base_args);
+    else
+        geoRadiusSearchAndReply(c, zobj, latlong, base_args);
+}
+
+/* Every radius search is counted for GEOSTATS */
+static void geoRadiusGeneric(redisClient *c, int type, bool store_ok) {
+    struct geoStatsSample sample;
+    geoStatsBegin(&sample);
+    geoRadiusLocateAndReply(c, type, store_ok);
+    geoStatsEnd(c->db, c->argv[1]);
+}
+
+/* GEORADIUSSTORE and GEORADIUSBYMEMBERSTORE take their destination first
+ * (so it's part of their key spec) and [storedist] among the options.  The
+ * search runs on the arguments of GEORADIUS (or GEORADIUSBYMEMBER) followed
+ * by STORE (or STOREDIST) dest, then the client gets its own arguments
+ * back, so the STORE command is what call() propagates. */
+static void geoRadiusStoreGeneric(redisClient *c, int type) {
+    robj **argv = c->argv;
+    int argc = c->argc;
+    int base_args = (type == RADIUS_COORDS ? 6 : 5) + 1;
+    robj **search = zmalloc(sizeof(*search) * (argc + 1));
+    int search_argc = 0;
+    bool storedist = false;
+
+    search[search_argc++] = argv[0];
+    for (int i = 2; i < argc; i++) {
+        char *arg = argv[i]->ptr;
+        if (i >= base_args && !strcasecmp(arg, "filter")) {
+            /* FILTER arguments are never options */
+            for (int j = 0; j < 5 && i + j < argc; j++)
+                search[search_argc++] = argv[i + j];
+            i += 4;
+        } else if (i >= base_args && !strcasecmp(arg, "storedist")) {
+            storedist = true;
+        } else if (i >= base_args && !strcasecmp(arg, "store")) {
+            addReply(c, shared.syntaxerr);
+            zfree(search);
+            return;
+        } else {
+            search[search_argc++] = argv[i];
+        }
+    }
+
+    robj *option = storedist ? createStringObject("storedist", 9)
+                             : createStringObject("store", 5);
+    search[search_argc++] = option;
+    search[search_argc++] = argv[1];
+
+    c->argv = search;
+    c->argc = search_argc;
+    geoRadiusGeneric(c, type, true);
+    c->argv = argv;
+    c->argc = argc;
+
+    decrRefCount(option);
+    zfree(search);
 }
 
 void geoRadiusCommand(redisClient *c) {
     /* args 0-5: ["georadius", key, lat, long, radius, units];
      * optionals: [withdist, withcoords, asc|desc] */
-    geoRadiusGeneric(c, RADIUS_COORDS);
+    geoRadiusGeneric(c, RADIUS_COORDS, false);
 }
 
 void geoRadiusByMemberCommand(redisClient *c) {
     /* args 0-4: ["georadius", key, compare-against-member, radius, units];
      * optionals: [withdist, withcoords, asc|desc] */
-    geoRadiusGeneric(c, RADIUS_MEMBER);
+    geoRadiusGeneric(c, RADIUS_MEMBER, false);
 }
 
-void geoDecodeCommand(redisClient *c) {
-    /* args 0-1: ["geodecode", geohash];
-     * optional: [geojson] */
+void geoRadiusStoreCommand(redisClient *c) {
+    /* args 0-6: ["georadiusstore", dest, key, lat, long, radius, units];
+     * optionals: [storedist], [filter prefix field op value], [planar],
+     *            [hilbert] */
+    geoRadiusStoreGeneric(c, RADIUS_COORDS);
+}
 
-    GeoHashBits geohash;
-    if (getLongLongFromObjectOrReply(c, c->argv[1], (long long *)&geohash.bits,
-                                     NULL) != REDIS_OK)
-        return;
+void geoRadiusByMemberStoreCommand(redisClient *c) {
+    /* args 0-5: ["georadiusbymemberstore", dest, key, member, radius,
+     *            units];
+     * optionals: [storedist], [filter prefix field op value], [planar],
+     *            [hilbert] */
+    geoRadiusStoreGeneric(c, RADIUS_MEMBER);
+}
 
-    bool withgeojson = false;
-    if (c->argc == 3)
-        withgeojson = true;
+/* GEORADIUSMULTI scan state.  Candidates arrive in score order, so the
+ * per-query ranges (sorted by min) become active once we reach their min
+ * and retire once we pass their max. */
+struct geoMultiQuery {
+    double latitude;
+    double longitude;
+    list *found;
+    long seen; /* last candidate tested against this query */
+};
+
+struct geoMultiScan {
+    struct geoMultiQuery *queries;
+    struct geoRange *ranges; /* every query's ranges, sorted by min */
+    int count;
+    int next;    /* first range not yet active */
+    int *active; /* indexes of ranges containing the current candidate */
+    int active_count;
+    uint8_t coord_type;
+    double radius;
+    long seq; /* candidates visited */
+};
+
+static bool geoMultiVisit(void *privdata, double score, unsigned char *str,
+                          unsigned int len, long long vlong) {
+    struct geoMultiScan *scan = privdata;
+
+    while (scan->next < scan->count && scan->ranges[scan->next].min <= score)
+        scan->active[scan->active_count++] = scan->next++;
+
+    /* Retire ranges we've moved past */
+    int kept = 0;
+    for (int i = 0; i < scan->active_count; i++)
+        if (scan->ranges[scan->active[i]].max > score)
+            scan->active[kept++] = scan->active[i];
+    scan->active_count = kept;
 
-    GeoHashArea area;
-    geohash.step = GEO_STEP_MAX;
-    geohashDecodeWGS84(geohash, &area);
+    double latlong[2];
+    decodeGeohashType(scan->coord_type, score, latlong);
+    scan->seq++;
 
-    double y = (area.latitude.min + area.latitude.max) / 2;
-    double x = (area.longitude.min + area.longitude.max) / 2;
+    for (int i = 0; i < scan->active_count; i++) {
+        struct geoMultiQuery *q =
+            scan->queries + scan->ranges[scan->active[i]].query;
+        double distance;
 
-    /* Returning three nested replies */
-    addReplyMultiBulkLen(c, 3 + withgeojson * 2);
+        /* Neighbor cells of one query can coincide near the poles */
+        if (q->seen == scan->seq)
+            continue;
+        q->seen = scan->seq;
 
-    /* First, the minimum corner */
-    addReplyMultiBulkLen(c, 2);
-    addReplyDouble(c, area.latitude.min);
-    addReplyDouble(c, area.longitude.min);
+        if (!distanceIfInRadius(scan->coord_type, q->longitude, q->latitude,
+                                latlong[1], latlong[0], scan->radius,
+                                &distance))
+            continue;
 
-    /* Next, the maximum corner */
-    addReplyMultiBulkLen(c, 2);
-    addReplyDouble(c, area.latitude.max);
-    addReplyDouble(c, area.longitude.max);
+        if (!q->found)
+            q->found = listCreate();
+        listAddNodeTail(q->found,
+                        visitedResult(score, str, len, vlong, distance));
+    }
 
-    /* Last, the averaged center of this bounding box */
-    addReplyMultiBulkLen(c, 2);
-    addReplyDouble(c, y);
-    addReplyDouble(c, x);
+    return true;
+}
 
-    if (withgeojson) {
-        struct geojsonPoint gp = {
-            .latitude = y, .longitude = x, .member = NULL};
+void geoRadiusMultiCommand(redisClient *c) {
+    /* args 0-2: ["georadiusmulti", key, radius, units];
+     * then: [lat1, long1, lat2, long2, ...]; optionals: same as georadius */
+    robj *key = c->argv[1];
 
-        /* Return geojson Feature Point */
-        latLongToGeojsonAndReply(c, &gp, NULL);
+    double radius_meters = 0, conversion = 1;
+    if ((radius_meters = extractDistanceOrReply(c, c->argv + 2,
+                                                &conversion)) < 0)
+        return;
 
-        /* Return geojson Feature Polygon */
-        decodeGeohashToGeojsonBoundsAndReply(c, geohash.bits, &gp);
+    /* Centers run until the first argument that isn't a number */
+    int first = 4, centers = 0;
+    double ignored;
+    while (first + centers * 2 + 1 < c->argc &&
+           extractCoordinate(c->argv[first + centers * 2], &ignored) &&
+           extractCoordinate(c->argv[first + centers * 2 + 1], &ignored))
+        centers++;
+
+    if (!centers) {
+        addReplyError(c, "format is: georadiusmulti [key] [radius] [units] "
+                         "[lat1] [long1] [lat2] [long2] ... [options]");
+        return;
+    }
+
+    int options = first + centers * 2;
+    struct geoReplyOptions opts;
+    if (!extractReplyOptionsOrReply(c, c->argv + options, c->argc - options,
+                                    c->argv[3]->ptr, conversion, false,
+                                    &opts))
+        return;
+
+    struct geoSetRead set;
+    if (!lookupGeoSetReadOrReply(c, key, shared.emptymultibulk, &set))
+        return;
+
+    struct geoMultiQuery *queries = zcalloc(sizeof(*queries) * centers);
+    struct geoRange *ranges = zmalloc(sizeof(*ranges) * centers * 9);
+    int count = 0;
+
+    for (int i = 0; i < centers; i++) {
+        double latlong[2];
+        extractLatLongOrReply(c, c->argv + first + i * 2, latlong);
+        queries[i].latitude = latlong[0];
+        queries[i].longitude = latlong[1];
+
+        GeoHashRadius georadius = geohashGetAreasByRadius(
+            opts.coord_type, latlong[0], latlong[1], radius_meters);
+        count += rangesOfRadius(georadius, ranges + count, i);
     }
+
+    /* Per-query ranges drive candidate assignment; their union drives
+     * the single pass over the zset. */
+    qsort(ranges, count, sizeof(*ranges), sort_range_asc);
+    struct geoRange *merged = zmalloc(sizeof(*merged) * count);
+    memcpy(merged, ranges, sizeof(*merged) * count);
+    int merged_count = mergeRanges(merged, count);
+
+    struct geoMultiScan scan = {.queries = queries,
+                                .ranges = ranges,
+                                .count = count,
+                                .active = zmalloc(sizeof(int) * count),
+                                .coord_type = opts.coord_type,
+                                .radius = radius_meters};
+
+    for (int i = 0; i < merged_count; i++)
+        geoSetVisit(&set, merged[i].min, merged[i].max, geoMultiVisit, &scan);
+
+    addReplyMultiBulkLen(c, centers);
+    for (int i = 0; i < centers; i++) {
+        replyResults(c, key, queries[i].found, &opts);
+        if (queries[i].found) {
+            listSetFreeMethod(queries[i].found,
+                              (void (*)(void *ptr)) & free_zipresult);
+            listRelease(queries[i].found);
+        }
+    }
+
+    zfree(scan.active);
+    zfree(merged);
+    zfree(ranges);
+    zfree(queries);
 }
 
-void geoEncodeCommand(redisClient *c) {
-    /* args 0-2: ["geoencode", lat, long];
-     * optionals: [radius, units]
-     * - AND / OR -
-     * optional: [geojson] */
+/* GEOSCAN visits at most this many candidates per call by default */
+#define GEO_SCAN_DEFAULT_COUNT 100
+
+/* GEOSCAN scan state.  Cursors are "<range>:<score>:<member>" naming the
+ * last candidate visited in the merged, sorted ranges of the search, so a
+ * scan resumes right after it even when other members share its score. */
+struct geoScanState {
+    uint8_t coord_type;
+    double latitude;
+    double longitude;
+    double radius;
+    long budget;         /* candidates we may still visit */
+    bool resume;         /* still skipping up to the cursor's member */
+    double last_score;
+    sds last_member;
+    list *found;
+};
+
+/* Binary member of a visited candidate (ints are compared as strings, like
+ * the zset itself orders them) */
+static unsigned char *visitedMember(unsigned char *str, unsigned int *len,
+                                    long long vlong, char *buf, size_t size) {
+    if (str)
+        return str;
+
+    *len = ll2string(buf, size, vlong);
+    return (unsigned char *)buf;
+}
 
-    bool withgeojson = false;
-    for (int i = 3; i < c->argc; i++) {
-        char *arg = c->argv[i]->ptr;
-        if (!strncasecmp(arg, "withgeo", 7) || !strcasecmp(arg, "geojson") ||
-            !strcasecmp(arg, "json") || !strcasecmp(arg, "withjson")) {
-            withgeojson = true;
-            break;
+static bool geoScanVisit(void *privdata, double score, unsigned char *str,
+                         unsigned int len, long long vlong) {
+    struct geoScanState *scan = privdata;
+    char buf[32];
+    unsigned char *member = visitedMember(str, &len, vlong, buf, sizeof(buf));
+
+    if (scan->resume) {
+        if (score == scan->last_score) {
+            size_t last_len = sdslen(scan->last_member);
+            int cmp = memcmp(member, scan->last_member,
+                             len < last_len ? len : last_len);
+            if (cmp < 0 || (cmp == 0 && len <= last_len))
+                return true;
         }
+        scan->resume = false;
     }
 
-    double radius_meters = 0;
-    if (c->argc >= 5) {
-        if ((radius_meters = extractDistanceOrReply(c, c->argv + 3, NULL)) <
-            0) {
-            return;
+    double latlong[2], distance;
+    decodeGeohashType(scan->coord_type, score, latlong);
+    if (distanceIfInRadius(scan->coord_type, scan->longitude, scan->latitude,
+                           latlong[1], latlong[0], scan->radius, &distance)) {
+        if (!scan->found)
+            scan->found = listCreate();
+        listAddNodeTail(scan->found,
+                        visitedResult(score, str, len, vlong, distance));
+    }
+
+    if (--scan->budget > 0)
+        return true;
+
+    /* Out of budget: remember where to pick up next time */
+    scan->last_score = score;
+    sdsclear(scan->last_member);
+    scan->last_member = sdscatlen(scan->last_member, member, len);
+    return false;
+}
+
+/* Parse "0" or "<range>:<score>:<member>" into 'range' and 'scan' */
+static bool extractScanCursorOrReply(redisClient *c, robj *cursor,
+                                     int range_count, int *range,
+                                     struct geoScanState *scan) {
+    sds s = cursor->ptr;
+    *range = 0;
+    if (!strcmp(s, "0"))
+        return true;
+
+    char *eptr;
+    long idx = strtol(s, &eptr, 10);
+    if (*eptr == ':' && idx >= 0 && idx < range_count) {
+        unsigned long long score = strtoull(eptr + 1, &eptr, 10);
+        if (*eptr == ':') {
+            eptr++;
+            *range = idx;
+            scan->resume = true;
+            scan->last_score = score;
+            scan->last_member =
+                sdscatlen(scan->last_member, eptr, sdslen(s) - (eptr - s));
+            return true;
         }
-    } else if (c->argc == 4 && !withgeojson) {
-        addReplyError(c, "must provide units when asking for radius encode");
-        return;
     }
 
+    addReplyError(c, "invalid cursor");
+    return false;
+}
+
+void geoScanCommand(redisClient *c) {
+    /* args 0-5: ["geoscan", key, lat, long, radius, units];
+     * optionals: [cursor c] [count n] + georadius reply options */
+    robj *key = c->argv[1];
+
     double latlong[2];
-    if (!extractLatLongOrReply(c, c->argv + 1, latlong))
+    if (!extractLatLongOrReply(c, c->argv + 2, latlong))
         return;
 
-    /* Encode lat/long into our geohash */
-    GeoHashBits geohash;
-    uint8_t step = geohashEstimateStepsByRadius(radius_meters);
-    geohashEncodeWGS84(latlong[0], latlong[1], step, &geohash);
+    double radius_meters = 0, conversion = 1;
+    if ((radius_meters = extractDistanceOrReply(c, c->argv + 4,
+                                                &conversion)) < 0)
+        return;
+
+    /* Pull out cursor/count, leaving the rest for the reply options */
+    robj *cursor = NULL;
+    long long count = GEO_SCAN_DEFAULT_COUNT;
+    robj *options[c->argc];
+    int option_count = 0;
+    for (int i = 6; i < c->argc; i++) {
+        char *arg = c->argv[i]->ptr;
+        if (!strcasecmp(arg, "cursor") && i + 1 < c->argc) {
+            cursor = c->argv[++i];
+        } else if (!strcasecmp(arg, "count") && i + 1 < c->argc) {
+            if (getLongLongFromObjectOrReply(c, c->argv[++i], &count, NULL) !=
+                REDIS_OK)
+                return;
+            if (count <= 0) {
+                addReplyError(c, "count must be positive");
+                return;
+            }
+        } else {
+            options[option_count++] = c->argv[i];
+        }
+    }
+
+    struct geoReplyOptions opts;
+    if (!extractReplyOptionsOrReply(c, options, option_count,
+                                    c->argv[5]->ptr, conversion, false,
+                                    &opts))
+        return;
+
+    struct geoSetRead set;
+    if (!lookupGeoSetReadOrReply(c, key, NULL, &set))
+        return;
+
+    /* The covering ranges only depend on the search itself, so every call
+     * of a scan computes the same ranges in the same order. */
+    GeoHashRadius georadius = geohashGetAreasByRadius(
+        opts.coord_type, latlong[0], latlong[1], radius_meters);
+    struct geoRange ranges[9];
+    int range_count = mergeRanges(ranges, rangesOfRadius(georadius, ranges, 0));
+
+    struct geoScanState scan = {.coord_type = opts.coord_type,
+                                .latitude = latlong[0],
+                                .longitude = latlong[1],
+                                .radius = radius_meters,
+                                .budget = count,
+                                .last_member = sdsempty()};
+    int range = 0;
+    if (cursor &&
+        !extractScanCursorOrReply(c, cursor, range_count, &range, &scan)) {
+        sdsfree(scan.last_member);
+        return;
+    }
+
+    bool finished = true;
+    for (; range < range_count; range++) {
+        double min = scan.resume ? scan.last_score : ranges[range].min;
+        if (!geoSetVisit(&set, min, ranges[range].max, geoScanVisit, &scan)) {
+            finished = false;
+            break;
+        }
+        scan.resume = false;
+    }
+
+    addReplyMultiBulkLen(c, 2);
+    if (finished) {
+        addReplyBulkCBuffer(c, "0", 1);
+    } else {
+        sds next = sdscatprintf(sdsempty(), "%d:%llu:", range,
+                                (unsigned long long)scan.last_score);
+        next = sdscatsds(next, scan.last_member);
+        addReplyBulkCBuffer(c, next, sdslen(next));
+        sdsfree(next);
+    }
+
+    replyResults(c, key, scan.found, &opts);
+
+    if (scan.found) {
+        listSetFreeMethod(scan.found, (void (*)(void *ptr)) & free_zipresult);
+        listRelease(scan.found);
+    }
+    sdsfree(scan.last_member);
+}
+
+/* Samples per path segment when covering the corridor with radius searches.
+ * Long segments with small buffers get sparser samples and larger radii. */
+#define GEO_ALONG_MAX_SAMPLES 64
+
+/* GEOALONG scan state */
+struct geoAlongScan {
+    uint8_t coord_type;
+    double *path; /* lat/long pairs */
+    int points;
+    double *bounds; /* per segment: min lat, min long, max lat, max long */
+    double buffer;
+    list *found;
+};
+
+static bool geoAlongVisit(void *privdata, double score, unsigned char *str,
+                          unsigned int len, long long vlong) {
+    struct geoAlongScan *scan = privdata;
+    double latlong[2];
+    decodeGeohashType(scan->coord_type, score, latlong);
+
+    bool within = false;
+    double nearest = 0;
+    for (int i = 0; i < scan->points - 1; i++) {
+        double *b = scan->bounds + i * 4;
+        if (latlong[0] < b[0] || latlong[1] < b[1] || latlong[0] > b[2] ||
+            latlong[1] > b[3])
+            continue;
+
+        double *p = scan->path + i * 2;
+        double distance;
+        if (geohashGetDistanceToSegmentIfInRadiusWGS84(
+                latlong[1], latlong[0], p[1], p[0], p[3], p[2], scan->buffer,
+                &distance) &&
+            (!within || distance < nearest)) {
+            within = true;
+            nearest = distance;
+        }
+    }
+
+    if (within)
+        listAddNodeTail(scan->found,
+                        visitedResult(score, str, len, vlong, nearest));
+
+    return true;
+}
+
+void geoAlongCommand(redisClient *c) {
+    /* args 0-3: ["geoalong", key, buffer, units];
+     * then: [lat1, long1, lat2, long2, ...]; optionals: same as georadius */
+    robj *key = c->argv[1];
+
+    double buffer_meters = 0, conversion = 1;
+    if ((buffer_meters = extractDistanceOrReply(c, c->argv + 2,
+                                                &conversion)) < 0)
+        return;
+
+    /* Path points run until the first argument that isn't a number */
+    int first = 4, points = 0;
+    double ignored;
+    while (first + points * 2 + 1 < c->argc &&
+           extractCoordinate(c->argv[first + points * 2], &ignored) &&
+           extractCoordinate(c->argv[first + points * 2 + 1], &ignored))
+        points++;
+
+    if (points < 2) {
+        addReplyError(c, "format is: geoalong [key] [buffer] [units] "
+                         "[lat1] [long1] [lat2] [long2] ... [options]");
+        return;
+    }
+
+    int options = first + points * 2;
+    struct geoReplyOptions opts;
+    if (!extractReplyOptionsOrReply(c, c->argv + options, c->argc - options,
+                                    c->argv[3]->ptr, conversion, false,
+                                    &opts))
+        return;
+
+    if (GEO_COORD_BASE(opts.coord_type) != GEO_WGS84_TYPE) {
+        addReplyError(c, "geoalong doesn't support planar coordinates");
+        return;
+    }
+
+    struct geoSetRead set;
+    if (!lookupGeoSetReadOrReply(c, key, shared.emptymultibulk, &set))
+        return;
+
+    double *path = zmalloc(sizeof(*path) * points * 2);
+    double *bounds = zmalloc(sizeof(*bounds) * (points - 1) * 4);
+    for (int i = 0; i < points; i++)
+        extractLatLongOrReply(c, c->argv + first + i * 2, path + i * 2);
+
+    /* Cover every segment with radius searches around evenly spaced
+     * samples.  Every point of a segment is within spacing / 2 of a sample,
+     * so searching buffer + spacing / 2 around samples covers the corridor. */
+    int capacity = (points - 1) * (GEO_ALONG_MAX_SAMPLES + 1) * 9;
+    struct geoRange *ranges = zmalloc(sizeof(*ranges) * capacity);
+    int count = 0;
+    for (int i = 0; i < points - 1; i++) {
+        double *p = path + i * 2;
+        double length;
+        geohashGetDistanceIfInRadiusWGS84(p[1], p[0], p[3], p[2], 0, &length);
+
+        int samples = ceil(length / (buffer_meters ? buffer_meters : 1));
+        if (samples > GEO_ALONG_MAX_SAMPLES)
+            samples = GEO_ALONG_MAX_SAMPLES;
+        if (samples < 1)
+            samples = 1;
+
+        double radius = buffer_meters + length / samples / 2;
+        for (int j = 0; j <= samples; j++) {
+            double t = (double)j / samples;
+            GeoHashRadius georadius = geohashGetAreasByRadius(
+                opts.coord_type, p[0] + t * (p[2] - p[0]),
+                p[1] + t * (p[3] - p[1]), radius);
+            count += rangesOfRadius(georadius, ranges + count, i);
+        }
+
+        /* Cheap rejection box for the exact distance test */
+        double b1[4], b2[4];
+        geohashBoundingBox(p[0], p[1], buffer_meters, b1);
+        geohashBoundingBox(p[2], p[3], buffer_meters, b2);
+        double *b = bounds + i * 4;
+        b[0] = b1[0] < b2[0] ? b1[0] : b2[0];
+        b[1] = b1[1] < b2[1] ? b1[1] : b2[1];
+        b[2] = b1[2] > b2[2] ? b1[2] : b2[2];
+        b[3] = b1[3] > b2[3] ? b1[3] : b2[3];
+    }
+
+    /* Merged ranges never overlap, so no member is visited twice. */
+    count = mergeRanges(ranges, count);
+
+    struct geoAlongScan scan = {.coord_type = opts.coord_type,
+                                .path = path,
+                                .points = points,
+                                .bounds = bounds,
+                                .buffer = buffer_meters,
+                                .found = listCreate()};
+    listSetFreeMethod(scan.found, (void (*)(void *ptr)) & free_zipresult);
+
+    for (int i = 0; i < count; i++)
+        geoSetVisit(&set, ranges[i].min, ranges[i].max, geoAlongVisit, &scan);
+
+    replyResults(c, key, scan.found, &opts);
+
+    listRelease(scan.found);
+    zfree(ranges);
+    zfree(bounds);
+    zfree(path);
+}
+
+/* GEOJOIN scan state.  Members of A arrive in score order, so members
+ * sharing a cell at 'step' arrive together.  Each group of A members is
+ * matched against the members of B in the group's cell and its neighbors. */
+struct geoJoinMember {
+    struct zipresult *zr;
+    double latitude;
+    double longitude;
+};
+
+struct geoJoinScan {
+    redisClient *c;
+    struct geoSetRead *b;
+    bool self; /* joining a key with itself: skip pairing members with
+                  themselves */
+    uint8_t coord_type;
+    uint8_t step;
+    double radius;
+    double conversion;
+    bool withdist;
+    struct geoTtlView ttl_a; /* expired members of either key are skipped */
+    struct geoTtlView ttl_b;
+    uint64_t cell; /* cell of the current group at 'step' */
+    struct geoJoinMember *group;
+    int group_count;
+    int group_alloc;
+    long pairs;
+};
+
+static void addReplyVisited(redisClient *c, unsigned char *str,
+                            unsigned int len, long long vlong) {
+    if (str)
+        addReplyBulkCBuffer(c, str, len);
+    else
+        addReplyBulkLongLong(c, vlong);
+}
+
+static bool visitedIsResult(struct zipresult *zr, unsigned char *str,
+                            unsigned int len, long long vlong) {
+    if (zr->type == ZR_LONG)
+        return !str && zr->val.v == vlong;
+
+    return str && sdslen(zr->val.s) == len && !memcmp(zr->val.s, str, len);
+}
+
+static bool geoJoinVisitB(void *privdata, double score, unsigned char *str,
+                          unsigned int len, long long vlong) {
+    struct geoJoinScan *scan = privdata;
+    if (geoTtlExpired(&scan->ttl_b, str, len, vlong))
+        return true;
+
+    double latlong[2];
+    decodeGeohashType(scan->coord_type, score, latlong);
+
+    for (int i = 0; i < scan->group_count; i++) {
+        struct geoJoinMember *a = scan->group + i;
+        double distance;
+
+        if (scan->self && visitedIsResult(a->zr, str, len, vlong))
+            continue;
+
+        if (!distanceIfInRadius(scan->coord_type, a->longitude, a->latitude,
+                                latlong[1], latlong[0], scan->radius,
+                                &distance))
+            continue;
+
+        addReplyMultiBulkLen(scan->c, scan->withdist ? 3 : 2);
+        if (a->zr->type == ZR_LONG)
+            addReplyBulkLongLong(scan->c, a->zr->val.v);
+        else
+            addReplyBulkCBuffer(scan->c, a->zr->val.s, sdslen(a->zr->val.s));
+        addReplyVisited(scan->c, str, len, vlong);
+        if (scan->withdist) {
+            /* Planar distances are squared */
+            if (GEO_COORD_BASE(scan->coord_type) == GEO_MERCATOR_TYPE)
+                distance = sqrt(distance);
+            addReplyDoubleNicer(scan->c, distance / scan->conversion);
+        }
+
+        scan->pairs++;
+    }
+
+    return true;
+}
+
+/* Match the current group of A against B, then empty the group. */
+static void geoJoinFlush(struct geoJoinScan *scan) {
+    if (!scan->group_count)
+        return;
+
+    /* Cells shrink (in meters) as we move away from the equator, so search
+     * coarser cells at high latitudes to keep the radius inside the
+     * neighbors.  Planar cells are the same size everywhere. */
+    uint8_t step = scan->step;
+    if (GEO_COORD_BASE(scan->coord_type) == GEO_WGS84_TYPE) {
+        double latitude = fabs(scan->group[0].latitude);
+        if (latitude > 66 && step > 1)
+            step--;
+        if (latitude > 80 && step > 1)
+            step--;
+    }
+
+    GeoHashRadius n = {{0}};
+    n.hash.step = step;
+    n.hash.bits = scan->cell >> ((scan->step - step) * 2);
+    geohashNeighborsType(scan->coord_type, &n.hash, &n.neighbors);
+
+    struct geoRange ranges[9];
+    int count = mergeRanges(ranges, rangesOfRadius(n, ranges, 0));
+    for (int i = 0; i < count; i++)
+        geoSetVisit(scan->b, ranges[i].min, ranges[i].max, geoJoinVisitB,
+                    scan);
+
+    for (int i = 0; i < scan->group_count; i++)
+        free_zipresult(scan->group[i].zr);
+    scan->group_count = 0;
+}
+
+static bool geoJoinVisitA(void *privdata, double score, unsigned char *str,
+                          unsigned int len, long long vlong) {
+    struct geoJoinScan *scan = privdata;
+    if (geoTtlExpired(&scan->ttl_a, str, len, vlong))
+        return true;
+
+    uint64_t cell = (uint64_t)score >> (52 - scan->step * 2);
+
+    if (scan->group_count && cell != scan->cell)
+        geoJoinFlush(scan);
+    scan->cell = cell;
+
+    if (scan->group_count == scan->group_alloc) {
+        scan->group_alloc = scan->group_alloc ? scan->group_alloc * 2 : 16;
+        scan->group = zrealloc(scan->group,
+                               sizeof(*scan->group) * scan->group_alloc);
+    }
+
+    struct geoJoinMember *a = scan->group + scan->group_count++;
+    double latlong[2];
+    decodeGeohashType(scan->coord_type, score, latlong);
+    a->zr = visitedResult(score, str, len, vlong, 0);
+    a->latitude = latlong[0];
+    a->longitude = latlong[1];
+
+    return true;
+}
+
+void geoJoinCommand(redisClient *c) {
+    /* args 0-4: ["geojoin", keyA, keyB, radius, units];
+     * optionals: [withdist, planar, hilbert]
+     * Replies with [memberA, memberB] (or [memberA, memberB, dist]) for
+     * every member of keyB within radius of a member of keyA. */
+    robj *key_a = c->argv[1];
+    robj *key_b = c->argv[2];
+
+    double radius_meters = 0, conversion = 1;
+    if ((radius_meters = extractDistanceOrReply(c, c->argv + 3,
+                                                &conversion)) < 0)
+        return;
+
+    bool withdist = false;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    for (int i = 5; i < c->argc; i++) {
+        if (!strncasecmp(c->argv[i]->ptr, "withdist", 8)) {
+            withdist = true;
+        } else if (!extractCoordTypeOption(c->argv[i]->ptr, &coord_type)) {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    struct geoSetRead a, b;
+    if (!lookupGeoSetReadOrReply(c, key_a, shared.emptymultibulk, &a) ||
+        !lookupGeoSetReadOrReply(c, key_b, shared.emptymultibulk, &b))
+        return;
+
+    struct geoJoinScan scan = {.c = c,
+                               .b = &b,
+                               .self = equalStringObjects(key_a, key_b),
+                               .coord_type = coord_type,
+                               .step = geohashEstimateStepsByRadius(
+                                   radius_meters),
+                               .radius = radius_meters,
+                               .conversion = conversion,
+                               .withdist = withdist};
+    geoTtlViewInit(c->db, key_a, &scan.ttl_a);
+    geoTtlViewInit(c->db, key_b, &scan.ttl_b);
+
+    void *replylen = addDeferredMultiBulkLength(c);
+    geoSetVisit(&a, 0, (double)(1ULL << 52), geoJoinVisitA, &scan);
+    geoJoinFlush(&scan);
+    setDeferredMultiBulkLength(c, replylen, scan.pairs);
+
+    zfree(scan.group);
+}
+
+/* Most distances one GEODISTMATRIX may compute (a 16 MB reply) */
+#define GEO_DISTMATRIX_MAX_CELLS (4 * 1024 * 1024)
+
+void geoDistMatrixCommand(redisClient *c) {
+    /* args 0-2: ["geodistmatrix", key, units];
+     * optionals: [origins, n], [planar], [hilbert];
+     * then: [member1, member2, ...]
+     * Without ORIGINS, replies with the N x N matrix of distances between
+     * all members.  With ORIGINS n, the first n members are rows and the
+     * rest are columns.  The reply is one bulk string of row-major
+     * little-endian float32 distances in 'units'.  Distances involving
+     * members missing from the key are NaN.  At most
+     * GEO_DISTMATRIX_MAX_CELLS distances are computed. */
+    robj *key = c->argv[1];
+
+    double conversion = extractUnitOrReply(c, c->argv[2]);
+    if (conversion < 0)
+        return;
+
+    /* Options run until the first member */
+    int first = 3;
+    long long origins = -1;
+    bool with_origins = false;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    while (first < c->argc) {
+        if (first + 1 < c->argc &&
+            !strcasecmp(c->argv[first]->ptr, "origins")) {
+            if (getLongLongFromObjectOrReply(c, c->argv[first + 1], &origins,
+                                             NULL) != REDIS_OK)
+                return;
+            with_origins = true;
+            first += 2;
+        } else if (extractCoordTypeOption(c->argv[first]->ptr, &coord_type)) {
+            first++;
+        } else {
+            break;
+        }
+    }
+
+    int members = c->argc - first;
+    if (members < 1 || (with_origins && (origins < 1 || origins >= members))) {
+        addReplyError(c, "format is: geodistmatrix [key] [units] "
+                         "[origins n] [planar] [hilbert] "
+                         "[member1] [member2] ... "
+                         "(origins must be between 1 and members - 1)");
+        return;
+    }
+
+    /* Square matrix: every member is both an origin and a destination */
+    int rows = origins > 0 ? origins : members;
+    int columns = origins > 0 ? members - origins : members;
+    if ((long long)rows * columns > GEO_DISTMATRIX_MAX_CELLS) {
+        addReplyErrorFormat(c, "geodistmatrix computes at most %d distances",
+                            GEO_DISTMATRIX_MAX_CELLS);
+        return;
+    }
+
+    /* Members may live in a zset, a frozen key or partitions */
+    struct geoSetRead set;
+    if (!lookupGeoSetReadOrReply(c, key, NULL, &set))
+        return;
+
+    /* Decode every member once (expired members count as missing) */
+    struct geoTtlView view;
+    geoTtlViewInit(c->db, key, &view);
+    double *latlong = zmalloc(sizeof(*latlong) * members * 2);
+    for (int i = 0; i < members; i++) {
+        robj *member = c->argv[first + i];
+        if (geoTtlExpiredObject(&view, member) ||
+            !latLongFromKeyMember(c->db, key, set.zobj, set.frozen,
+                                  set.part_step, coord_type, member,
+                                  latlong + i * 2))
+            latlong[i * 2] = latlong[i * 2 + 1] = NAN;
+    }
+
+    double *destinations = origins > 0 ? latlong + origins * 2 : latlong;
+
+    size_t bytes = sizeof(float) * rows * columns;
+    float *matrix = zmalloc(bytes);
+    if (GEO_COORD_BASE(coord_type) == GEO_MERCATOR_TYPE) {
+        geohashGetDistanceMatrixMercator(latlong, rows, destinations, columns,
+                                         1 / conversion, matrix);
+    } else {
+        double *scratch = zmalloc(
+            sizeof(*scratch) * GEO_DISTANCE_MATRIX_SCRATCH(rows, columns));
+        geohashGetDistanceMatrixWGS84(latlong, rows, destinations, columns,
+                                      1 / conversion, matrix, scratch);
+        zfree(scratch);
+    }
+
+    for (size_t i = 0; i < (size_t)rows * columns; i++)
+        memrev32ifbe(matrix + i);
+
+    addReplyBulkCBuffer(c, matrix, bytes);
+
+    zfree(matrix);
+    zfree(latlong);
+}
+
+void geoAddBinCommand(redisClient *c) {
+    /* args 0-2: ["geoaddbin", key, blob]; optionals: [planar, hilbert]
+     * blob is packed records of little-endian float64 latitude,
+     * float64 longitude, uint32 member length, then the member bytes. */
+    robj *key = c->argv[1];
+
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    for (int i = 3; i < c->argc; i++) {
+        if (!extractCoordTypeOption(c->argv[i]->ptr, &coord_type)) {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    /* Decode and validate the whole blob before changing anything */
+    robj *blob = getDecodedObject(c->argv[2]);
+    size_t count = 0;
+    sds err = NULL;
+    struct geoLoadPoint *points = geoLoadParseBinary(
+        blob->ptr, sdslen(blob->ptr), coord_type, &count, &err);
+    if (err) {
+        addReplyErrorFormat(c, "invalid geoaddbin blob: %s", err);
+        sdsfree(err);
+        decrRefCount(blob);
+        return;
+    }
+
+    if (!count) {
+        addReplyError(c, "geoaddbin blob has no points");
+        decrRefCount(blob);
+        return;
+    }
+
+    robj *zobj = lookupGeoKeyWrite(c, key);
+    int part_step = 0;
+    if ((!zobj || zobj->type != REDIS_ZSET) &&
+        geoPartStep(c->db, key, &part_step)) {
+        zobj = NULL;
+    } else if (zobj && checkType(c, zobj, REDIS_ZSET)) {
+        zfree(points);
+        decrRefCount(blob);
+        return;
+    } else {
+        if (zobj)
+            geoTtlReap(c->db, key, GEO_TTL_REAP_PER_COMMAND);
+        else
+            geoTtlDelete(c->db, key);
+        zobj = lookupKeyWrite(c->db, key);
+    }
+
+    count = geoLoadSortUnique(points, count);
+
+    long added = 0, changed = 0;
+    if (part_step) {
+        /* Partitioned keys take points one by one, like GEOADD */
+        for (size_t i = 0; i < count; i++) {
+            robj *member =
+                createStringObject((char *)points[i].member, points[i].len);
+            bool member_changed;
+            added += geoPartAdd(c->db, key, part_step, member,
+                                points[i].score, &member_changed, NULL);
+            changed += member_changed;
+            decrRefCount(member);
+        }
+    } else if (!zobj) {
+        /* New key: presorted build */
+        zobj = geoLoadCreateZset(points, count);
+        dbAdd(c->db, key, zobj);
+        added = changed = count;
+    } else {
+        for (size_t i = 0; i < count; i++) {
+            robj *member =
+                createStringObject((char *)points[i].member, points[i].len);
+            bool member_changed;
+            added += zsetAdd(zobj, member, points[i].score, &member_changed);
+            changed += member_changed;
+            decrRefCount(member);
+        }
+    }
+
+    /* Like GEOADD without EX: re-added members lose their expire times */
+    if (geoTtlExists(c->db, key)) {
+        robj **members = zmalloc(sizeof(*members) * count);
+        for (size_t i = 0; i < count; i++)
+            members[i] =
+                createStringObject((char *)points[i].member, points[i].len);
+
+        geoTtlClear(c->db, key, members, 1, count);
+
+        for (size_t i = 0; i < count; i++)
+            decrRefCount(members[i]);
+        zfree(members);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        double latlong[2];
+        decodeGeohashType(coord_type, points[i].score, latlong);
+        sds member = sdsnewlen(points[i].member, points[i].len);
+        publishLocationUpdate(key->ptr, member, latlong[0], latlong[1], -1);
+        sdsfree(member);
+    }
+
+    if (changed) {
+        signalModifiedKey(c->db, key);
+        notifyKeyspaceEvent(REDIS_NOTIFY_ZSET, "zadd", key, c->db->id);
+        server.dirty += changed;
+        geoCacheKeyModified(c->db, key);
+    }
+
+    addReplyLongLong(c, added);
+
+    zfree(points);
+    decrRefCount(blob);
+}
+
+/* Most members per ZADD when we propagate (or merge) bulk loads */
+#define GEO_LOAD_CHUNK 1024
+
+/* One GEOLOAD reads at most this much of a file, bounding how long it
+ * blocks the server.  Larger files must be split (CSV at line boundaries,
+ * binary at record boundaries) and loaded in parts, one GEOLOAD each. */
+#define GEO_LOAD_MAX_BYTES (16 * 1024 * 1024)
+
+/* GEOLOAD only reads regular files below the server's working directory
+ * (CONFIG GET dir): no absolute paths and no ".." components here, and no
+ * symlinks anywhere along the path (see geoLoadOpen()). */
+static bool geoLoadPathAllowed(const char *path) {
+    if (!*path || *path == '/')
+        return false;
+
+    while (*path) {
+        const char *slash = strchr(path, '/');
+        size_t len = slash ? (size_t)(slash - path) : strlen(path);
+        if (len == 2 && path[0] == '.' && path[1] == '.')
+            return false;
+        path += len + (slash != NULL);
+    }
+
+    return true;
+}
+
+/* Open relative 'path' one component at a time from the working directory
+ * with O_NOFOLLOW, so neither a symlinked directory along the path nor the
+ * file itself can lead outside of it (and nothing can be swapped in between
+ * a check and the open).  Returns -1 with errno set on failure. */
+static int geoLoadOpen(const char *path) {
+    int dirfd = open(".", O_RDONLY | O_DIRECTORY);
+
+    while (dirfd != -1 && *path) {
+        const char *slash = strchr(path, '/');
+        size_t len = slash ? (size_t)(slash - path) : strlen(path);
+        char name[NAME_MAX + 1];
+
+        if (len > NAME_MAX) {
+            close(dirfd);
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(name, path, len);
+        name[len] = '\0';
+        path += len + (slash != NULL);
+
+        /* Empty and "." components stay where we are */
+        if (!len || (len == 1 && name[0] == '.'))
+            continue;
+
+        int flags = O_RDONLY | O_NOFOLLOW;
+        flags |= *path ? O_DIRECTORY : O_NONBLOCK;
+        int fd = openat(dirfd, name, flags);
+
+        /* O_NOFOLLOW | O_DIRECTORY fails a symlinked directory as ENOTDIR */
+        struct stat st;
+        if (fd == -1 && errno == ENOTDIR &&
+            fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0 &&
+            S_ISLNK(st.st_mode))
+            errno = ELOOP;
+
+        int saved_errno = errno;
+        close(dirfd);
+        errno = saved_errno;
+        dirfd = fd;
+    }
+
+    return dirfd;
+}
+
+/* Replicas and the AOF can't read our files, so GEOLOAD is propagated as
+ * the commands rebuilding the key: an optional DEL, then ZADDs of at most
+ * GEO_LOAD_CHUNK members (see struct geoPropagation). */
+/* Turn sorted points into ZADDs of at most GEO_LOAD_CHUNK members and
+ * propagate them.  If 'run' is set, each ZADD is also executed to merge
+ * the points into the existing key. */
+static void geoLoadZadd(struct geoPropagation *prop,
+                        struct geoLoadPoint *points, size_t count, bool run) {
+    redisClient *c = prop->c;
+    redisClient *client = NULL;
+    robj *key = c->argv[1];
+
+    if (run) {
+        client = createClient(-1);
+        selectDb(client, c->db->id);
+    }
+
+    for (size_t start = 0; start < count; start += GEO_LOAD_CHUNK) {
+        size_t n = count - start < GEO_LOAD_CHUNK ? count - start
+                                                  : GEO_LOAD_CHUNK;
+        int argc = 2 + n * 2;
+        robj **argv = geoCommandArgv(argc, "zadd");
+
+        argv[1] = key;
+        incrRefCount(key);
+        for (size_t j = 0; j < n; j++) {
+            struct geoLoadPoint *p = points + start + j;
+            argv[2 + j * 2] =
+                createStringObjectFromLongLong((long long)p->score);
+            argv[3 + j * 2] = createStringObject((char *)p->member, p->len);
+        }
+
+        if (run) {
+            client->argc = argc;
+            client->argv = argv;
+            zaddCommand(client);
+            argv = client->argv; /* zadd may have encoded arguments */
+            client->argc = 0;
+            client->argv = NULL;
+        }
+
+        geoPropagate(prop, argv, argc);
+    }
+
+    if (client)
+        freeClient(client);
+}
+
+/* Loaded members lose their expire times, like members of GEOADD without
+ * EX */
+static void geoLoadClearTtls(redisClient *c, struct geoLoadPoint *points,
+                             size_t count) {
+    robj *key = c->argv[1];
+    if (!count || !geoTtlExists(c->db, key))
+        return;
+
+    robj **members = zmalloc(sizeof(*members) * count);
+    for (size_t i = 0; i < count; i++)
+        members[i] =
+            createStringObject((char *)points[i].member, points[i].len);
+
+    geoTtlClear(c->db, key, members, 1, count);
+
+    for (size_t i = 0; i < count; i++)
+        decrRefCount(members[i]);
+    zfree(members);
+}
+
+void geoLoadCommand(redisClient *c) {
+    /* args 0-2: ["geoload", key, path];
+     * optionals: [binary, replace, planar, hilbert]
+     * Loads every point of a file (relative to the server's working
+     * directory, at most GEO_LOAD_MAX_BYTES) into key.  Without REPLACE,
+     * points are merged into an existing key. */
+    robj *key = c->argv[1];
+    char *path = c->argv[2]->ptr;
+
+    bool binary = false, replace = false;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    for (int i = 3; i < c->argc; i++) {
+        char *arg = c->argv[i]->ptr;
+        if (!strcasecmp(arg, "binary")) {
+            binary = true;
+        } else if (!strcasecmp(arg, "replace")) {
+            replace = true;
+        } else if (!extractCoordTypeOption(arg, &coord_type)) {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    if (!geoLoadPathAllowed(path)) {
+        addReplyError(c, "geoload paths must be relative to the server's "
+                         "working directory and can't contain '..'");
+        return;
+    }
+
+    robj *zobj = lookupGeoKeyWrite(c, key);
+    int part_step;
+    if ((!zobj || zobj->type != REDIS_ZSET) &&
+        geoPartStep(c->db, key, &part_step)) {
+        addReplyError(c, "geoload can't load into partitioned keys (use "
+                         "geoaddbin)");
+        return;
+    }
+
+    if (zobj && checkType(c, zobj, REDIS_ZSET))
+        return;
+
+    int fd = geoLoadOpen(path);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (errno == ELOOP)
+            addReplyErrorFormat(c, "can't open %s: geoload doesn't follow "
+                                   "symbolic links",
+                                path);
+        else
+            addReplyErrorFormat(c, "can't open %s: %s", path,
+                                strerror(errno));
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        addReplyErrorFormat(c, "%s isn't a regular file", path);
+        close(fd);
+        return;
+    }
+
+    if (st.st_size > GEO_LOAD_MAX_BYTES) {
+        addReplyErrorFormat(c, "%s is larger than the %d bytes one geoload "
+                               "reads: split it (CSV at line boundaries, "
+                               "binary at record boundaries) and geoload "
+                               "each part",
+                            path, GEO_LOAD_MAX_BYTES);
+        close(fd);
+        return;
+    }
+
+    /* Parse and validate everything before changing anything */
+    char *map = NULL;
+    struct geoLoadPoint *points = NULL;
+    size_t count = 0;
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            addReplyErrorFormat(c, "can't map %s: %s", path, strerror(errno));
+            close(fd);
+            return;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+        sds err = NULL;
+        if (binary)
+            points =
+                geoLoadParseBinary(map, st.st_size, coord_type, &count, &err);
+        else
+            points = geoLoadParseCSV(map, st.st_size, coord_type, &count, &err);
+
+        if (err) {
+            addReplyErrorFormat(c, "%s: %s", path, err);
+            sdsfree(err);
+            munmap(map, st.st_size);
+            close(fd);
+            return;
+        }
+    }
+    close(fd);
+
+    count = geoLoadSortUnique(points, count);
+
+    bool del = replace && zobj;
+    int commands = del + (count + GEO_LOAD_CHUNK - 1) / GEO_LOAD_CHUNK;
+    struct geoPropagation prop;
+    geoPropagateBegin(&prop, c, commands);
+
+    if (del) {
+        dbDelete(c->db, key);
+        zobj = NULL;
+        signalModifiedKey(c->db, key);
+        notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC, "del", key, c->db->id);
+        server.dirty++;
+
+        robj **argv = geoCommandArgv(2, "del");
+        argv[1] = key;
+        incrRefCount(key);
+        geoPropagate(&prop, argv, 2);
+    }
+
+    /* A new key (or a replaced one) starts without expire times */
+    if (zobj)
+        geoLoadClearTtls(c, points, count);
+    else
+        geoTtlDelete(c->db, key);
+
+    if (count) {
+        if (zobj) {
+            /* Merge into the existing zset */
+            geoLoadZadd(&prop, points, count, true);
+        } else {
+            /* Presorted build of a new zset */
+            robj *loaded = geoLoadCreateZset(points, count);
+            setKey(c->db, key, loaded);
+            decrRefCount(loaded);
+            notifyKeyspaceEvent(REDIS_NOTIFY_ZSET, "zadd", key, c->db->id);
+            server.dirty += count;
+            geoLoadZadd(&prop, points, count, false);
+        }
+    }
+
+    geoPropagateEnd(&prop);
+    geoCacheKeyModified(c->db, key);
+    addReplyLongLong(c, count);
+
+    zfree(points);
+    if (map)
+        munmap(map, st.st_size);
+}
+
+void geoPartitionCommand(redisClient *c) {
+    /* args 0-2: ["geopartition", key, step] */
+    robj *key = c->argv[1];
+
+    long long step;
+    if (getLongLongFromObjectOrReply(c, c->argv[2], &step, NULL) != REDIS_OK)
+        return;
+
+    if (step < 1 || step > GEO_STEP_MAX) {
+        addReplyErrorFormat(c, "partition step must be between 1 and %d",
+                            GEO_STEP_MAX);
+        return;
+    }
+
+    int existing;
+    if (geoPartStep(c->db, key, &existing)) {
+        addReplyError(c, "key is already partitioned");
+        return;
+    }
+
+    robj *zobj = lookupGeoKeyWrite(c, key);
+    if (zobj && checkType(c, zobj, REDIS_ZSET))
+        return;
+
+    if (geoTtlExists(c->db, key)) {
+        addReplyError(c, "can't partition a key with member expire times");
+        return;
+    }
+
+    geoPartCreate(c->db, key, step);
+
+    signalModifiedKey(c->db, key);
+    server.dirty++;
+    geoCacheKeyModified(c->db, key);
+    addReply(c, shared.ok);
+}
+
+void geoFreezeCommand(redisClient *c) {
+    /* args 0-1: ["geofreeze", key]; optional: [hash] */
+    robj *key = c->argv[1];
+
+    bool hash = false;
+    if (c->argc == 3 && !strcasecmp(c->argv[2]->ptr, "hash")) {
+        hash = true;
+    } else if (c->argc != 2) {
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+
+    robj *zobj = lookupKeyWrite(c->db, key);
+    if (!zobj) {
+        addReply(c, shared.nokeyerr);
+        return;
+    }
+
+    if (geoFrozenIs(zobj)) {
+        addReply(c, shared.ok);
+        return;
+    }
+
+    if (checkType(c, zobj, REDIS_ZSET))
+        return;
+
+    if (geoTtlExists(c->db, key)) {
+        addReplyError(c, "can't freeze a key with member expire times");
+        return;
+    }
+
+    robj *frozen = geoFrozenCreate(zobj, hash);
+    if (!frozen) {
+        addReplyError(c, "geo set is too large to freeze (4GB or more)");
+        return;
+    }
+    dbOverwrite(c->db, key, frozen);
+
+    signalModifiedKey(c->db, key);
+    server.dirty++;
+    geoCacheKeyModified(c->db, key);
+    addReply(c, shared.ok);
+}
+
+void geoThawCommand(redisClient *c) {
+    /* args 0-1: ["geothaw", key] */
+    robj *key = c->argv[1];
+
+    robj *o = lookupKeyWrite(c->db, key);
+    if (!o || !geoFrozenIs(o)) {
+        addReply(c, shared.czero);
+        return;
+    }
+
+    geoThaw(c->db, key, o);
+
+    signalModifiedKey(c->db, key);
+    server.dirty++;
+    addReply(c, shared.cone);
+}
+
+/* SIZE, FLUSH and RESETSTATS change module state, so like GEOSTATSRESET
+ * the whole command is flagged admin instead of read only */
+void geoCacheCommand(redisClient *c) {
+    /* args 0-2: ["geocache", "size", max-bytes]
+     * - OR -
+     * args 0-1: ["geocache", "stats" | "flush" | "resetstats"] */
+    char *subcmd = c->argv[1]->ptr;
+
+    if (!strcasecmp(subcmd, "size") && c->argc == 3) {
+        long long max_bytes;
+        if (getLongLongFromObjectOrReply(c, c->argv[2], &max_bytes, NULL) !=
+            REDIS_OK)
+            return;
+
+        if (max_bytes < 0) {
+            addReplyError(c, "cache size must be zero (disabled) or positive");
+            return;
+        }
+
+        geoCacheSetMaxBytes(max_bytes);
+        addReply(c, shared.ok);
+    } else if (!strcasecmp(subcmd, "stats") && c->argc == 2) {
+        geoCacheReplyStats(c);
+    } else if (!strcasecmp(subcmd, "flush") && c->argc == 2) {
+        geoCacheFlush();
+        addReply(c, shared.ok);
+    } else if (!strcasecmp(subcmd, "resetstats") && c->argc == 2) {
+        geoCacheResetStats();
+        addReply(c, shared.ok);
+    } else {
+        addReplyError(c, "format is: geocache [size max-bytes | stats | flush "
+                         "| resetstats]");
+    }
+}
+
+void geoStatsCommand(redisClient *c) {
+    /* args 0: ["geostats"]
+     * - OR -
+     * args 0-2: ["geostats", "key", key] */
+    if (c->argc == 1) {
+        geoStatsReply(c, c->db, NULL);
+    } else if (c->argc == 3 && !strcasecmp(c->argv[1]->ptr, "key")) {
+        geoStatsReply(c, c->db, c->argv[2]);
+    } else {
+        addReplyError(c, "format is: geostats [key key]");
+    }
+}
+
+/* Resetting changes state, so it isn't part of the read only GEOSTATS */
+void geoStatsResetCommand(redisClient *c) {
+    /* args 0: ["geostatsreset"]; optional: [key] */
+    geoStatsReset(c->db, c->argc == 2 ? c->argv[1] : NULL);
+    addReply(c, shared.ok);
+}
+
+/* Partition roots are hashes too, but of scores, not histories */
+static bool geoTrackRejectPartitioned(redisClient *c, robj *key) {
+    int step;
+    if (!geoPartStep(c->db, key, &step))
+        return false;
+
+    addReplyError(c, "partitioned geo sets can't hold geotrack histories");
+    return true;
+}
+
+void geoTrackCommand(redisClient *c) {
+    /* args 0-5: ["geotrack", key, member, lat, long, timestamp];
+     * optional: [retention span] (in timestamp units) */
+    robj *key = c->argv[1];
+    robj *member = c->argv[2];
+
+    double latlong[2];
+    if (!extractLatLongOrReply(c, c->argv + 3, latlong))
+        return;
+
+    long long timestamp, retention = -1;
+    if (getLongLongFromObjectOrReply(c, c->argv[5], &timestamp, NULL) !=
+        REDIS_OK)
+        return;
+
+    if (c->argc == 8 && !strcasecmp(c->argv[6]->ptr, "retention")) {
+        if (getLongLongFromObjectOrReply(c, c->argv[7], &retention, NULL) !=
+            REDIS_OK)
+            return;
+        if (retention < 0) {
+            addReplyError(c, "retention can't be negative");
+            return;
+        }
+    } else if (c->argc != 6) {
+        addReplyError(c, "format is: geotrack [key] [member] [lat] [long] "
+                         "[timestamp] [retention span]");
+        return;
+    }
+
+    /* Histories always store Z-order WGS84 hashes; GEOTRACKRANGE HILBERT
+     * converts them on the way out. */
+    GeoHashBits hash;
+    if (!geohashEncodeType(GEO_WGS84_TYPE, latlong[0], latlong[1],
+                           GEO_STEP_MAX, &hash)) {
+        addReplyError(c, "coordinates out of range");
+        return;
+    }
+
+    robj *o = lookupKeyWrite(c->db, key);
+    if ((o && checkType(c, o, REDIS_HASH)) ||
+        geoTrackRejectPartitioned(c, key))
+        return;
+
+    /* Histories are appended in place, which needs a hash table */
+    if (!o) {
+        o = createHashObject();
+        dbAdd(c->db, key, o);
+    }
+    if (o->encoding == REDIS_ENCODING_ZIPLIST)
+        hashTypeConvert(o, REDIS_ENCODING_HT);
+
+    dictEntry *de = dictFind(o->ptr, member);
+    robj *track = de ? dictGetVal(de) : NULL;
+    if (track && (track->encoding != REDIS_ENCODING_RAW ||
+                  track->refcount != 1)) {
+        /* Not ours to modify (or not a history at all).  Work on a copy. */
+        robj *decoded = getDecodedObject(track);
+        track = createObject(REDIS_STRING, sdsdup(decoded->ptr));
+        decrRefCount(decoded);
+        hashTypeSet(o, member, track);
+        decrRefCount(track);
+    } else if (!track) {
+        track = createObject(REDIS_STRING, geoTrackCreate());
+        hashTypeSet(o, member, track);
+        decrRefCount(track);
+    }
+
+    sds history = track->ptr;
+    int result = geoTrackAppend(&history, timestamp,
+                                geohashAlign52Bits(hash));
+    if (result == GEO_TRACK_OK && retention >= 0) {
+        /* Keep points newer than the latest one minus 'retention' */
+        long long last = geoTrackLast(history);
+        long long before = last < LLONG_MIN + retention ? LLONG_MIN
+                                                         : last - retention;
+        if (geoTrackTrim(&history, before) < 0)
+            result = GEO_TRACK_CORRUPT;
+    }
+    track->ptr = history;
+
+    if (result == GEO_TRACK_CORRUPT) {
+        addReplyError(c, "member history is not a geotrack history");
+        return;
+    } else if (result == GEO_TRACK_OUT_OF_ORDER) {
+        addReplyError(c, "timestamp is older than the member's latest point");
+        return;
+    }
+
+    signalModifiedKey(c->db, key);
+    notifyKeyspaceEvent(REDIS_NOTIFY_HASH, "geotrack", key, c->db->id);
+    server.dirty++;
+    addReplyLongLong(c, geoTrackLength(history));
+}
+
+/* Points collected by GEOTRACKRANGE */
+struct geoTrackRangeScan {
+    long long *timestamps;
+    uint64_t *scores;
+    long count;
+    long alloc;
+    long limit;
+};
+
+static bool geoTrackRangeVisit(long long timestamp, uint64_t score,
+                               void *privdata) {
+    struct geoTrackRangeScan *scan = privdata;
+
+    if (scan->count == scan->alloc) {
+        scan->alloc = scan->alloc ? scan->alloc * 2 : 64;
+        scan->timestamps = zrealloc(scan->timestamps,
+                                    sizeof(*scan->timestamps) * scan->alloc);
+        scan->scores =
+            zrealloc(scan->scores, sizeof(*scan->scores) * scan->alloc);
+    }
+
+    scan->timestamps[scan->count] = timestamp;
+    scan->scores[scan->count++] = score;
+    return scan->count != scan->limit;
+}
+
+/* "-" and "+" are the oldest and newest possible timestamps */
+static bool extractTimestampOrReply(redisClient *c, robj *o,
+                                    long long *timestamp) {
+    char *arg = o->ptr;
+    if (o->encoding != REDIS_ENCODING_INT && !strcmp(arg, "-"))
+        *timestamp = LLONG_MIN;
+    else if (o->encoding != REDIS_ENCODING_INT && !strcmp(arg, "+"))
+        *timestamp = LLONG_MAX;
+    else
+        return getLongLongFromObjectOrReply(c, o, timestamp, NULL) ==
+               REDIS_OK;
+    return true;
+}
+
+void geoTrackRangeCommand(redisClient *c) {
+    /* args 0-4: ["geotrackrange", key, member, start, end];
+     * optionals: [count n], [withhash], [hilbert] */
+    robj *key = c->argv[1];
+    robj *member = c->argv[2];
+
+    long long start, end;
+    if (!extractTimestampOrReply(c, c->argv[3], &start) ||
+        !extractTimestampOrReply(c, c->argv[4], &end))
+        return;
+
+    struct geoTrackRangeScan scan = {.limit = -1};
+    bool withhash = false;
+    bool hilbert = false;
+    for (int i = 5; i < c->argc; i++) {
+        char *arg = c->argv[i]->ptr;
+        if (!strcasecmp(arg, "count") && i + 1 < c->argc) {
+            long long count;
+            if (getLongLongFromObjectOrReply(c, c->argv[++i], &count, NULL) !=
+                REDIS_OK)
+                return;
+            if (count <= 0) {
+                addReplyError(c, "count must be positive");
+                return;
+            }
+            scan.limit = count;
+        } else if (!strcasecmp(arg, "withhash")) {
+            withhash = true;
+        } else if (!strcasecmp(arg, "hilbert")) {
+            hilbert = true;
+        } else {
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+
+    robj *o;
+    if ((o = lookupKeyReadOrReply(c, key, shared.emptymultibulk)) == NULL ||
+        checkType(c, o, REDIS_HASH) || geoTrackRejectPartitioned(c, key))
+        return;
+
+    robj *track = hashTypeGetObject(o, member);
+    if (!track) {
+        addReply(c, shared.emptymultibulk);
+        return;
+    }
+
+    robj *decoded = getDecodedObject(track);
+    decrRefCount(track);
+    bool valid = geoTrackRange(decoded->ptr, sdslen(decoded->ptr), start, end,
+                               geoTrackRangeVisit, &scan);
+    decrRefCount(decoded);
+
+    if (!valid) {
+        addReplyError(c, "member history is not a geotrack history");
+    } else {
+        /* [timestamp, lat, long] or [timestamp, lat, long, hash] */
+        addReplyMultiBulkLen(c, scan.count);
+        for (long i = 0; i < scan.count; i++) {
+            double latlong[2];
+            decodeGeohashType(GEO_WGS84_TYPE, scan.scores[i], latlong);
+            addReplyMultiBulkLen(c, 3 + withhash);
+            addReplyLongLong(c, scan.timestamps[i]);
+            addReplyDouble(c, latlong[0]);
+            addReplyDouble(c, latlong[1]);
+            if (withhash && hilbert)
+                addReplyLongLong(c, geohashHilbertFromZ(scan.scores[i],
+                                                        GEO_STEP_MAX));
+            else if (withhash)
+                addReplyLongLong(c, scan.scores[i]);
+        }
+    }
+
+    zfree(scan.timestamps);
+    zfree(scan.scores);
+}
+
+void geoDecodeCommand(redisClient *c) {
+    /* args 0-1: ["geodecode", geohash];
+     * optionals: [geojson], [planar], [hilbert] */
+
+    GeoHashBits geohash;
+    if (getLongLongFromObjectOrReply(c, c->argv[1], (long long *)&geohash.bits,
+                                     NULL) != REDIS_OK)
+        return;
+
+    /* Any argument that isn't a coordinate type asks for geojson */
+    bool withgeojson = false;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    for (int i = 2; i < c->argc; i++)
+        if (!extractCoordTypeOption(c->argv[i]->ptr, &coord_type))
+            withgeojson = true;
+
+    if (withgeojson && GEO_COORD_BASE(coord_type) != GEO_WGS84_TYPE) {
+        addReplyError(c, "geojson replies don't support planar coordinates");
+        return;
+    }
+
+    GeoHashArea area;
+    geohash.step = GEO_STEP_MAX;
+    geohashDecodeType(coord_type, geohash, &area);
+
+    double y = (area.latitude.min + area.latitude.max) / 2;
+    double x = (area.longitude.min + area.longitude.max) / 2;
+
+    /* Returning three nested replies */
+    addReplyMultiBulkLen(c, 3 + withgeojson * 2);
+
+    /* First, the minimum corner */
+    addReplyMultiBulkLen(c, 2);
+    addReplyDouble(c, area.latitude.min);
+    addReplyDouble(c, area.longitude.min);
+
+    /* Next, the maximum corner */
+    addReplyMultiBulkLen(c, 2);
+    addReplyDouble(c, area.latitude.max);
+    addReplyDouble(c, area.longitude.max);
+
+    /* Last, the averaged center of this bounding box */
+    addReplyMultiBulkLen(c, 2);
+    addReplyDouble(c, y);
+    addReplyDouble(c, x);
+
+    if (withgeojson) {
+        struct geojsonPoint gp = {
+            .latitude = y, .longitude = x, .member = NULL};
+
+        /* Return geojson Feature Point */
+        latLongToGeojsonAndReply(c, &gp, NULL);
+
+        /* Return geojson Feature Polygon */
+        decodeGeohashToGeojsonBoundsAndReply(c, coord_type, geohash.bits,
+                                             &gp);
+    }
+}
+
+void geoEncodeCommand(redisClient *c) {
+    /* args 0-2: ["geoencode", lat, long];
+     * optionals: [radius, units]
+     * - AND / OR -
+     * optionals: [geojson], [planar], [hilbert] */
+
+    bool withgeojson = false;
+    uint8_t coord_type = GEO_WGS84_TYPE;
+    int positional = c->argc;
+    for (int i = 3; i < c->argc; i++) {
+        char *arg = c->argv[i]->ptr;
+        if (!strncasecmp(arg, "withgeo", 7) || !strcasecmp(arg, "geojson") ||
+            !strcasecmp(arg, "json") || !strcasecmp(arg, "withjson")) {
+            withgeojson = true;
+            positional--;
+        } else if (extractCoordTypeOption(arg, &coord_type)) {
+            positional--;
+        }
+    }
+
+    if (withgeojson && GEO_COORD_BASE(coord_type) != GEO_WGS84_TYPE) {
+        addReplyError(c, "geojson replies don't support planar coordinates");
+        return;
+    }
+
+    double radius_meters = 0;
+    if (positional >= 5) {
+        if ((radius_meters = extractDistanceOrReply(c, c->argv + 3, NULL)) <
+            0) {
+            return;
+        }
+    } else if (positional == 4) {
+        addReplyError(c, "must provide units when asking for radius encode");
+        return;
+    }
+
+    double latlong[2];
+    if (!extractLatLongOrReply(c, c->argv + 1, latlong))
+        return;
+
+    /* Encode lat/long into our geohash */
+    GeoHashBits geohash;
+    uint8_t step = geohashEstimateStepsByRadius(radius_meters);
+    if (!geohashEncodeType(coord_type, latlong[0], latlong[1], step,
+                           &geohash)) {
+        addReplyError(c, "coordinates out of range");
+        return;
+    }
 
     /* Align the hash to a valid 52-bit integer based on step size */
     GeoHashFix52Bits bits = geohashAlign52Bits(geohash);
@@ -704,7 +3401,7 @@ void geoEncodeCommand(redisClient *c) {
     printf("Decoding with step size: %d\n", geohash.step);
 #endif
     GeoHashArea area;
-    geohashDecodeWGS84(geohash, &area);
+    geohashDecodeType(coord_type, geohash, &area);
 
     double y = (area.latitude.min + area.latitude.max) / 2;
     double x = (area.longitude.min + area.longitude.max) / 2;
@@ -3,10 +3,32 @@
 
 #include "redis.h"
 
+/* Result orderings */
+#define SORT_NONE 0
+#define SORT_ASC 1
+#define SORT_DESC 2
+
 void geoEncodeCommand(redisClient *c);
 void geoDecodeCommand(redisClient *c);
 void geoRadiusByMemberCommand(redisClient *c);
 void geoRadiusCommand(redisClient *c);
+void geoRadiusStoreCommand(redisClient *c);
+void geoRadiusByMemberStoreCommand(redisClient *c);
+void geoRadiusMultiCommand(redisClient *c);
+void geoScanCommand(redisClient *c);
+void geoAlongCommand(redisClient *c);
+void geoJoinCommand(redisClient *c);
+void geoDistMatrixCommand(redisClient *c);
+void geoAddBinCommand(redisClient *c);
+void geoLoadCommand(redisClient *c);
+void geoPartitionCommand(redisClient *c);
+void geoFreezeCommand(redisClient *c);
+void geoThawCommand(redisClient *c);
 void geoAddCommand(redisClient *c);
+void geoCacheCommand(redisClient *c);
+void geoStatsCommand(redisClient *c);
+void geoStatsResetCommand(redisClient *c);
+void geoTrackCommand(redisClient *c);
+void geoTrackRangeCommand(redisClient *c);
 
 #endif
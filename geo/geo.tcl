@@ -11,6 +11,12 @@ start_server {tags {"geo"}} {
         r geoadd nyc 40.7648057 -73.9733487 "central park n/q/r" 40.7362513 -73.9903085 "union square" 40.7126674 -74.0131604 "wtc one" 40.6428986 -73.7858139 "jfk" 40.7498929 -73.9375699 "q4" 40.7480973 -73.9564142 4545
     } {6}
 
+    test {GEOADD multi add replies with the number of members given} {
+        r geoadd counted 40.7648057 -73.9733487 a 40.7362513 -73.9903085 b
+        list [r geoadd counted 40.7648057 -73.9733487 a \
+                               40.7126674 -74.0131604 c] [r zcard counted]
+    } {2 3}
+
     test {Check geoset values} {
         r zrange nyc 0 -1 withscores
     } {{wtc one} 1791873972053020 {union square} 1791875485187452 {central park n/q/r} 1791875761332224 4545 1791875796750882 {lic market} 1791875804419201 q4 1791875830079666 jfk 1791895905559723}
@@ -50,4 +56,626 @@ start_server {tags {"geo"}} {
     } {{41.235888125243704 1.8063229322433472}\
        {41.235890659964866 1.806328296661377}\
        {41.235889392604285 1.8063256144523621}}
+
+    test {GEOADD parses exponent and integer coordinates} {
+        r geoadd parsed 4.0747533e1 -73.9454966 a 40 -74 b
+        r geoadd parsedref 40.747533 -73.9454966 a 40.0 -74.0 b
+        expr {[r zrange parsed 0 -1 withscores] eq
+              [r zrange parsedref 0 -1 withscores]}
+    } {1}
+
+    test {GEOADD rejects invalid coordinates} {
+        catch {r geoadd parsed 40.7x -73.9 c} err
+        list [string match "*not a valid float*" $err] [r zcard parsed]
+    } {1 2}
+
+    test {GEOCACHE serves repeated GEORADIUS from cache} {
+        r geocache size 1048576
+        r geocache resetstats
+        set first [r georadius nyc 40.7598464 -73.9798091 3 km ascending]
+        set second [r georadius nyc 40.7598464 -73.9798091 3 km ascending]
+        set stats [r geocache stats]
+        list $first $second [dict get $stats hits] [dict get $stats misses]
+    } {{{central park n/q/r} 4545 {union square}} {{central park n/q/r} 4545 {union square}} 1 1}
+
+    test {GEOCACHE invalidates after GEOADD} {
+        r geoadd nyc 40.7598464 -73.9798091 "times square"
+        set after [r georadius nyc 40.7598464 -73.9798091 3 km ascending]
+        set stats [r geocache stats]
+        r geocache size 0
+        list $after [dict get $stats invalidations]
+    } {{{times square} {central park n/q/r} 4545 {union square}} 1}
+
+    test {GEOCACHE keys entries by the exact center} {
+        r geocache size 1048576
+        r geocache resetstats
+        r georadius nyc 40.7598464 -73.9798091 3 km withdist
+        r georadius nyc 40.7598465 -73.9798091 3 km withdist
+        set stats [r geocache stats]
+        r geocache size 0
+        list [dict get $stats hits] [dict get $stats misses]
+    } {0 2}
+
+    test {GEOCACHE sees DEL and re-create at the same length} {
+        r geocache size 1048576
+        r geoadd recreated 40.7598464 -73.9798091 a
+        set before [r georadius recreated 40.7598464 -73.9798091 1 km]
+        r del recreated
+        r geoadd recreated 40.7598464 -73.9798091 b
+        set after [r georadius recreated 40.7598464 -73.9798091 1 km]
+        r geocache size 0
+        list $before $after
+    } {a b}
+
+    test {GEOCACHE sees plain zset writes at the same length} {
+        r geocache size 1048576
+        r geocache resetstats
+        r geoadd plaincached 40.7598464 -73.9798091 a \
+                             40.7126674 -74.0131604 b
+        set first [r georadius plaincached 40.7598464 -73.9798091 1 km]
+        # move b next to a with a plain ZADD XX
+        r zadd plaincached xx [r zscore plaincached a] b
+        set moved [r georadius plaincached 40.7598464 -73.9798091 1 km]
+        # swap a for c without changing the length
+        r zrem plaincached a
+        r zadd plaincached [r zscore plaincached b] c
+        set swapped [r georadius plaincached 40.7598464 -73.9798091 1 km]
+        set stats [r geocache stats]
+        r geocache size 0
+        list $first [lsort $moved] [lsort $swapped] \
+             [dict get $stats hits] [dict get $stats invalidations]
+    } {a {a b} {b c} 0 2}
+
+    test {GEOCACHE releases keys deleted without being searched again} {
+        r geocache size 1048576
+        r geoadd dropcached 40.7598464 -73.9798091 a
+        r georadius dropcached 40.7598464 -73.9798091 1 km
+        set before [dict get [r geocache stats] keys]
+        r del dropcached
+        # any other lookup sweeps the deleted key
+        r georadius nyc 40.7598464 -73.9798091 1 km
+        set stats [r geocache stats]
+        r geocache size 0
+        list $before [dict get $stats keys] [dict get $stats entries]
+    } {1 1 1}
+
+    test {GEOSTATS counts radius search work per key} {
+        r geostatsreset
+        r georadius nyc 40.7598464 -73.9798091 3 km ascending
+        set global [r geostats]
+        set key [r geostats key nyc]
+        r geostatsreset nyc
+        list [dict get $global searches] [dict get $key searches] \
+             [dict get $key accepted] \
+             [expr {[dict get $key candidates] >= 4}] \
+             [expr {[dict get $key ranges] < [dict get $key cells]}] \
+             [expr {[llength [dict get $key scan-us-histogram]] > 0}] \
+             [dict get [r geostats key nyc] searches]
+    } {1 1 4 1 1 1 0}
+
+    test {GEOSTATS only keeps totals of existing keys} {
+        r geostatsreset
+        r georadius nostats 40.7598464 -73.9798091 3 km
+        r geoadd nostats 40.7598464 -73.9798091 "times square"
+        list [dict get [r geostats] searches] \
+             [dict get [r geostats key nostats] searches]
+    } {1 0}
+
+    test {GEOADD MOVE adds new members and moves existing members} {
+        r geoadd fleet move 0 m 40.7598464 -73.9798091 car1 \
+                                40.712667 -74.013163 car2
+        set moved [r geoadd fleet move 0 m 40.747533 -73.9454966 car1]
+        list $moved [r georadius fleet 40.747533 -73.9454966 1 km]
+    } {0 car1}
+
+    test {GEOADD MOVE applies moves below threshold} {
+        r geoadd fleet move 100 m 40.7475 -73.9455 car1
+        r georadius fleet 40.7475 -73.9455 10 m
+    } {car1}
+
+    test {GEOADD EX expires members} {
+        r geoadd expiring ex 1 40.7598464 -73.9798091 "times square" \
+                               40.747533 -73.9454966 "lic market"
+        r geoadd expiring ex 100 40.712667 -74.013163 "wtc one"
+        after 1100
+        r georadius expiring 40.7598464 -73.9798091 10 km ascending
+    } {{wtc one}}
+
+    test {GEOADD without EX clears expire times} {
+        r geoadd expiring 40.712667 -74.013163 "wtc one"
+        r exists __geottl:expiring
+    } {0}
+
+    test {GEORADIUS skips every expired member} {
+        for {set i 0} {$i < 40} {incr i} {
+            r geoadd manyexpiring ex 1 40.7598464 -73.9798091 "member $i"
+        }
+        r geoadd manyexpiring 40.712667 -74.013163 "wtc one"
+        after 1100
+        set found [r georadius manyexpiring 40.7598464 -73.9798091 10 km]
+        binary scan [r geodistmatrix manyexpiring m "member 0" "wtc one"] \
+                    f4 distances
+        list $found [lrange $distances 0 1]
+    } {{{wtc one}} {NaN NaN}}
+
+    test {GEOADD of a deleted key doesn't inherit expire times} {
+        r geoadd recreated ex 100 40.712667 -74.013163 "wtc one"
+        r del recreated
+        r geoadd recreated 40.7598464 -73.9798091 "times square"
+        r exists __geottl:recreated
+    } {0}
+
+    test {GEORADIUSMULTI answers every center} {
+        r georadiusmulti nyc 3 km 40.7598464 -73.9798091 \
+                                  40.7126674 -74.0131604 ascending
+    } {{{times square} {central park n/q/r} 4545 {union square}} {{wtc one}}}
+
+    test {GEOSCAN iterates a radius search with a cursor} {
+        set cursor 0
+        set found {}
+        set calls 0
+        while 1 {
+            set reply [r geoscan nyc 40.7598464 -73.9798091 3 km \
+                                 cursor $cursor count 2]
+            set cursor [lindex $reply 0]
+            lappend found {*}[lindex $reply 1]
+            incr calls
+            if {$cursor eq "0"} break
+        }
+        list [lsort $found] [expr {$calls > 1}]
+    } {{4545 {central park n/q/r} {times square} {union square}} 1}
+
+    test {GEORADIUS ASYNC matches the inline search} {
+        set blob {}
+        for {set i 0} {$i < 5000} {incr i} {
+            set member "p$i"
+            append blob [binary format qqi [expr {40.75 + ($i % 100) * 0.0001}] \
+                                           [expr {-73.98 + ($i / 100) * 0.0001}] \
+                                           [string length $member]]
+            append blob $member
+        }
+        r geoaddbin dense $blob
+        set inline [r georadius dense 40.755 -73.9775 1 km withdist]
+        set async [r georadius dense 40.755 -73.9775 1 km withdist async]
+        list [llength $async] [expr {[lsort $inline] eq [lsort $async]}] [r ping]
+    } {5000 1 PONG}
+
+    test {GEORADIUS FILTER keeps members whose hash matches} {
+        r geoadd drivers 40.7598464 -73.9798091 d1 40.7590000 -73.9800000 d2 \
+                         40.7580000 -73.9790000 d3 40.7126674 -74.0131604 d4
+        r hmset driver:d1 status idle rating 4.9
+        r hmset driver:d2 status busy rating 4.2
+        r hmset driver:d4 status idle rating 3.0
+        list [r georadius drivers 40.7598464 -73.9798091 1 km \
+                 filter driver: status = idle] \
+             [lsort [r georadius drivers 40.7598464 -73.9798091 1 km \
+                        filter driver: rating >= 4]] \
+             [lsort [r georadius drivers 40.7598464 -73.9798091 1 km \
+                        filter driver: status != idle]]
+    } {d1 {d1 d2} d2}
+
+    test {GEORADIUS FILTER rejects unknown operators} {
+        catch {r georadius drivers 40.7598464 -73.9798091 1 km \
+                   filter driver: status ~ idle} err
+        string match "*operator*" $err
+    } {1}
+
+    test {GEORADIUSSTORE and STOREDIST write results to a zset} {
+        r del nearby nearbydist
+        set stored [r georadiusstore nearby drivers 40.7598464 -73.9798091 \
+                        1 km]
+        set dist [r georadiusstore nearbydist drivers 40.7598464 -73.9798091 \
+                      1 km storedist]
+        list $stored $dist [r zrange nearby 0 -1] \
+             [r zrange nearbydist 0 -1] [r zscore nearbydist d1] \
+             [expr {[r zscore nearby d1] == [r zscore drivers d1]}]
+    } {3 3 {d2 d1 d3} {d1 d2 d3} 0 1}
+
+    test {GEORADIUSBYMEMBERSTORE writes results to a zset} {
+        r del nearby
+        list [r georadiusbymemberstore nearby drivers d1 1 km] \
+             [r zrange nearby 0 -1]
+    } {3 {d2 d1 d3}}
+
+    test {GEORADIUSSTORE without matches deletes the destination} {
+        list [r georadiusstore nearby drivers 10 10 1 km] [r exists nearby]
+    } {0 0}
+
+    test {Read only radius searches refuse STORE} {
+        catch {r georadius drivers 40.7598464 -73.9798091 1 km \
+                   store nearby} err
+        list [string match "*GEORADIUSSTORE*" $err] [r exists nearby]
+    } {1 0}
+
+    test {GEOALONG finds members near a path} {
+        r geoalong nyc 500 m 40.7126674 -74.0131604 40.7362513 -73.9903085
+    } {{wtc one} {union square}}
+
+    test {GEOJOIN pairs members within radius} {
+        r geoadd riders 40.7598464 -73.9798091 r1 40.7126674 -74.0131604 r2
+        r geojoin riders nyc 500 m
+    } {{r2 {wtc one}} {r1 {times square}}}
+
+    test {GEODISTMATRIX returns packed float32 distances} {
+        set m [r geodistmatrix nyc km "wtc one" "union square" missing]
+        binary scan $m f* d
+        set rounded {}
+        foreach v $d {
+            if {$v eq "NaN"} { lappend rounded NaN } else { lappend rounded [format %.2f $v] }
+        }
+        list [string length $m] [lrange $rounded 0 4] [lindex $rounded 2]
+    } {36 {0.00 3.25 NaN 3.25 0.00} NaN}
+
+    test {GEODISTMATRIX rejects bad ORIGINS} {
+        set errors {}
+        foreach n {-1 -5 0 3} {
+            catch {r geodistmatrix nyc km origins $n "wtc one" \
+                                  "union square" missing} err
+            lappend errors [string match "*origins must be*" $err]
+        }
+        set errors
+    } {1 1 1 1}
+
+    test {GEOADD PLANAR and planar radius searches} {
+        r geoadd floor planar 10 10 robot1 500 500 robot2
+        list [r georadius floor 0 0 20 m planar] \
+             [r georadiusbymember floor robot1 1 km planar ascending]
+    } {robot1 {robot1 robot2}}
+
+    test {GEODISTMATRIX and GEOJOIN PLANAR measure planar meters} {
+        binary scan [r geodistmatrix floor m planar robot1 robot2] f4 d
+        set pairs [r geojoin floor floor 1 km planar withdist]
+        list [expr {abs([lindex $d 1] - 692.96) < 2}] [llength $pairs] \
+             [expr {abs([lindex $pairs 0 2] - 692.96) < 2}]
+    } {1 2 1}
+
+    test {Geojson replies reject planar searches} {
+        catch {r georadius floor 0 0 20 m planar withgeojson} err
+        string match "*planar*" $err
+    } {1}
+
+    test {GEOADD HILBERT orders scores along the Hilbert curve} {
+        r geoadd curvy hilbert 40.7598464 -73.9798091 "times square" \
+                               40.7126674 -74.0131604 "wtc one" \
+                               40.7362513 -73.9903085 "union square"
+        r geoadd zcurve 40.7598464 -73.9798091 "times square"
+        list [expr {[r zscore curvy "times square"] != [r zscore zcurve "times square"]}] \
+             [r georadius curvy 40.7598464 -73.9798091 3 km ascending hilbert] \
+             [r georadiusbymember curvy "wtc one" 10 km descending hilbert]
+    } {1 {{times square} {union square}} {{times square} {union square} {wtc one}}}
+
+    test {GEOENCODE, GEODECODE and geojson bounds follow HILBERT} {
+        set hash [lindex [r geoencode 40.7598464 -73.9798091 hilbert] 0]
+        set center [lindex [r geodecode $hash hilbert] 2]
+        set bounds [r georadius curvy 40.7598464 -73.9798091 1 km \
+                                withgeojsonbounds hilbert]
+        list [expr {$hash == [r zscore curvy "times square"]}] \
+             [format %.4f [lindex $center 0]] [format %.4f [lindex $center 1]] \
+             [string match "*-73.979*40.759*" [lindex $bounds 0 1]]
+    } {1 40.7598 -73.9798 1}
+
+    test {GEOPARTITION routes adds and searches to partitions} {
+        r geoadd parted 40.7598464 -73.9798091 "times square" \
+                        40.7126674 -74.0131604 "wtc one"
+        r geopartition parted 12
+        r geoadd parted 40.7362513 -73.9903085 "union square"
+        set before [r georadius parted 40.7598464 -73.9798091 3 km ascending]
+        # move wtc one next to times square (a different partition)
+        r geoadd parted 40.7598 -73.9798 "wtc one"
+        list $before [r georadiusbymember parted "times square" 100 m ascending] \
+             [r type parted]
+    } {{{times square} {union square}} {{times square} {wtc one}} hash}
+
+    test {GEOPARTITION keeps integer-like member names} {
+        r geoadd numparted 40.7598464 -73.9798091 4545 \
+                           40.7126674 -74.0131604 10 \
+                           40.7362513 -73.9903085 "union square"
+        r geopartition numparted 12
+        r geoadd numparted 40.7598 -73.9798 10
+        list [r georadius numparted 40.7598464 -73.9798091 100 m ascending] \
+             [r georadius numparted 40.7362513 -73.9903085 100 m]
+    } {{4545 10} {{union square}}}
+
+    test {Partitioned keys work with MOVE, GEOADDBIN and GEODISTMATRIX} {
+        r geoadd parted move 10 m 40.7598 -73.9798 "wtc one"
+        set blob [binary format qqi 40.7126674 -74.0131604 4]
+        append blob "wtc2"
+        set added [r geoaddbin parted $blob]
+        binary scan [r geodistmatrix parted km "wtc one" "times square"] \
+                    f4 d
+        list $added [r georadius parted 40.7126674 -74.0131604 1 km] \
+             [expr {[lindex $d 1] < 0.01}]
+    } {1 wtc2 1}
+
+    test {GEORADIUSSTORE into a partitioned key drops its partitions} {
+        r geopartition storedparted 12
+        r geoadd storedparted 40.7126674 -74.0131604 old
+        r georadiusstore storedparted parted 40.7598464 -73.9798091 100 m
+        list [r type storedparted] [r keys "__geo*:{storedparted}*"]
+    } {zset {}}
+
+    test {DEL of a partitioned key doesn't leave partitions for a new key} {
+        r geopartition delparted 12
+        r geoadd delparted 40.7126674 -74.0131604 old
+        r del delparted
+        set stale [r georadius delparted 40.7126674 -74.0131604 1 km]
+        r geoadd delparted 40.7598464 -73.9798091 new
+        list $stale [r type delparted] [r keys "__geo*:{delparted}*"] \
+             [r georadius delparted 40.7126674 -74.0131604 10 km]
+    } {{} zset {} new}
+
+    test {GEORADIUSMULTI, GEOSCAN, GEOALONG and GEOJOIN read any encoding} {
+        foreach key {plainset partset frozenset} {
+            if {$key eq "partset"} {r geopartition $key 12}
+            r geoadd $key 40.7598464 -73.9798091 "times square" \
+                          40.7126674 -74.0131604 "wtc one" \
+                          40.7362513 -73.9903085 "union square"
+            if {$key eq "frozenset"} {r geofreeze $key hash}
+        }
+        set replies {}
+        foreach key {plainset partset frozenset} {
+            lappend replies [list \
+                [r georadiusmulti $key 1 km 40.7598464 -73.9798091 \
+                                          40.7126674 -74.0131604 ascending] \
+                [r geoscan $key 40.7598464 -73.9798091 3 km count 100 \
+                           ascending] \
+                [lsort [r geoalong $key 500 m 40.7598464 -73.9798091 \
+                                            40.7362513 -73.9903085]] \
+                [lsort [r geojoin $key plainset 10 m]]]
+        }
+        list [lindex $replies 0] \
+             [expr {[lindex $replies 1] eq [lindex $replies 0]}] \
+             [expr {[lindex $replies 2] eq [lindex $replies 0]}] \
+             [r type partset] [r type frozenset]
+    } {{{{{times square}} {{wtc one}}}\
+        {0 {{times square} {union square}}}\
+        {{times square} {union square}}\
+        {{{times square} {times square}} {{union square} {union square}}\
+         {{wtc one} {wtc one}}}} 1 1 hash string}
+
+    test {GEOTRACK refuses partitioned keys} {
+        catch {r geotrack parted car1 40.71 -74.01 1000} err
+        string match "*partitioned*" $err
+    } {1}
+
+    test {GEOFREEZE serves searches from a frozen copy} {
+        r geoadd icy 40.7598464 -73.9798091 "times square" \
+                     40.7126674 -74.0131604 "wtc one" \
+                     40.7362513 -73.9903085 "union square"
+        r geofreeze icy hash
+        list [r type icy] \
+             [r georadius icy 40.7598464 -73.9798091 3 km ascending] \
+             [r georadiusbymember icy "wtc one" 1 km]
+    } {string {{times square} {union square}} {{wtc one}}}
+
+    test {Frozen keys are strings to zset commands until thawed} {
+        r geoadd icystring 40.7598464 -73.9798091 "times square"
+        r geofreeze icystring
+        set errors {}
+        foreach cmd {{zscore icystring "times square"} {zrange icystring 0 -1}
+                     {zrem icystring "times square"} {zcard icystring}} {
+            catch {r {*}$cmd} err
+            lappend errors [string match "WRONGTYPE*" $err]
+        }
+        list [r type icystring] $errors [r geothaw icystring] \
+             [r type icystring] [r zrange icystring 0 -1]
+    } {string {1 1 1 1} 1 zset {{times square}}}
+
+    test {GEOADD thaws frozen keys} {
+        r geoadd icy 40.747533 -73.9454966 "lic market"
+        list [r type icy] [r zcard icy]
+    } {zset 4}
+
+    test {GEOLOAD loads CSV files} {
+        set dir [lindex [r config get dir] 1]
+        set fd [open [file join $dir geoload.csv] w]
+        puts $fd "# latitude,longitude,member"
+        puts $fd "40.7598464,-73.9798091,times square"
+        puts $fd "40.7126674,-74.0131604,wtc one"
+        puts $fd "40.7126674,-74.0131604,wtc one"
+        close $fd
+        set loaded [r geoload poi geoload.csv]
+        file delete [file join $dir geoload.csv]
+        list $loaded [r georadius poi 40.7126674 -74.0131604 1 km]
+    } {2 {{wtc one}}}
+
+    test {GEOLOAD only reads files below the server's directory} {
+        set errors {}
+        foreach path {/etc/passwd ../geoload.csv a/../../geoload.csv ..} {
+            catch {r geoload poi $path} err
+            lappend errors [string match "*relative*" $err]
+        }
+        set errors
+    } {1 1 1 1}
+
+    test {GEOLOAD doesn't follow symlinks out of the server's directory} {
+        set dir [lindex [r config get dir] 1]
+        set link [file join $dir geoloadlink]
+        file delete $link
+        file link -symbolic $link /etc
+        catch {r geoload poi geoloadlink/passwd} err
+        file delete $link
+        string match "*symbolic links*" $err
+    } {1}
+
+    test {GEOLOAD explains how to load files past its size limit} {
+        set dir [lindex [r config get dir] 1]
+        set fd [open [file join $dir geoloadbig.csv] w]
+        seek $fd [expr {17 * 1024 * 1024}]
+        puts -nonewline $fd "\n"
+        close $fd
+        catch {r geoload poi geoloadbig.csv} err
+        file delete [file join $dir geoloadbig.csv]
+        string match "*split it*" $err
+    } {1}
+
+    test {GEOLOAD clears expire times of loaded members} {
+        set dir [lindex [r config get dir] 1]
+        set fd [open [file join $dir geoload.csv] w]
+        puts $fd "40.7598464,-73.9798091,times square"
+        close $fd
+        r geoadd loadttl ex 100 40.7598464 -73.9798091 "times square" \
+                                40.7126674 -74.0131604 "wtc one"
+        r geoload loadttl geoload.csv
+        file delete [file join $dir geoload.csv]
+        r zrange __geottl:loadttl 0 -1
+    } {{wtc one}}
+
+    test {GEOADDBIN adds packed binary points} {
+        set blob [binary format qqi 40.7126674 -74.0131604 7]
+        append blob "wtc one"
+        append blob [binary format qqi 40.7598464 -73.9798091 12]
+        append blob "times square"
+        list [r geoaddbin binpoi $blob] \
+             [r georadius binpoi 40.7126674 -74.0131604 1 km]
+    } {2 {{wtc one}}}
+
+    test {GEOADDBIN rejects truncated blobs without changes} {
+        set blob [binary format qqi 40.7126674 -74.0131604 7]
+        append blob "wtc"
+        catch {r geoaddbin binpoi2 $blob} err
+        list [string match "*truncated*" $err] [r exists binpoi2]
+    } {1 0}
+
+    test {GEOTRACK appends to member histories} {
+        list [r geotrack trips car1 40.7126674 -74.0131604 1000] \
+             [r geotrack trips car1 40.7130000 -74.0120000 1005] \
+             [r geotrack trips car1 40.7140000 -74.0110000 1010] \
+             [r geotrack trips car2 40.7484000 -73.9857000 1000]
+    } {1 2 3 1}
+
+    test {GEOTRACK rejects points older than the latest} {
+        catch {r geotrack trips car1 40.71 -74.01 1004} err
+        list [string match "*older*" $err] [llength [r geotrackrange trips car1 - +]]
+    } {1 3}
+
+    test {GEOTRACKRANGE reads a time window} {
+        set points [r geotrackrange trips car1 1001 +]
+        list [llength $points] [lindex $points 0 0] \
+             [format %.4f [lindex $points 0 1]] \
+             [format %.4f [lindex $points 0 2]]
+    } {2 1005 40.7130 -74.0120}
+
+    test {GEOTRACKRANGE HILBERT reports Hilbert hashes} {
+        set hash [lindex [r geoencode 40.7126674 -74.0131604 hilbert] 0]
+        list [expr {[lindex [r geotrackrange trips car1 - 1000 withhash \
+                                            hilbert] 0 3] == $hash}] \
+             [expr {[lindex [r geotrackrange trips car1 - 1000 withhash] 0 3] \
+                    == [lindex [r geoencode 40.7126674 -74.0131604] 0]}]
+    } {1 1}
+
+    test {GEOTRACK RETENTION trims whole blocks} {
+        for {set t 0} {$t < 300} {incr t} {
+            r geotrack bushist bus 40.7 -74.0 $t retention 100
+        }
+        set points [r geotrackrange bushist bus - +]
+        list [llength $points] [lindex $points 0 0] [lindex $points end 0]
+    } {172 128 299}
+}
+
+start_server {tags {"geo repl"}} {
+    start_server {} {
+        set master [srv -1 client]
+        set replica [srv 0 client]
+
+        proc geo_wait_for_replica {master replica} {
+            wait_for_condition 50 100 {
+                [$master debug digest] eq [$replica debug digest]
+            } else {
+                fail "replica didn't catch up with the master"
+            }
+        }
+
+        test {GEO replica connects to the master} {
+            $replica slaveof [srv -1 host] [srv -1 port]
+            wait_for_condition 50 100 {
+                [s 0 master_link_status] eq {up}
+            } else {
+                fail "replica didn't connect"
+            }
+            $master config set appendonly yes
+            wait_for_condition 50 100 {
+                [s -1 aof_rewrite_in_progress] == 0 &&
+                [s -1 aof_rewrite_scheduled] == 0
+            } else {
+                fail "AOF rewrite didn't finish"
+            }
+        }
+
+        test {GEOADD MOVE below threshold reaches replicas and the AOF} {
+            $master geoadd fleet move 100 m 40.7475 -73.9455 car1
+            $master geoadd fleet move 100 m 40.7476 -73.9455 car1
+            set score [$master zscore fleet car1]
+            geo_wait_for_replica $master $replica
+            $master debug loadaof
+            list [expr {$score eq [$replica zscore fleet car1]}] \
+                 [expr {$score eq [$master zscore fleet car1]}]
+        } {1 1}
+
+        test {GEOLOAD REPLACE reaches replicas and the AOF as one transaction} {
+            set dir [lindex [$master config get dir] 1]
+            set fd [open [file join $dir geoload.csv] w]
+            for {set i 0} {$i < 3000} {incr i} {
+                puts $fd "40.[expr {7000 + $i}],-73.9798091,member $i"
+            }
+            close $fd
+            $master geoadd bulk ex 100 40.7126674 -74.0131604 "wtc one"
+            set loaded [$master geoload bulk geoload.csv replace]
+            file delete [file join $dir geoload.csv]
+            geo_wait_for_replica $master $replica
+            $master debug loadaof
+            list $loaded [$replica zcard bulk] [$master zcard bulk] \
+                 [$replica exists __geottl:bulk]
+        } {3000 3000 3000 0}
+
+        test {Replicas publish GEOADD location updates} {
+            set rd [redis_deferring_client]
+            $rd psubscribe __geo:pubfleet:*
+            $rd read
+            $master geoadd pubfleet 40.7 -73.9 car1
+            $master geoadd pubfleet move 100 m 40.75 -73.9 car1
+            set messages [list [lindex [$rd read] 3] [lindex [$rd read] 3]]
+            $rd close
+            set messages
+        } {{40.7000000 -73.9000000} {40.7500000 -73.9000000}}
+
+        test {Replicas have the new position when they publish it} {
+            set rd [redis_deferring_client]
+            $rd psubscribe __geo:orderfleet:*
+            $rd read
+            $master geoadd orderfleet 40.7 -73.9 car1
+            $rd read
+            set scores {}
+            foreach {lat move} {40.75 {} 40.76 {move 100 m}} {
+                $master geoadd orderfleet {*}$move $lat -73.9 car1
+                $rd read
+                lappend scores [expr {[$replica zscore orderfleet car1] eq
+                                      [$master zscore orderfleet car1]}]
+            }
+            $rd close
+            set scores
+        } {1 1}
+
+        test {Partitioned GEOADD reaches replicas and the AOF} {
+            $master geoadd replparted 40.7598464 -73.9798091 "times square" \
+                                      40.7126674 -74.0131604 "wtc one"
+            $master geopartition replparted 12
+            $master geoadd replparted 40.7362513 -73.9903085 "union square" \
+                                      40.7598 -73.9798 "wtc one"
+            geo_wait_for_replica $master $replica
+            $master debug loadaof
+            list [$replica georadius replparted 40.7598464 -73.9798091 \
+                                     100 m ascending] \
+                 [$master georadius replparted 40.7126674 -74.0131604 1 km] \
+                 [expr {[$master debug digest] eq [$replica debug digest]}]
+        } {{{times square} {wtc one}} {} 1}
+
+        test {GEO reads on replicas skip expired members} {
+            $master geoadd replexpiring ex 1 40.7598464 -73.9798091 a
+            $master geoadd replexpiring 40.712667 -74.013163 b
+            geo_wait_for_replica $master $replica
+            after 1100
+            $replica georadius replexpiring 40.75 -73.98 10 km
+        } {b}
+    }
 }
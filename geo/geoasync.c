@@ -0,0 +1,390 @@
+#include "geoasync.h"
+#include "geo.h"
+#include "geohash_helper.h"
+#include "geostats.h"
+#include "zset.h"
+
+/* ====================================================================
+ * Background Radius Filtering
+ * ====================================================================
+ * GEORADIUS ... ASYNC moves distance filtering, sorting and reply
+ * formatting of large searches off the main thread:
+ *   - the main thread copies the candidate scores and members of the
+ *     search's cells into an immutable snapshot owned by a job,
+ *   - blocks the client,
+ *   - a worker thread filters and sorts the snapshot and writes the whole
+ *     reply as raw protocol,
+ *   - the worker hands the job back through a pipe and the main thread
+ *     appends the reply and unblocks the client.
+ *
+ * Clients are blocked the way BLPOP blocks them, on a private sentinel key
+ * nobody pushes to.  That gets us the usual behavior for free: pipelined
+ * commands wait for our reply, and clients disconnecting while blocked are
+ * cleaned up by Redis.  Replies of jobs whose client went away are dropped.
+ * Sentinels ("__geoasync:<random>:<job>") carry a random per-process
+ * secret, so other clients can't guess them and LPUSH a fake reply.
+ *
+ * Workers never touch the keyspace or clients.  They only read their job's
+ * snapshot, allocate the reply and count into the job's GEOSTATS sample,
+ * which the main thread folds in on delivery.  Reply allocations go
+ * through zmalloc from several threads, so we turn on zmalloc's thread safe
+ * used_memory accounting before starting any worker. */
+
+#define GEO_ASYNC_THREADS 4
+
+/* One snapshotted candidate */
+struct geoAsyncCandidate {
+    double score;
+    size_t member; /* offset of the member in the job's member blob */
+    unsigned int len;
+    double distance;
+    double latitude;
+    double longitude;
+};
+
+struct geoAsyncJob {
+    redisClient *c;
+    redisDb *db;
+    robj *key;      /* searched key (for GEOSTATS) */
+    robj *sentinel; /* key the client is blocked on */
+    struct geoAsyncQuery query;
+    struct geoAsyncCandidate *candidates;
+    long count;
+    long alloc;
+    sds members; /* every candidate's member, back to back */
+    sds reply;   /* raw protocol, written by the worker */
+    struct geoStatsSample stats; /* filter/sort/reply work of the worker */
+    listNode *pending;
+};
+
+static struct {
+    pthread_t threads[GEO_ASYNC_THREADS];
+    int started;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    list *queue; /* jobs waiting for a worker (guarded by 'lock') */
+    bool stop;   /* (guarded by 'lock') */
+    int done[2]; /* pipe of finished jobs: workers write, we read */
+    list *pending; /* every job not yet delivered (main thread only) */
+    unsigned long long seq;
+    char secret[REDIS_RUN_ID_SIZE + 1]; /* random part of sentinel keys */
+} async = {.done = {-1, -1}};
+
+/* ====================================================================
+ * Snapshot
+ * ==================================================================== */
+static bool geoAsyncCount(void *privdata, double score, unsigned char *str,
+                          unsigned int len, long long vlong) {
+    long *count = privdata;
+    return ++*count < GEO_ASYNC_MIN_CANDIDATES;
+}
+
+static bool geoAsyncSnapshot(void *privdata, double score, unsigned char *str,
+                             unsigned int len, long long vlong) {
+    struct geoAsyncJob *job = privdata;
+    char buf[32];
+
+    if (!str) {
+        len = ll2string(buf, sizeof(buf), vlong);
+        str = (unsigned char *)buf;
+    }
+
+    if (job->count == job->alloc) {
+        job->alloc *= 2;
+        job->candidates = zrealloc(job->candidates,
+                                   sizeof(*job->candidates) * job->alloc);
+    }
+
+    struct geoAsyncCandidate *candidate = job->candidates + job->count++;
+    candidate->score = score;
+    candidate->member = sdslen(job->members);
+    candidate->len = len;
+    job->members = sdscatlen(job->members, str, len);
+    return true;
+}
+
+/* ====================================================================
+ * Worker side
+ * ==================================================================== */
+static int sort_candidate_asc(const void *a, const void *b) {
+    const struct geoAsyncCandidate *ca = a, *cb = b;
+    if (ca->distance > cb->distance)
+        return 1;
+    else if (ca->distance == cb->distance)
+        return 0;
+    else
+        return -1;
+}
+
+static int sort_candidate_desc(const void *a, const void *b) {
+    return -sort_candidate_asc(a, b);
+}
+
+static sds catBulk(sds reply, const char *str, size_t len) {
+    reply = sdscatprintf(reply, "$%zu\r\n", len);
+    reply = sdscatlen(reply, str, len);
+    return sdscatlen(reply, "\r\n", 2);
+}
+
+/* Same formats as addReplyDouble() and addReplyDoubleNicer() */
+static sds catDouble(sds reply, const char *fmt, double d) {
+    char dbuf[128];
+    int dlen = snprintf(dbuf, sizeof(dbuf), fmt, d);
+    return catBulk(reply, dbuf, dlen);
+}
+
+/* Filter, sort and format the reply exactly like the inline path. */
+static void geoAsyncRun(struct geoAsyncJob *job) {
+    const struct geoAsyncQuery *q = &job->query;
+    struct geoStatsSample *stats = &job->stats;
+    bool haversine = GEO_COORD_BASE(q->coord_type) == GEO_WGS84_TYPE;
+    long found = 0;
+
+    long long stage = ustime();
+    stats->candidates = job->count;
+    for (long i = 0; i < job->count; i++) {
+        struct geoAsyncCandidate candidate = job->candidates[i];
+        GeoHashBits hash = {.bits = (uint64_t)candidate.score,
+                            .step = GEO_STEP_MAX};
+        double latlong[2];
+
+        stats->decodes++;
+        if (!geohashDecodeToLatLongType(q->coord_type, hash, latlong))
+            continue;
+
+        stats->haversines += haversine;
+        if (!geohashGetDistanceIfInRadius(q->coord_type, q->longitude,
+                                          q->latitude, latlong[1], latlong[0],
+                                          q->radius, &candidate.distance))
+            continue;
+
+        /* Planar searches only take the square root for replies */
+        if (GEO_COORD_BASE(q->coord_type) == GEO_MERCATOR_TYPE)
+            candidate.distance = sqrt(candidate.distance);
+        candidate.distance /= q->conversion;
+        candidate.latitude = latlong[0];
+        candidate.longitude = latlong[1];
+        job->candidates[found++] = candidate;
+    }
+    stats->accepted = found;
+    geoStatsSampleStage(stats, GEO_STATS_FILTER, stage);
+
+    stage = ustime();
+    if (q->sort == SORT_ASC)
+        qsort(job->candidates, found, sizeof(*job->candidates),
+              sort_candidate_asc);
+    else if (q->sort == SORT_DESC)
+        qsort(job->candidates, found, sizeof(*job->candidates),
+              sort_candidate_desc);
+    geoStatsSampleStage(stats, GEO_STATS_SORT, stage);
+
+    stage = ustime();
+    int option_length = q->withdist + q->withhash + q->withcoords;
+    sds reply = sdscatprintf(sdsempty(), "*%ld\r\n", found);
+    for (long i = 0; i < found; i++) {
+        struct geoAsyncCandidate *candidate = job->candidates + i;
+
+        if (option_length)
+            reply = sdscatprintf(reply, "*%d\r\n", option_length + 1);
+
+        reply = catBulk(reply, job->members + candidate->member,
+                        candidate->len);
+
+        if (q->withdist)
+            reply = catDouble(reply, "%.2f", candidate->distance);
+
+        if (q->withhash)
+            reply = sdscatprintf(reply, ":%lld\r\n",
+                                 (long long)candidate->score);
+
+        if (q->withcoords) {
+            reply = sdscatlen(reply, "*2\r\n", 4);
+            reply = catDouble(reply, "%.17g", candidate->latitude);
+            reply = catDouble(reply, "%.17g", candidate->longitude);
+        }
+    }
+
+    job->reply = reply;
+    geoStatsSampleStage(stats, GEO_STATS_REPLY, stage);
+}
+
+static void *geoAsyncWorker(void *arg) {
+    while (1) {
+        pthread_mutex_lock(&async.lock);
+        while (!async.stop && !listLength(async.queue))
+            pthread_cond_wait(&async.ready, &async.lock);
+
+        if (async.stop) {
+            pthread_mutex_unlock(&async.lock);
+            return NULL;
+        }
+
+        listNode *ln = listFirst(async.queue);
+        struct geoAsyncJob *job = listNodeValue(ln);
+        listDelNode(async.queue, ln);
+        pthread_mutex_unlock(&async.lock);
+
+        geoAsyncRun(job);
+
+        /* Pointer-sized writes to a pipe are atomic */
+        if (write(async.done[1], &job, sizeof(job)) != sizeof(job))
+            redisLog(REDIS_WARNING, "geo: can't hand back async search");
+    }
+}
+
+/* ====================================================================
+ * Main thread side
+ * ==================================================================== */
+static void geoAsyncJobFree(struct geoAsyncJob *job) {
+    decrRefCount(job->key);
+    decrRefCount(job->sentinel);
+    zfree(job->candidates);
+    sdsfree(job->members);
+    sdsfree(job->reply);
+    zfree(job);
+}
+
+/* Is the job's client still connected and blocked on behalf of this job?
+ * Sentinel keys are unique, so a new client reusing a freed client's
+ * address can't be mistaken for the original. */
+static bool geoAsyncClientWaiting(struct geoAsyncJob *job) {
+    redisClient *c = job->c;
+    return listSearchKey(server.clients, c) && (c->flags & REDIS_BLOCKED) &&
+           dictFind(c->bpop.keys, job->sentinel);
+}
+
+/* Unblock the job's client with the worker's reply (or 'err' if the job
+ * never ran) and free the job. */
+static void geoAsyncDeliver(struct geoAsyncJob *job, char *err) {
+    listDelNode(async.pending, job->pending);
+
+    if (!err)
+        geoStatsFold(job->db, job->key, &job->stats);
+
+    if (geoAsyncClientWaiting(job)) {
+        unblockClientWaitingData(job->c);
+        if (err) {
+            addReplyError(job->c, err);
+        } else {
+            addReplySds(job->c, job->reply);
+            job->reply = NULL;
+        }
+    }
+
+    geoAsyncJobFree(job);
+}
+
+static void geoAsyncDone(struct aeEventLoop *el, int fd, void *privdata,
+                         int mask) {
+    struct geoAsyncJob *job;
+    while (read(fd, &job, sizeof(job)) == sizeof(job))
+        geoAsyncDeliver(job, NULL);
+}
+
+bool geoAsyncAllowed(redisClient *c) {
+    return async.started && c->fd != -1 &&
+           !(c->flags & (REDIS_MULTI | REDIS_LUA_CLIENT));
+}
+
+bool geoAsyncSearchAndReply(redisClient *c, robj *zobj, const double *ranges,
+                            int count, const struct geoAsyncQuery *query) {
+    /* Counting stops at the threshold, so big searches don't pay for a
+     * full extra pass. */
+    long candidates = 0;
+    for (int i = 0; i < count && candidates < GEO_ASYNC_MIN_CANDIDATES; i++)
+        geozrangeVisit(zobj, ranges[i * 2], ranges[i * 2 + 1], geoAsyncCount,
+                       &candidates);
+
+    if (candidates < GEO_ASYNC_MIN_CANDIDATES)
+        return false;
+
+    struct geoAsyncJob *job = zcalloc(sizeof(*job));
+    job->c = c;
+    job->db = c->db;
+    job->key = c->argv[1];
+    incrRefCount(job->key);
+    job->query = *query;
+    job->alloc = GEO_ASYNC_MIN_CANDIDATES;
+    job->candidates = zmalloc(sizeof(*job->candidates) * job->alloc);
+    job->members = sdsempty();
+
+    long long stage = geoStatsStageStart();
+    for (int i = 0; i < count; i++)
+        geozrangeVisit(zobj, ranges[i * 2], ranges[i * 2 + 1],
+                       geoAsyncSnapshot, job);
+    geoStatsStageEnd(GEO_STATS_SCAN, stage);
+
+    job->sentinel = createObject(
+        REDIS_STRING, sdscatprintf(sdsempty(), "__geoasync:%s:%llu",
+                                   async.secret, async.seq++));
+    blockForKeys(c, &job->sentinel, 1, 0, NULL);
+
+    listAddNodeTail(async.pending, job);
+    job->pending = listLast(async.pending);
+
+    pthread_mutex_lock(&async.lock);
+    listAddNodeTail(async.queue, job);
+    pthread_cond_signal(&async.ready);
+    pthread_mutex_unlock(&async.lock);
+
+    return true;
+}
+
+/* ====================================================================
+ * Bring up / Teardown
+ * ==================================================================== */
+void geoAsyncInit(void) {
+    async.queue = listCreate();
+    async.pending = listCreate();
+    pthread_mutex_init(&async.lock, NULL);
+    pthread_cond_init(&async.ready, NULL);
+    getRandomHexChars(async.secret, REDIS_RUN_ID_SIZE);
+
+    /* Without workers, ASYNC searches just run inline */
+    if (pipe(async.done) == -1) {
+        redisLog(REDIS_WARNING, "geo: can't create async pipe: %s",
+                 strerror(errno));
+        return;
+    }
+
+    anetNonBlock(NULL, async.done[0]);
+    aeCreateFileEvent(server.el, async.done[0], AE_READABLE, geoAsyncDone,
+                      NULL);
+
+    /* Workers allocate replies while the main thread allocates too */
+    zmalloc_enable_thread_safeness();
+
+    for (; async.started < GEO_ASYNC_THREADS; async.started++)
+        if (pthread_create(async.threads + async.started, NULL,
+                           geoAsyncWorker, NULL))
+            break;
+}
+
+void geoAsyncFree(void) {
+    pthread_mutex_lock(&async.lock);
+    async.stop = true;
+    pthread_cond_broadcast(&async.ready);
+    pthread_mutex_unlock(&async.lock);
+
+    for (int i = 0; i < async.started; i++)
+        pthread_join(async.threads[i], NULL);
+
+    /* Deliver finished jobs, then fail the ones no worker picked up. */
+    if (async.done[0] != -1) {
+        geoAsyncDone(server.el, async.done[0], NULL, AE_READABLE);
+        aeDeleteFileEvent(server.el, async.done[0], AE_READABLE);
+        close(async.done[0]);
+        close(async.done[1]);
+    }
+
+    while (listLength(async.pending))
+        geoAsyncDeliver(listNodeValue(listFirst(async.pending)),
+                        "geo module unloaded before search finished");
+
+    listRelease(async.queue);
+    listRelease(async.pending);
+    pthread_cond_destroy(&async.ready);
+    pthread_mutex_destroy(&async.lock);
+    memset(&async, 0, sizeof(async));
+    async.done[0] = async.done[1] = -1;
+}
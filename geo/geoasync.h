@@ -0,0 +1,36 @@
+#ifndef __GEOASYNC_H__
+#define __GEOASYNC_H__
+
+#include "redis.h"
+#include <stdbool.h>
+
+/* Searches with fewer candidates than this run inline */
+#define GEO_ASYNC_MIN_CANDIDATES 4096
+
+/* Everything a worker needs to filter candidates and format the reply */
+struct geoAsyncQuery {
+    uint8_t coord_type;
+    double latitude;
+    double longitude;
+    double radius;     /* meters */
+    double conversion; /* meters per requested unit */
+    int sort;          /* SORT_NONE, SORT_ASC, SORT_DESC */
+    bool withdist, withhash, withcoords;
+};
+
+/* Bring up / Teardown (called from module load/cleanup) */
+void geoAsyncInit(void);
+void geoAsyncFree(void);
+
+/* Can replies to 'c' be delivered later?  (Not for fake clients or inside
+ * MULTI.) */
+bool geoAsyncAllowed(redisClient *c);
+
+/* If the half-open score ranges [ranges[i * 2], ranges[i * 2 + 1]) of
+ * 'zobj' hold at least GEO_ASYNC_MIN_CANDIDATES members, snapshot them,
+ * block 'c' and answer 'query' from a worker thread.  Returns false
+ * (without replying) if the search is small enough to run inline. */
+bool geoAsyncSearchAndReply(redisClient *c, robj *zobj, const double *ranges,
+                            int count, const struct geoAsyncQuery *query);
+
+#endif
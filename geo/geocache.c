@@ -0,0 +1,417 @@
+#include "geocache.h"
+
+/* multi.c prototype (not in redis.h) */
+void watchForKey(redisClient *c, robj *key);
+
+/* ====================================================================
+ * GEORADIUS Result Cache
+ * ====================================================================
+ * An opt-in cache of fully encoded GEORADIUS/GEORADIUSBYMEMBER replies.
+ *
+ * Entries are keyed by (db, key, exact center, radius, units and options)
+ * and remember the exact protocol bytes of the reply, so a hit skips the
+ * zset scan, distance filtering, sorting, and reply formatting.  Only a
+ * query with the same center can hit, so distances and ordering are the
+ * ones an uncached run would reply with.
+ *
+ * Every key with cached entries has a watcher: a fake client WATCHing the
+ * key, exactly like a client about to MULTI.  Every write to the key (ZADD,
+ * ZREM, DEL, RENAME, SET, geo commands, ...) calls signalModifiedKey(),
+ * which flags the watcher REDIS_DIRTY_CAS, and a dirty watcher drops every
+ * entry of its key.  The key also pins the zset its entries were created
+ * against.  Writes which don't signal (FLUSHDB, loading a new dataset) put
+ * a different zset at the key, which can't reuse our pinned object's
+ * address, so they're caught too.
+ *
+ * Every lookup and store also checks a few keys (round robin) for being
+ * dirty, deleted or replaced, so zsets pinned by keys nobody searches
+ * anymore are released soon rather than when their entries get evicted.
+ *
+ * Total cached bytes (replies plus the per-key watcher) are bounded by
+ * GEOCACHE SIZE.  When we go over the limit, we evict least recently used
+ * entries first. */
+
+/* Keys checked for staleness on every lookup and store */
+#define GEO_CACHE_SWEEP_KEYS 4
+
+/* One key with cached replies */
+struct geoCacheKey {
+    sds keyid;            /* "<db>:<key>" (owned by gc.keys) */
+    redisDb *db;
+    robj *key;
+    robj *zobj;           /* zset our entries were created against (ref) */
+    redisClient *watcher; /* WATCHes 'key' */
+    list *entries;        /* ids of our entries */
+    listNode *sweep;      /* our position in gc.sweep */
+    size_t bytes;         /* bytes charged against max_bytes */
+};
+
+/* One cached reply */
+struct geoCacheEntry {
+    struct geoCacheKey *key; /* key we were created against */
+    listNode *key_entry;     /* our position in key->entries */
+    sds reply;               /* raw protocol reply */
+    size_t bytes;            /* bytes charged against max_bytes */
+    listNode *lru;           /* our position in the LRU list */
+};
+
+static struct {
+    dict *entries; /* sds id -> struct geoCacheEntry */
+    dict *keys;    /* sds keyid -> struct geoCacheKey */
+    list *lru;     /* head = most recently used; values are sds ids */
+    list *sweep;   /* every struct geoCacheKey, in sweep order */
+    size_t bytes;
+    size_t max_bytes; /* 0 = cache disabled */
+    long long hits;
+    long long misses;
+    long long evictions;
+    long long invalidations;
+    redisClient *capture; /* fake client collecting replies for caching */
+} gc = {0};
+
+/* ====================================================================
+ * dict types
+ * ==================================================================== */
+static unsigned int geoCacheHash(const void *key) {
+    return dictGenHashFunction(key, sdslen((sds)key));
+}
+
+static int geoCacheKeyCompare(void *privdata, const void *key1,
+                              const void *key2) {
+    size_t l1 = sdslen((sds)key1);
+    size_t l2 = sdslen((sds)key2);
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+static void geoCacheSdsDestructor(void *privdata, void *val) {
+    sdsfree(val);
+}
+
+static dictType geoCacheEntryDictType = {
+    geoCacheHash,          /* hash function */
+    NULL,                  /* key dup */
+    NULL,                  /* val dup */
+    geoCacheKeyCompare,    /* key compare */
+    geoCacheSdsDestructor, /* key destructor */
+    NULL                   /* val destructor (entries freed by us) */
+};
+
+static dictType geoCacheKeyDictType = {
+    geoCacheHash,          /* hash function */
+    NULL,                  /* key dup */
+    NULL,                  /* val dup */
+    geoCacheKeyCompare,    /* key compare */
+    geoCacheSdsDestructor, /* key destructor */
+    NULL                   /* val destructor (keys freed by us) */
+};
+
+/* ====================================================================
+ * Bring up / Teardown
+ * ==================================================================== */
+void geoCacheInit(void) {
+    gc.entries = dictCreate(&geoCacheEntryDictType, NULL);
+    gc.keys = dictCreate(&geoCacheKeyDictType, NULL);
+    gc.lru = listCreate();
+    gc.sweep = listCreate();
+    gc.capture = createClient(-1);
+    /* The fake client buffer only works if fd == -1 && flags & LUA_CLIENT */
+    gc.capture->flags |= REDIS_LUA_CLIENT;
+}
+
+void geoCacheFree(void) {
+    geoCacheFlush();
+    dictRelease(gc.entries);
+    dictRelease(gc.keys);
+    listRelease(gc.lru);
+    listRelease(gc.sweep);
+    freeClient(gc.capture);
+    memset(&gc, 0, sizeof(gc));
+}
+
+/* ====================================================================
+ * Key Management
+ * ==================================================================== */
+static sds geoCacheKeyId(redisDb *db, robj *key) {
+    sds keyid = sdsfromlonglong(db->id);
+    keyid = sdscatlen(keyid, ":", 1);
+    return sdscatsds(keyid, key->ptr);
+}
+
+static struct geoCacheKey *geoCacheKeyCreate(sds keyid, redisDb *db,
+                                             robj *key, robj *zobj) {
+    struct geoCacheKey *k = zmalloc(sizeof(*k));
+
+    k->keyid = sdsdup(keyid);
+    k->db = db;
+    k->key = createStringObject(key->ptr, sdslen(key->ptr));
+    k->zobj = zobj;
+    incrRefCount(zobj);
+    k->watcher = createClient(-1);
+    selectDb(k->watcher, db->id);
+    watchForKey(k->watcher, k->key);
+    k->entries = listCreate();
+    listAddNodeHead(gc.sweep, k);
+    k->sweep = listFirst(gc.sweep);
+    k->bytes = sizeof(*k) + sizeof(*k->watcher) + sdslen(keyid);
+
+    dictAdd(gc.keys, k->keyid, k);
+    gc.bytes += k->bytes;
+    return k;
+}
+
+/* Called once the last entry of 'k' is gone */
+static void geoCacheKeyFree(struct geoCacheKey *k) {
+    gc.bytes -= k->bytes;
+    listDelNode(gc.sweep, k->sweep);
+    freeClient(k->watcher); /* also unwatches 'key' */
+    decrRefCount(k->key);
+    decrRefCount(k->zobj);
+    listRelease(k->entries);
+
+    /* Deleting the dict entry also frees 'keyid' (the dict owns it) */
+    dictDelete(gc.keys, k->keyid);
+    zfree(k);
+}
+
+/* Was 'k' written, deleted or replaced since we started watching it? */
+static bool geoCacheKeyStale(struct geoCacheKey *k) {
+    if (k->watcher->flags & REDIS_DIRTY_CAS)
+        return true;
+
+    /* Straight from the keyspace: lookupKey() would touch the LRU clock */
+    dictEntry *de = dictFind(k->db->dict, k->key->ptr);
+    return !de || dictGetVal(de) != k->zobj;
+}
+
+/* ====================================================================
+ * Entry Management
+ * ==================================================================== */
+/* Remove entry 'id' (and its key, if it was the key's last entry). */
+static void geoCacheRemove(sds id) {
+    dictEntry *de = dictFind(gc.entries, id);
+    if (!de)
+        return;
+
+    struct geoCacheEntry *e = dictGetVal(de);
+    struct geoCacheKey *k = e->key;
+
+    gc.bytes -= e->bytes;
+    listDelNode(gc.lru, e->lru);
+    listDelNode(k->entries, e->key_entry);
+    sdsfree(e->reply);
+    zfree(e);
+
+    /* Deleting the dict entry also frees 'id' (the dict owns the key) */
+    dictDelete(gc.entries, id);
+
+    if (!listLength(k->entries))
+        geoCacheKeyFree(k);
+}
+
+/* Drop every entry of 'k' (which frees 'k') as invalidated. */
+static void geoCacheKeyInvalidate(struct geoCacheKey *k) {
+    unsigned long count = listLength(k->entries);
+
+    gc.invalidations += count;
+    while (count--)
+        geoCacheRemove(listNodeValue(listFirst(k->entries)));
+}
+
+/* Check the next few keys in gc.sweep, invalidating stale ones. */
+static void geoCacheSweep(void) {
+    for (int i = 0; i < GEO_CACHE_SWEEP_KEYS && listLength(gc.sweep); i++) {
+        struct geoCacheKey *k = listNodeValue(listLast(gc.sweep));
+        if (geoCacheKeyStale(k))
+            geoCacheKeyInvalidate(k);
+        else
+            listRotate(gc.sweep);
+    }
+}
+
+static void geoCacheEvictToLimit(void) {
+    while (gc.bytes > gc.max_bytes && listLength(gc.lru)) {
+        geoCacheRemove(listNodeValue(listLast(gc.lru)));
+        gc.evictions++;
+    }
+}
+
+void geoCacheFlush(void) {
+    while (listLength(gc.lru))
+        geoCacheRemove(listNodeValue(listFirst(gc.lru)));
+}
+
+/* ====================================================================
+ * Configuration and Stats
+ * ==================================================================== */
+bool geoCacheEnabled(void) {
+    return gc.max_bytes > 0;
+}
+
+/* Setting a limit of zero disables the cache and drops every entry. */
+void geoCacheSetMaxBytes(size_t max_bytes) {
+    gc.max_bytes = max_bytes;
+    geoCacheEvictToLimit();
+}
+
+void geoCacheResetStats(void) {
+    gc.hits = gc.misses = gc.evictions = gc.invalidations = 0;
+}
+
+void geoCacheReplyStats(redisClient *c) {
+    addReplyMultiBulkLen(c, 16);
+    addReplyBulkCString(c, "max-bytes");
+    addReplyLongLong(c, gc.max_bytes);
+    addReplyBulkCString(c, "bytes");
+    addReplyLongLong(c, gc.bytes);
+    addReplyBulkCString(c, "entries");
+    addReplyLongLong(c, dictSize(gc.entries));
+    addReplyBulkCString(c, "keys");
+    addReplyLongLong(c, dictSize(gc.keys));
+    addReplyBulkCString(c, "hits");
+    addReplyLongLong(c, gc.hits);
+    addReplyBulkCString(c, "misses");
+    addReplyLongLong(c, gc.misses);
+    addReplyBulkCString(c, "evictions");
+    addReplyLongLong(c, gc.evictions);
+    addReplyBulkCString(c, "invalidations");
+    addReplyLongLong(c, gc.invalidations);
+}
+
+/* ====================================================================
+ * Invalidation
+ * ==================================================================== */
+/* Geo writes drop their key's entries right away (the watcher would only
+ * catch them at the next lookup or sweep). */
+void geoCacheKeyModified(redisDb *db, robj *key) {
+    if (!dictSize(gc.keys))
+        return;
+
+    sds keyid = geoCacheKeyId(db, key);
+    dictEntry *ke = dictFind(gc.keys, keyid);
+    if (ke)
+        geoCacheKeyInvalidate(dictGetVal(ke));
+    sdsfree(keyid);
+}
+
+/* ====================================================================
+ * Lookup / Store
+ * ==================================================================== */
+/* Cache id layout: <db>:<key> NUL <latitude><longitude> {<len>:<arg>}...
+ * 'argv' is everything after the center (radius, units, options). */
+sds geoCacheId(redisDb *db, robj *key, double *latlong, robj **argv,
+               int argc) {
+    sds id = geoCacheKeyId(db, key);
+    id = sdscatlen(id, "\0", 1);
+    id = sdscatlen(id, latlong, sizeof(*latlong) * 2);
+
+    for (int i = 0; i < argc; i++) {
+        robj *arg = getDecodedObject(argv[i]);
+        id = sdscatprintf(id, "%zu:", sdslen(arg->ptr));
+        id = sdscatsds(id, arg->ptr);
+        decrRefCount(arg);
+    }
+
+    return id;
+}
+
+bool geoCacheReplyIfCached(redisClient *c, sds id, robj *zobj) {
+    geoCacheSweep();
+
+    dictEntry *de = dictFind(gc.entries, id);
+    if (!de) {
+        gc.misses++;
+        return false;
+    }
+
+    struct geoCacheEntry *e = dictGetVal(de);
+    if (geoCacheKeyStale(e->key) || e->key->zobj != zobj) {
+        /* The key changed since we cached this reply. */
+        geoCacheKeyInvalidate(e->key);
+        gc.misses++;
+        return false;
+    }
+
+    /* Move entry to the front of the LRU list */
+    sds entry_id = listNodeValue(e->lru);
+    listDelNode(gc.lru, e->lru);
+    listAddNodeHead(gc.lru, entry_id);
+    e->lru = listFirst(gc.lru);
+
+    gc.hits++;
+    addReplyString(c, e->reply, sdslen(e->reply));
+    return true;
+}
+
+/* Point the capture client at the caller's arguments and DB.  Anything
+ * replied to the capture client is collected by geoCacheStoreAndReply() */
+redisClient *geoCacheCaptureClient(redisClient *c) {
+    gc.capture->db = c->db;
+    gc.capture->argc = c->argc;
+    gc.capture->argv = c->argv;
+    return gc.capture;
+}
+
+/* result buffer aggregation is taken from scripting.c */
+static sds geoCacheCaptureBuffer(redisClient *c) {
+    sds reply = sdsnewlen(c->buf, c->bufpos);
+    c->bufpos = 0;
+    while (listLength(c->reply)) {
+        robj *o = listNodeValue(listFirst(c->reply));
+
+        reply = sdscatlen(reply, o->ptr, sdslen(o->ptr));
+        listDelNode(c->reply, listFirst(c->reply));
+    }
+
+    return reply;
+}
+
+/* Forward the captured reply to 'c' and cache it if it's cacheable.
+ * Takes ownership of 'id'. */
+void geoCacheStoreAndReply(redisClient *c, redisClient *capture, sds id,
+                           robj *zobj) {
+    sds reply = geoCacheCaptureBuffer(capture);
+
+    /* Don't leave pointers to the caller's argv hanging around */
+    capture->argc = 0;
+    capture->argv = NULL;
+
+    addReplyString(c, reply, sdslen(reply));
+
+    /* Never cache errors or anything bigger than the entire cache */
+    size_t bytes = sizeof(struct geoCacheEntry) + sdslen(reply) + sdslen(id);
+    if (reply[0] == '-' || bytes > gc.max_bytes) {
+        sdsfree(reply);
+        sdsfree(id);
+        return;
+    }
+
+    /* Replace any stale entry left behind under the same id */
+    geoCacheRemove(id);
+    geoCacheSweep();
+
+    /* Entries of a key must all be from the key's current zset */
+    sds keyid = geoCacheKeyId(c->db, c->argv[1]);
+    dictEntry *ke = dictFind(gc.keys, keyid);
+    struct geoCacheKey *k = ke ? dictGetVal(ke) : NULL;
+    if (k && (geoCacheKeyStale(k) || k->zobj != zobj)) {
+        geoCacheKeyInvalidate(k);
+        k = NULL;
+    }
+    if (!k)
+        k = geoCacheKeyCreate(keyid, c->db, c->argv[1], zobj);
+    sdsfree(keyid);
+
+    struct geoCacheEntry *e = zmalloc(sizeof(*e));
+    e->key = k;
+    listAddNodeTail(k->entries, id);
+    e->key_entry = listLast(k->entries);
+    e->reply = reply;
+    e->bytes = bytes;
+
+    dictAdd(gc.entries, id, e);
+    listAddNodeHead(gc.lru, id);
+    e->lru = listFirst(gc.lru);
+
+    gc.bytes += bytes;
+    geoCacheEvictToLimit();
+}
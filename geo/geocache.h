@@ -0,0 +1,31 @@
+#ifndef __GEOCACHE_H__
+#define __GEOCACHE_H__
+
+#include "redis.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Bring up / Teardown (called from module load/cleanup) */
+void geoCacheInit(void);
+void geoCacheFree(void);
+
+/* Configuration */
+bool geoCacheEnabled(void);
+void geoCacheSetMaxBytes(size_t max_bytes);
+void geoCacheFlush(void);
+void geoCacheResetStats(void);
+void geoCacheReplyStats(redisClient *c);
+
+/* Invalidation: geo writes call this to drop the entries of 'key' at once
+ * (other writes are caught at the next lookup or sweep) */
+void geoCacheKeyModified(redisDb *db, robj *key);
+
+/* Lookup / Store */
+sds geoCacheId(redisDb *db, robj *key, double *latlong, robj **argv,
+               int argc);
+bool geoCacheReplyIfCached(redisClient *c, sds id, robj *zobj);
+redisClient *geoCacheCaptureClient(redisClient *c);
+void geoCacheStoreAndReply(redisClient *c, redisClient *capture, sds id,
+                           robj *zobj);
+
+#endif
@@ -0,0 +1,148 @@
+#include "geofilter.h"
+#include "geoparse.h"
+
+/* ====================================================================
+ * Attribute Filters
+ * ====================================================================
+ * GEORADIUS ... FILTER prefix field op value keeps only members whose
+ * hash at key prefix+member has 'field' comparing 'op' to 'value'.
+ *
+ * = and != compare bytes.  <, <=, > and >= compare numbers; fields that
+ * aren't numbers never match.  Members without a hash, or whose hash
+ * lacks 'field', never match (not even !=).
+ *
+ * Hashes are read in place (ziplist or hash table) as results are
+ * accepted, so filtered out members never become replies. */
+
+/* prefix+member of the hash being looked at, reused across lookups */
+static sds filter_key = NULL;
+
+static struct {
+    char *name;
+    int op;
+} filter_ops[] = {{"=", GEO_FILTER_EQ},  {"==", GEO_FILTER_EQ},
+                  {"eq", GEO_FILTER_EQ}, {"!=", GEO_FILTER_NE},
+                  {"ne", GEO_FILTER_NE}, {"<", GEO_FILTER_LT},
+                  {"lt", GEO_FILTER_LT}, {"<=", GEO_FILTER_LE},
+                  {"le", GEO_FILTER_LE}, {">", GEO_FILTER_GT},
+                  {"gt", GEO_FILTER_GT}, {">=", GEO_FILTER_GE},
+                  {"ge", GEO_FILTER_GE}};
+
+void geoFilterFree(void) {
+    sdsfree(filter_key);
+    filter_key = NULL;
+}
+
+/* ====================================================================
+ * Parsing
+ * ==================================================================== */
+bool geoFilterParseOrReply(redisClient *c, robj **argv,
+                           struct geoFilter *filter) {
+    memset(filter, 0, sizeof(*filter));
+    for (int i = 0; i < sizeof(filter_ops) / sizeof(*filter_ops); i++) {
+        if (!strcasecmp(argv[2]->ptr, filter_ops[i].name)) {
+            filter->op = filter_ops[i].op;
+            break;
+        }
+    }
+
+    if (filter->op == GEO_FILTER_NONE) {
+        addReplyError(c, "filter operator must be one of = != < <= > >=");
+        return false;
+    }
+
+    filter->db = c->db;
+    filter->prefix = argv[0]->ptr;
+    filter->field = argv[1];
+    filter->value = argv[3]->ptr;
+
+    if (filter->op != GEO_FILTER_EQ && filter->op != GEO_FILTER_NE &&
+        !geoParseDouble(filter->value, sdslen(filter->value),
+                        &filter->number)) {
+        addReplyError(c, "filter value is not a valid float");
+        return false;
+    }
+
+    return true;
+}
+
+/* ====================================================================
+ * Matching
+ * ==================================================================== */
+/* Compare field value 'vstr' (or 'vll' when 'vstr' is NULL) */
+static bool compare(struct geoFilter *filter, unsigned char *vstr,
+                    unsigned int vlen, long long vll) {
+    char buf[32];
+    double d;
+
+    if (filter->op == GEO_FILTER_EQ || filter->op == GEO_FILTER_NE) {
+        if (!vstr) {
+            vlen = ll2string(buf, sizeof(buf), vll);
+            vstr = (unsigned char *)buf;
+        }
+
+        bool equal = vlen == sdslen(filter->value) &&
+                     !memcmp(vstr, filter->value, vlen);
+        return filter->op == GEO_FILTER_EQ ? equal : !equal;
+    }
+
+    if (!vstr)
+        d = vll;
+    else if (!geoParseDouble((char *)vstr, vlen, &d))
+        return false;
+
+    switch (filter->op) {
+    case GEO_FILTER_LT:
+        return d < filter->number;
+    case GEO_FILTER_LE:
+        return d <= filter->number;
+    case GEO_FILTER_GT:
+        return d > filter->number;
+    case GEO_FILTER_GE:
+        return d >= filter->number;
+    }
+
+    return false;
+}
+
+bool geoFilterMatch(struct geoFilter *filter, unsigned char *str,
+                    unsigned int len, long long vlong) {
+    char buf[32];
+
+    if (!str) {
+        len = ll2string(buf, sizeof(buf), vlong);
+        str = (unsigned char *)buf;
+    }
+
+    if (!filter_key)
+        filter_key = sdsempty();
+    filter_key =
+        sdscpylen(filter_key, filter->prefix, sdslen(filter->prefix));
+    filter_key = sdscatlen(filter_key, str, len);
+
+    robj key;
+    initStaticStringObject(key, filter_key);
+    robj *o = lookupKeyRead(filter->db, &key);
+    if (!o || o->type != REDIS_HASH)
+        return false;
+
+    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *vstr = NULL;
+        unsigned int vlen = 0;
+        long long vll = 0;
+
+        if (hashTypeGetFromZiplist(o, filter->field, &vstr, &vlen, &vll) < 0)
+            return false;
+
+        return compare(filter, vstr, vlen, vll);
+    }
+
+    robj *value;
+    if (hashTypeGetFromHashTable(o, filter->field, &value) < 0)
+        return false;
+
+    if (value->encoding == REDIS_ENCODING_INT)
+        return compare(filter, NULL, 0, (long)value->ptr);
+
+    return compare(filter, value->ptr, sdslen(value->ptr), 0);
+}
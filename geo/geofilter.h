@@ -0,0 +1,39 @@
+#ifndef __GEOFILTER_H__
+#define __GEOFILTER_H__
+
+#include "redis.h"
+#include <stdbool.h>
+
+/* Comparison operators (GEO_FILTER_NONE means no filter) */
+#define GEO_FILTER_NONE 0
+#define GEO_FILTER_EQ 1
+#define GEO_FILTER_NE 2
+#define GEO_FILTER_LT 3
+#define GEO_FILTER_LE 4
+#define GEO_FILTER_GT 5
+#define GEO_FILTER_GE 6
+
+/* FILTER prefix field op value: keep members whose hash at key
+ * prefix+member has 'field' comparing 'op' to 'value' */
+struct geoFilter {
+    int op;
+    redisDb *db;
+    sds prefix;
+    robj *field;
+    sds value;
+    double number; /* 'value' for <, <=, > and >= */
+};
+
+/* Teardown (called from module cleanup) */
+void geoFilterFree(void);
+
+/* Parse the four arguments after FILTER.  Filters point into 'argv' and
+ * live as long as it does. */
+bool geoFilterParseOrReply(redisClient *c, robj **argv,
+                           struct geoFilter *filter);
+
+/* Does member 'str' (or 'vlong' when 'str' is NULL) pass 'filter'? */
+bool geoFilterMatch(struct geoFilter *filter, unsigned char *str,
+                    unsigned int len, long long vlong);
+
+#endif
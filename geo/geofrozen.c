@@ -0,0 +1,454 @@
+#include "geofrozen.h"
+#include "geohash.h"
+#include "geoload.h"
+
+/* ====================================================================
+ * Frozen Geo Sets
+ * ====================================================================
+ * GEOFREEZE key [HASH] replaces a read-mostly geo zset with one compact
+ * string holding every point in zset order.  No dict, no skiplist nodes, no
+ * per-member robjs: a point costs its score delta, its member and (with
+ * HASH) one slot of a member hash.
+ *
+ * Layout (all integers little-endian):
+ *   header (GEO_FROZEN_HEADER bytes):
+ *     "GEOF", u8 version, u8 flags, u16 unused, u32 block size,
+ *     u32 point count, u32 block count, u32 members offset,
+ *     u32 hash offset (0 without HASH), u32 hash slots
+ *   index: per block of 'block size' points:
+ *     u64 first score, u32 delta offset, u32 member offset
+ *   deltas: per block, varint score deltas of every point after the first
+ *   members: per point, varint length + member bytes
+ *   hash: u32 slots of (point position + 1), 0 = empty, linear probing
+ *
+ * Offsets and counts are u32, so sets whose frozen copy would reach 4GB
+ * can't be frozen.
+ *
+ * Range scans binary search the index for their first block and decode
+ * forward from there.  Writes (GEOADD, GEOADDBIN, GEOLOAD) thaw the key back
+ * into a regular zset first.
+ *
+ * To the rest of Redis a frozen key is just a string: TYPE replies "string"
+ * and zset commands (ZSCORE, ZRANGE, ZREM, ...) reply WRONGTYPE until the
+ * key is thawed by GEOTHAW or a geo write. */
+
+#define GEO_FROZEN_MAGIC "GEOF"
+#define GEO_FROZEN_VERSION 1
+#define GEO_FROZEN_HASHED 1
+#define GEO_FROZEN_BLOCK 64
+#define GEO_FROZEN_HEADER 32
+#define GEO_FROZEN_INDEX_ENTRY 16
+
+/* Decoded header of a frozen set */
+struct geoFrozen {
+    uint32_t block_size;
+    uint32_t count;
+    uint32_t blocks;
+    const unsigned char *index;
+    const unsigned char *deltas;
+    const unsigned char *members;
+    const unsigned char *members_end;
+    const unsigned char *hash;
+    uint32_t hash_slots;
+};
+
+/* ====================================================================
+ * Encoding helpers
+ * ==================================================================== */
+static inline uint32_t get32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    memrev32ifbe(&v);
+    return v;
+}
+
+static inline uint64_t get64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    memrev64ifbe(&v);
+    return v;
+}
+
+static inline void set32(unsigned char *p, uint32_t v) {
+    memrev32ifbe(&v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static sds cat32(sds s, uint32_t v) {
+    memrev32ifbe(&v);
+    return sdscatlen(s, &v, sizeof(v));
+}
+
+static sds cat64(sds s, uint64_t v) {
+    memrev64ifbe(&v);
+    return sdscatlen(s, &v, sizeof(v));
+}
+
+static sds catVarint(sds s, uint64_t v) {
+    unsigned char buf[10];
+    int len = 0;
+
+    do {
+        buf[len] = v & 0x7f;
+        v >>= 7;
+        if (v)
+            buf[len] |= 0x80;
+        len++;
+    } while (v);
+
+    return sdscatlen(s, buf, len);
+}
+
+/* Returns the byte after the varint or NULL if it runs past 'end' */
+static const unsigned char *getVarint(const unsigned char *p,
+                                      const unsigned char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+
+    return NULL;
+}
+
+/* FNV-1a: the hash is stored, so it can't depend on the server's seed */
+static uint32_t geoFrozenHash(const unsigned char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* Validate the layout of 'o' and decode its header.  Anything could be
+ * stored in a string, so nothing past here trusts unchecked offsets. */
+static bool geoFrozenOpen(robj *o, struct geoFrozen *f) {
+    if (o->type != REDIS_STRING || o->encoding == REDIS_ENCODING_INT)
+        return false;
+
+    const unsigned char *buf = o->ptr;
+    size_t len = sdslen(o->ptr);
+    if (len < GEO_FROZEN_HEADER || memcmp(buf, GEO_FROZEN_MAGIC, 4) ||
+        buf[4] != GEO_FROZEN_VERSION)
+        return false;
+
+    bool hashed = buf[5] & GEO_FROZEN_HASHED;
+    f->block_size = get32(buf + 8);
+    f->count = get32(buf + 12);
+    f->blocks = get32(buf + 16);
+    uint32_t members = get32(buf + 20);
+    uint32_t hash = get32(buf + 24);
+    f->hash_slots = get32(buf + 28);
+
+    if (!f->block_size ||
+        f->blocks != (f->count + f->block_size - 1) / f->block_size)
+        return false;
+
+    size_t deltas = GEO_FROZEN_HEADER + (size_t)f->blocks *
+                                            GEO_FROZEN_INDEX_ENTRY;
+    size_t members_end = hashed ? hash : len;
+    if (deltas > members || members > members_end || members_end > len)
+        return false;
+
+    if (hashed && (f->hash_slots < f->count ||
+                   (f->hash_slots & (f->hash_slots - 1)) ||
+                   members_end + (size_t)f->hash_slots * 4 != len))
+        return false;
+
+    f->index = buf + GEO_FROZEN_HEADER;
+    f->deltas = buf + deltas;
+    f->members = buf + members;
+    f->members_end = buf + members_end;
+    f->hash = hashed ? buf + hash : NULL;
+    return true;
+}
+
+bool geoFrozenIs(robj *o) {
+    struct geoFrozen f;
+    return geoFrozenOpen(o, &f);
+}
+
+unsigned long geoFrozenLength(robj *o) {
+    struct geoFrozen f;
+    return geoFrozenOpen(o, &f) ? f.count : 0;
+}
+
+/* ====================================================================
+ * Reading
+ * ==================================================================== */
+#define GEO_FROZEN_MORE 0    /* keep going with the next block */
+#define GEO_FROZEN_END 1     /* passed 'max' (or found corrupt data) */
+#define GEO_FROZEN_STOPPED 2 /* 'visit' stopped us */
+
+/* Decode points [from, to) of block 'b', visiting the ones in [min, max) */
+static int geoFrozenVisitBlock(struct geoFrozen *f, uint32_t b, uint32_t from,
+                               uint32_t to, double min, double max,
+                               zsetRangeVisitor *visit, void *privdata) {
+    const unsigned char *entry = f->index + b * GEO_FROZEN_INDEX_ENTRY;
+    uint64_t score = get64(entry);
+    const unsigned char *dp = f->deltas + get32(entry + 8);
+    const unsigned char *mp = f->members + get32(entry + 12);
+    uint32_t points = b + 1 < f->blocks ? f->block_size
+                                        : f->count - b * f->block_size;
+
+    if (dp > f->members || mp > f->members_end)
+        return GEO_FROZEN_END;
+
+    if (to > points)
+        to = points;
+
+    for (uint32_t i = 0; i < to; i++) {
+        uint64_t delta, len;
+        if (i) {
+            if (!(dp = getVarint(dp, f->members, &delta)))
+                return GEO_FROZEN_END;
+            score += delta;
+        }
+
+        if (!(mp = getVarint(mp, f->members_end, &len)) ||
+            len > (uint64_t)(f->members_end - mp))
+            return GEO_FROZEN_END;
+
+        const unsigned char *member = mp;
+        mp += len;
+
+        if (i < from || score < min)
+            continue;
+
+        if (score >= max)
+            return GEO_FROZEN_END;
+
+        if (!visit(privdata, score, (unsigned char *)member, len, 0))
+            return GEO_FROZEN_STOPPED;
+    }
+
+    return GEO_FROZEN_MORE;
+}
+
+bool geoFrozenVisit(robj *o, double min, double max, zsetRangeVisitor *visit,
+                    void *privdata) {
+    struct geoFrozen f;
+    if (!geoFrozenOpen(o, &f) || !f.count)
+        return true;
+
+    /* The block before the first block starting at or after 'min' may
+     * still hold scores >= min. */
+    uint32_t lo = 0, hi = f.blocks;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (get64(f.index + mid * GEO_FROZEN_INDEX_ENTRY) < min)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    int state = GEO_FROZEN_MORE;
+    for (uint32_t b = lo ? lo - 1 : 0;
+         b < f.blocks && state == GEO_FROZEN_MORE; b++)
+        state = geoFrozenVisitBlock(&f, b, 0, f.block_size, min, max, visit,
+                                    privdata);
+
+    return state != GEO_FROZEN_STOPPED;
+}
+
+struct geoFrozenFind {
+    const unsigned char *member;
+    size_t len;
+    bool found;
+    double score;
+};
+
+static bool geoFrozenFindVisit(void *privdata, double score,
+                               unsigned char *str, unsigned int len,
+                               long long vlong) {
+    struct geoFrozenFind *find = privdata;
+    if (len != find->len || memcmp(str, find->member, len))
+        return true;
+
+    find->found = true;
+    find->score = score;
+    return false;
+}
+
+bool geoFrozenScore(robj *o, robj *member, double *score) {
+    struct geoFrozen f;
+    if (!geoFrozenOpen(o, &f))
+        return false;
+
+    robj *decoded = getDecodedObject(member);
+    struct geoFrozenFind find = {.member = decoded->ptr,
+                                 .len = sdslen(decoded->ptr)};
+
+    if (f.hash) {
+        uint32_t mask = f.hash_slots - 1;
+        uint32_t slot = geoFrozenHash(find.member, find.len) & mask;
+        for (uint32_t probes = 0; probes < f.hash_slots && !find.found;
+             probes++, slot = (slot + 1) & mask) {
+            uint32_t position = get32(f.hash + slot * 4);
+            if (!position--)
+                break;
+
+            if (position >= f.count)
+                continue;
+
+            uint32_t from = position % f.block_size;
+            geoFrozenVisitBlock(&f, position / f.block_size, from, from + 1,
+                                0, INFINITY, geoFrozenFindVisit, &find);
+        }
+    } else {
+        geoFrozenVisit(o, 0, INFINITY, geoFrozenFindVisit, &find);
+    }
+
+    decrRefCount(decoded);
+    if (find.found)
+        *score = find.score;
+    return find.found;
+}
+
+/* ====================================================================
+ * Freezing / Thawing
+ * ==================================================================== */
+struct geoFrozenBuild {
+    uint64_t *scores;
+    size_t *offsets; /* of each member's length varint in 'members' */
+    size_t count;
+    size_t alloc;
+    sds members;
+};
+
+static bool geoFrozenBuildVisit(void *privdata, double score,
+                                unsigned char *str, unsigned int len,
+                                long long vlong) {
+    struct geoFrozenBuild *b = privdata;
+    char buf[32];
+
+    if (!str) {
+        len = ll2string(buf, sizeof(buf), vlong);
+        str = (unsigned char *)buf;
+    }
+
+    if (b->count == b->alloc) {
+        b->alloc = b->alloc ? b->alloc * 2 : 1024;
+        b->scores = zrealloc(b->scores, sizeof(*b->scores) * b->alloc);
+        b->offsets = zrealloc(b->offsets, sizeof(*b->offsets) * b->alloc);
+    }
+
+    b->scores[b->count] = score;
+    b->offsets[b->count] = sdslen(b->members);
+    b->members = catVarint(b->members, len);
+    b->members = sdscatlen(b->members, str, len);
+    b->count++;
+    return true;
+}
+
+robj *geoFrozenCreate(robj *zobj, bool hash) {
+    struct geoFrozenBuild b = {.members = sdsempty()};
+    geozrangeVisit(zobj, 0, 1ULL << (GEO_STEP_MAX * 2), geoFrozenBuildVisit,
+                   &b);
+
+    uint32_t blocks = (b.count + GEO_FROZEN_BLOCK - 1) / GEO_FROZEN_BLOCK;
+    sds index = sdsempty();
+    sds deltas = sdsempty();
+    for (size_t i = 0; i < b.count; i++) {
+        if (i % GEO_FROZEN_BLOCK == 0) {
+            index = cat64(index, b.scores[i]);
+            index = cat32(index, sdslen(deltas));
+            index = cat32(index, b.offsets[i]);
+        } else {
+            deltas = catVarint(deltas, b.scores[i] - b.scores[i - 1]);
+        }
+    }
+
+    uint64_t slots = 0;
+    if (hash) {
+        for (slots = 2; slots < b.count * 2; slots *= 2)
+            ;
+    }
+
+    /* Every offset (and the blob's length) must fit in a u32 */
+    uint64_t size = GEO_FROZEN_HEADER + sdslen(index) + sdslen(deltas) +
+                    sdslen(b.members) + slots * 4;
+    if (size > UINT32_MAX) {
+        sdsfree(index);
+        sdsfree(deltas);
+        sdsfree(b.members);
+        zfree(b.scores);
+        zfree(b.offsets);
+        return NULL;
+    }
+
+    sds blob = sdsnewlen(NULL, GEO_FROZEN_HEADER);
+    unsigned char *header = (unsigned char *)blob;
+    memcpy(header, GEO_FROZEN_MAGIC, 4);
+    header[4] = GEO_FROZEN_VERSION;
+    header[5] = hash ? GEO_FROZEN_HASHED : 0;
+    set32(header + 8, GEO_FROZEN_BLOCK);
+    set32(header + 12, b.count);
+    set32(header + 16, blocks);
+    uint32_t members = GEO_FROZEN_HEADER + sdslen(index) + sdslen(deltas);
+    set32(header + 20, members);
+    set32(header + 24, hash ? members + sdslen(b.members) : 0);
+    set32(header + 28, slots);
+
+    blob = sdscatsds(blob, index);
+    blob = sdscatsds(blob, deltas);
+    blob = sdscatsds(blob, b.members);
+
+    if (hash) {
+        uint32_t *table = zcalloc(sizeof(*table) * slots);
+        for (size_t i = 0; i < b.count; i++) {
+            uint64_t len;
+            const unsigned char *member = getVarint(
+                (unsigned char *)b.members + b.offsets[i],
+                (unsigned char *)b.members + sdslen(b.members), &len);
+            uint32_t slot = geoFrozenHash(member, len) & (slots - 1);
+            while (table[slot])
+                slot = (slot + 1) & (slots - 1);
+            table[slot] = i + 1;
+        }
+
+        for (uint64_t i = 0; i < slots; i++)
+            blob = cat32(blob, table[i]);
+        zfree(table);
+    }
+
+    sdsfree(index);
+    sdsfree(deltas);
+    sdsfree(b.members);
+    zfree(b.scores);
+    zfree(b.offsets);
+    return createObject(REDIS_STRING, blob);
+}
+
+struct geoFrozenThawing {
+    struct geoLoadPoint *points;
+    size_t count;
+};
+
+static bool geoFrozenThawVisit(void *privdata, double score,
+                               unsigned char *str, unsigned int len,
+                               long long vlong) {
+    struct geoFrozenThawing *t = privdata;
+    struct geoLoadPoint *p = t->points + t->count;
+
+    p->score = score;
+    p->member = (const char *)str;
+    p->len = len;
+    p->index = t->count++;
+    return true;
+}
+
+robj *geoFrozenThaw(robj *o) {
+    /* Points are stored in zset order, so we can use the presorted build.
+     * Members point into 'o', which outlives the build. */
+    struct geoFrozenThawing t = {
+        .points = zmalloc(sizeof(*t.points) * (geoFrozenLength(o) + 1))};
+    geoFrozenVisit(o, 0, INFINITY, geoFrozenThawVisit, &t);
+
+    robj *zobj = geoLoadCreateZset(t.points, t.count);
+    zfree(t.points);
+    return zobj;
+}
@@ -0,0 +1,29 @@
+#ifndef __GEOFROZEN_H__
+#define __GEOFROZEN_H__
+
+#include "redis.h"
+#include "zset.h"
+#include <stdbool.h>
+
+/* Is 'o' a frozen geo set? */
+bool geoFrozenIs(robj *o);
+
+/* Frozen (string) copy of geo zset 'zobj'.  With 'hash', member lookups
+ * use a member -> position hash instead of a linear scan.  Returns NULL if
+ * the copy would be too large for its 32 bit offsets. */
+robj *geoFrozenCreate(robj *zobj, bool hash);
+
+/* Zset copy of frozen 'o' */
+robj *geoFrozenThaw(robj *o);
+
+unsigned long geoFrozenLength(robj *o);
+
+/* Score of 'member' of frozen 'o' */
+bool geoFrozenScore(robj *o, robj *member, double *score);
+
+/* Visit members scored in [min, max) in score order.  Members are always
+ * passed as strings.  Returns false if 'visit' stopped us early. */
+bool geoFrozenVisit(robj *o, double min, double max, zsetRangeVisitor *visit,
+                    void *privdata);
+
+#endif
@@ -45,6 +45,11 @@ extern "C" {
 #define GEO_WGS84_TYPE 1
 #define GEO_MERCATOR_TYPE 2
 
+/* Or'd into a coord type: scores follow the Hilbert curve instead of
+ * Z-order.  GEO_COORD_BASE() strips it back to the coordinate system. */
+#define GEO_HILBERT 0x80
+#define GEO_COORD_BASE(coord_type) ((coord_type) & ~GEO_HILBERT)
+
 #define GEO_STEP_MAX 26
 
 typedef enum {
@@ -112,6 +117,10 @@ bool geohashDecodeToLatLongType(uint8_t coord_type, const GeoHashBits hash,
 bool geohashDecodeToLatLongWGS84(const GeoHashBits hash, double *latlong);
 bool geohashDecodeToLatLongMercator(const GeoHashBits hash, double *latlong);
 void geohashNeighbors(const GeoHashBits *hash, GeoHashNeighbors *neighbors);
+void geohashNeighborsType(uint8_t coord_type, const GeoHashBits *hash,
+                          GeoHashNeighbors *neighbors);
+uint64_t geohashHilbertFromZ(uint64_t bits, uint8_t step);
+uint64_t geohashHilbertToZ(uint64_t bits, uint8_t step);
 
 #if defined(__cplusplus)
 }
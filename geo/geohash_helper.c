@@ -34,6 +34,7 @@
  */
 
 #include "geohash_helper.h"
+#include <stdlib.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
@@ -173,7 +174,7 @@ GeoHashRadius geohashGetAreasByRadius(uint8_t coord_type, double latitude,
     double min_lat, max_lat, min_lon, max_lon;
     int steps;
 
-    if (coord_type == GEO_WGS84_TYPE) {
+    if (GEO_COORD_BASE(coord_type) == GEO_WGS84_TYPE) {
         double bounds[4];
         geohashBoundingBox(latitude, longitude, radius_meters, bounds);
         min_lat = bounds[0];
@@ -215,6 +216,19 @@ GeoHashRadius geohashGetAreasByRadius(uint8_t coord_type, double latitude,
         GZERO(neighbors.south_east);
         GZERO(neighbors.north_east);
     }
+
+    /* Cells were found in Z-order; Hilbert keys need their own numbering */
+    if (coord_type & GEO_HILBERT) {
+        GeoHashBits *cells[9] = {
+            &hash,                 &neighbors.north,      &neighbors.east,
+            &neighbors.west,       &neighbors.south,      &neighbors.north_east,
+            &neighbors.south_east, &neighbors.north_west, &neighbors.south_west};
+        for (int i = 0; i < 9; i++)
+            if (GISNOTZERO((*cells[i])))
+                cells[i]->bits = geohashHilbertFromZ(cells[i]->bits, steps);
+        area.hash = hash;
+    }
+
     radius.hash = hash;
     radius.neighbors = neighbors;
     radius.area = area;
@@ -252,10 +266,91 @@ double distanceEarth(double lat1d, double lon1d, double lat2d, double lon2d) {
            asin(sqrt(u * u + cos(lat1r) * cos(lat2r) * v * v));
 }
 
+/* Haversine terms of a set of points, stored as structure-of-arrays so the
+ * distance loop below runs over contiguous doubles. */
+struct haversineTerms {
+    double *sin_lat; /* sin(lat / 2) */
+    double *cos_lat; /* cos(lat / 2) */
+    double *sin_lon; /* sin(lon / 2) */
+    double *cos_lon; /* cos(lon / 2) */
+    double *cos_full; /* cos(lat) */
+};
+
+/* 'terms' has room for count * 5 doubles */
+static void haversineTermsInit(struct haversineTerms *t, double *terms,
+                               const double *latlong, int count) {
+    t->sin_lat = terms;
+    t->cos_lat = terms + count;
+    t->sin_lon = terms + count * 2;
+    t->cos_lon = terms + count * 3;
+    t->cos_full = terms + count * 4;
+
+    for (int i = 0; i < count; i++) {
+        double latr = deg_rad(latlong[i * 2]);
+        double lonr = deg_rad(latlong[i * 2 + 1]);
+        t->sin_lat[i] = sin(latr / 2);
+        t->cos_lat[i] = cos(latr / 2);
+        t->sin_lon[i] = sin(lonr / 2);
+        t->cos_lon[i] = cos(lonr / 2);
+        t->cos_full[i] = cos(latr);
+    }
+}
+
+/* Fill 'matrix' (origins rows x destinations columns) with haversine
+ * distances multiplied by 'scale'.  All trig happens once per point up
+ * front; per pair we only need the angle difference identity
+ *   sin((a - b) / 2) = sin(a/2)cos(b/2) - cos(a/2)sin(b/2)
+ * plus one sqrt and asin.  Points with NaN coordinates produce NaN. */
+void geohashGetDistanceMatrixWGS84(const double *origins, int origin_count,
+                                   const double *destinations,
+                                   int destination_count, double scale,
+                                   float *matrix, double *scratch) {
+    struct haversineTerms o, d;
+    haversineTermsInit(&o, scratch, origins, origin_count);
+    scratch += origin_count * 5;
+    haversineTermsInit(&d, scratch, destinations, destination_count);
+    double *row = scratch + destination_count * 5;
+    double diameter = 2.0 * EARTH_RADIUS_IN_METERS * scale;
+
+    for (int i = 0; i < origin_count; i++) {
+        const double sin_lat = o.sin_lat[i], cos_lat = o.cos_lat[i];
+        const double sin_lon = o.sin_lon[i], cos_lon = o.cos_lon[i];
+        const double cos_full = o.cos_full[i];
+
+        /* Branch-free over contiguous arrays so the compiler can vectorize */
+        for (int j = 0; j < destination_count; j++) {
+            double u = sin_lat * d.cos_lat[j] - cos_lat * d.sin_lat[j];
+            double v = sin_lon * d.cos_lon[j] - cos_lon * d.sin_lon[j];
+            row[j] = u * u + cos_full * d.cos_full[j] * v * v;
+        }
+
+        float *out = matrix + (size_t)i * destination_count;
+        for (int j = 0; j < destination_count; j++)
+            out[j] = diameter * asin(sqrt(row[j] > 1 ? 1 : row[j]));
+    }
+}
+
+/* Planar version of the above: euclidean distances between y/x points in
+ * meters, multiplied by 'scale'. */
+void geohashGetDistanceMatrixMercator(const double *origins, int origin_count,
+                                      const double *destinations,
+                                      int destination_count, double scale,
+                                      float *matrix) {
+    for (int i = 0; i < origin_count; i++) {
+        const double y = origins[i * 2], x = origins[i * 2 + 1];
+        float *out = matrix + (size_t)i * destination_count;
+        for (int j = 0; j < destination_count; j++) {
+            double dy = y - destinations[j * 2];
+            double dx = x - destinations[j * 2 + 1];
+            out[j] = sqrt(dx * dx + dy * dy) * scale;
+        }
+    }
+}
+
 bool geohashGetDistanceIfInRadius(uint8_t coord_type, double x1, double y1,
                                   double x2, double y2, double radius,
                                   double *distance) {
-    if (coord_type == GEO_WGS84_TYPE) {
+    if (GEO_COORD_BASE(coord_type) == GEO_WGS84_TYPE) {
         *distance = distanceEarth(y1, x1, y2, x2);
         if (*distance > radius) {
             return false;
@@ -272,6 +367,34 @@ bool geohashGetDistanceIfInRadius(uint8_t coord_type, double x1, double y1,
     return true;
 }
 
+/* Distance from point (x, y) to the segment (x1, y1) - (x2, y2).  The
+ * closest point on the segment is found on a local equirectangular
+ * projection (fine at corridor scale), then measured with haversine. */
+bool geohashGetDistanceToSegmentIfInRadiusWGS84(double x, double y, double x1,
+                                                double y1, double x2,
+                                                double y2, double radius,
+                                                double *distance) {
+    double scale = cos(deg_rad(y));
+    double dx = (x2 - x1) * scale;
+    double dy = y2 - y1;
+    double px = (x - x1) * scale;
+    double py = y - y1;
+
+    double t = 0;
+    double length_squared = dx * dx + dy * dy;
+    if (length_squared > 0) {
+        t = (px * dx + py * dy) / length_squared;
+        if (t < 0)
+            t = 0;
+        else if (t > 1)
+            t = 1;
+    }
+
+    return geohashGetDistanceIfInRadiusWGS84(x, y, x1 + t * (x2 - x1),
+                                             y1 + t * (y2 - y1), radius,
+                                             distance);
+}
+
 bool geohashGetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                        double y2, double radius,
                                        double *distance) {
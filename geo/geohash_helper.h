@@ -70,6 +70,21 @@ bool geohashGetDistanceIfInRadius(uint8_t coord_type, double x1, double y1,
 bool geohashGetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                        double y2, double radius,
                                        double *distance);
+bool geohashGetDistanceToSegmentIfInRadiusWGS84(double x, double y, double x1,
+                                                double y1, double x2,
+                                                double y2, double radius,
+                                                double *distance);
+/* Callers provide 'scratch' (this file doesn't allocate) with room for
+ * GEO_DISTANCE_MATRIX_SCRATCH(origin_count, destination_count) doubles */
+#define GEO_DISTANCE_MATRIX_SCRATCH(o, d) (((size_t)(o) + (d)) * 5 + (d))
+void geohashGetDistanceMatrixWGS84(const double *origins, int origin_count,
+                                   const double *destinations,
+                                   int destination_count, double scale,
+                                   float *matrix, double *scratch);
+void geohashGetDistanceMatrixMercator(const double *origins, int origin_count,
+                                      const double *destinations,
+                                      int destination_count, double scale,
+                                      float *matrix);
 bool geohashGetDistanceSquaredIfInRadiusMercator(double x1, double y1,
                                                  double x2, double y2,
                                                  double radius,
@@ -0,0 +1,288 @@
+#include "geoload.h"
+#include "geohash_helper.h"
+#include "geoparse.h"
+#include <ctype.h>
+
+/* ====================================================================
+ * Bulk Loading
+ * ====================================================================
+ * Parse whole files (or blobs) of points up front, validate everything
+ * before the caller touches the keyspace, sort once, then build the zset
+ * by appending to it in order instead of inserting points one at a time.
+ *
+ * CSV input is one "latitude,longitude,member" per line.  The member is
+ * everything after the second comma.  Empty lines and lines starting with
+ * '#' are skipped.
+ *
+ * Binary input is a sequence of records:
+ *   float64 latitude, float64 longitude, uint32 member length, member bytes
+ * with all numbers little-endian. */
+
+#define GEO_LOAD_BINARY_HEADER (sizeof(double) * 2 + sizeof(uint32_t))
+
+/* ====================================================================
+ * Parsing
+ * ==================================================================== */
+/* Encode and append one point, growing 'points' as needed. */
+static bool appendPoint(struct geoLoadPoint **points, size_t *count,
+                        size_t *alloc, uint8_t coord_type, double latitude,
+                        double longitude, const char *member, uint32_t len) {
+    /* x = longitude, y = latitude */
+    if (!geohashVerifyCoordinates(coord_type, longitude, latitude))
+        return false;
+
+    GeoHashBits hash;
+    if (!geohashEncodeType(coord_type, latitude, longitude, GEO_STEP_MAX,
+                           &hash))
+        return false;
+
+    if (*count == *alloc) {
+        *alloc = *alloc ? *alloc * 2 : 1024;
+        *points = zrealloc(*points, sizeof(**points) * *alloc);
+    }
+
+    struct geoLoadPoint *p = *points + (*count);
+    p->score = geohashAlign52Bits(hash);
+    p->member = member;
+    p->len = len;
+    p->index = (*count)++;
+    return true;
+}
+
+/* Like strtod(), fields may start with spaces ("40.7, -73.9, member") */
+static bool parseDouble(const char *start, const char *end, double *value) {
+    while (start < end && isspace((unsigned char)*start))
+        start++;
+
+    size_t len = end - start;
+    if (len == 0 || len >= 64)
+        return false;
+
+    return geoParseDouble(start, len, value);
+}
+
+struct geoLoadPoint *geoLoadParseCSV(const char *buf, size_t len,
+                                     uint8_t coord_type, size_t *count,
+                                     sds *err) {
+    struct geoLoadPoint *points = NULL;
+    size_t alloc = 0;
+    size_t line = 0;
+    const char *p = buf, *end = buf + len;
+
+    *count = 0;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+
+        const char *next = eol < end ? eol + 1 : end;
+        if (eol > p && eol[-1] == '\r')
+            eol--;
+
+        line++;
+        if (eol == p || *p == '#') {
+            p = next;
+            continue;
+        }
+
+        const char *comma1 = memchr(p, ',', eol - p);
+        const char *comma2 =
+            comma1 ? memchr(comma1 + 1, ',', eol - comma1 - 1) : NULL;
+        double latitude, longitude;
+        if (!comma2 || !parseDouble(p, comma1, &latitude) ||
+            !parseDouble(comma1 + 1, comma2, &longitude) ||
+            !appendPoint(&points, count, &alloc, coord_type, latitude,
+                         longitude, comma2 + 1, eol - comma2 - 1)) {
+            *err = sdscatprintf(sdsempty(),
+                                "line %zu: expected valid latitude,longitude,"
+                                "member",
+                                line);
+            zfree(points);
+            return NULL;
+        }
+
+        p = next;
+    }
+
+    return points;
+}
+
+struct geoLoadPoint *geoLoadParseBinary(const char *buf, size_t len,
+                                        uint8_t coord_type, size_t *count,
+                                        sds *err) {
+    struct geoLoadPoint *points = NULL;
+    size_t alloc = 0;
+    size_t offset = 0;
+
+    *count = 0;
+    while (offset < len) {
+        double latitude, longitude;
+        uint32_t member_len;
+
+        if (len - offset < GEO_LOAD_BINARY_HEADER) {
+            *err = sdscatprintf(sdsempty(), "truncated record at byte %zu",
+                                offset);
+            zfree(points);
+            return NULL;
+        }
+
+        memcpy(&latitude, buf + offset, sizeof(double));
+        memcpy(&longitude, buf + offset + sizeof(double), sizeof(double));
+        memcpy(&member_len, buf + offset + sizeof(double) * 2,
+               sizeof(uint32_t));
+        memrev64ifbe(&latitude);
+        memrev64ifbe(&longitude);
+        memrev32ifbe(&member_len);
+
+        const char *member = buf + offset + GEO_LOAD_BINARY_HEADER;
+        if (member_len > len - offset - GEO_LOAD_BINARY_HEADER) {
+            *err = sdscatprintf(sdsempty(), "truncated member at byte %zu",
+                                offset);
+            zfree(points);
+            return NULL;
+        }
+
+        if (!appendPoint(&points, count, &alloc, coord_type, latitude,
+                         longitude, member, member_len)) {
+            *err = sdscatprintf(sdsempty(),
+                                "invalid coordinates in record at byte %zu",
+                                offset);
+            zfree(points);
+            return NULL;
+        }
+
+        offset += GEO_LOAD_BINARY_HEADER + member_len;
+    }
+
+    return points;
+}
+
+/* ====================================================================
+ * Sorting
+ * ==================================================================== */
+/* Same ordering as binary compareStringObjects() */
+static int compareMembers(const struct geoLoadPoint *a,
+                          const struct geoLoadPoint *b) {
+    uint32_t minlen = a->len < b->len ? a->len : b->len;
+    int cmp = memcmp(a->member, b->member, minlen);
+    if (cmp)
+        return cmp;
+
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+static int sort_member_index(const void *a, const void *b) {
+    const struct geoLoadPoint *pa = a, *pb = b;
+    int cmp = compareMembers(pa, pb);
+    if (cmp)
+        return cmp;
+
+    return pa->index < pb->index ? -1 : pa->index > pb->index;
+}
+
+/* zset order: score, then member */
+static int sort_score_member(const void *a, const void *b) {
+    const struct geoLoadPoint *pa = a, *pb = b;
+    if (pa->score != pb->score)
+        return pa->score < pb->score ? -1 : 1;
+
+    return compareMembers(pa, pb);
+}
+
+size_t geoLoadSortUnique(struct geoLoadPoint *points, size_t count) {
+    if (count < 2)
+        return count;
+
+    /* Group duplicates together (in input order), keep the last of each. */
+    qsort(points, count, sizeof(*points), sort_member_index);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && !compareMembers(points + i, points + i + 1))
+            continue;
+
+        points[unique++] = points[i];
+    }
+
+    qsort(points, unique, sizeof(*points), sort_score_member);
+    return unique;
+}
+
+/* ====================================================================
+ * Building
+ * ==================================================================== */
+/* Points are already in order, so every insert is an append at the tail:
+ * we keep the last node of every level (and its rank) instead of
+ * searching from the header for each point like zslInsert() does. */
+static void buildSkiplist(zset *zs, struct geoLoadPoint *points,
+                          size_t count) {
+    zskiplist *zsl = zs->zsl;
+    zskiplistNode *last[ZSKIPLIST_MAXLEVEL];
+    unsigned long rank[ZSKIPLIST_MAXLEVEL];
+
+    for (int i = 0; i < ZSKIPLIST_MAXLEVEL; i++) {
+        last[i] = zsl->header;
+        rank[i] = 0;
+    }
+
+    dictExpand(zs->dict, count);
+
+    zskiplistNode *tail = NULL;
+    for (size_t k = 1; k <= count; k++) {
+        struct geoLoadPoint *p = points + k - 1;
+        robj *member = createStringObject((char *)p->member, p->len);
+        int level = zslRandomLevel();
+
+        if (level > zsl->level)
+            zsl->level = level;
+
+        zskiplistNode *x = zslCreateNode(level, p->score, member);
+        for (int i = 0; i < level; i++) {
+            last[i]->level[i].forward = x;
+            last[i]->level[i].span = k - rank[i];
+            last[i] = x;
+            rank[i] = k;
+        }
+
+        x->backward = tail;
+        tail = x;
+
+        /* The skiplist and the dict each hold a reference */
+        incrRefCount(member);
+        dictAdd(zs->dict, member, &x->score);
+    }
+
+    /* Spans of the last node of each level reach past the tail */
+    for (int i = 0; i < zsl->level; i++)
+        last[i]->level[i].span = count - rank[i];
+
+    zsl->tail = tail;
+    zsl->length = count;
+}
+
+robj *geoLoadCreateZset(struct geoLoadPoint *points, size_t count) {
+    bool ziplist = count <= server.zset_max_ziplist_entries;
+    for (size_t i = 0; ziplist && i < count; i++)
+        if (points[i].len > server.zset_max_ziplist_value)
+            ziplist = false;
+
+    if (!ziplist) {
+        robj *zobj = createZsetObject();
+        buildSkiplist(zobj->ptr, points, count);
+        return zobj;
+    }
+
+    robj *zobj = createZsetZiplistObject();
+    unsigned char *zl = zobj->ptr;
+    for (size_t i = 0; i < count; i++) {
+        char score[128];
+        int scorelen = d2string(score, sizeof(score), points[i].score);
+
+        zl = ziplistPush(zl, (unsigned char *)points[i].member, points[i].len,
+                         ZIPLIST_TAIL);
+        zl = ziplistPush(zl, (unsigned char *)score, scorelen, ZIPLIST_TAIL);
+    }
+    zobj->ptr = zl;
+
+    return zobj;
+}
@@ -0,0 +1,34 @@
+#ifndef __GEOLOAD_H__
+#define __GEOLOAD_H__
+
+#include "redis.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* One parsed point.  'member' points into the caller's input buffer.
+ * Scores are 52-bit geohashes (exact as doubles) or, for GEORADIUS
+ * STOREDIST, distances. */
+struct geoLoadPoint {
+    double score;
+    const char *member;
+    uint32_t len;
+    size_t index; /* position in the input; later duplicates win */
+};
+
+/* Parsing: returns an array of points (zfree() it) or NULL and an error
+ * in *err (sdsfree() it). */
+struct geoLoadPoint *geoLoadParseCSV(const char *buf, size_t len,
+                                     uint8_t coord_type, size_t *count,
+                                     sds *err);
+struct geoLoadPoint *geoLoadParseBinary(const char *buf, size_t len,
+                                        uint8_t coord_type, size_t *count,
+                                        sds *err);
+
+/* Sort points into zset order and drop duplicate members.
+ * Returns the new count. */
+size_t geoLoadSortUnique(struct geoLoadPoint *points, size_t count);
+
+/* Build a zset from points already in zset order */
+robj *geoLoadCreateZset(struct geoLoadPoint *points, size_t count);
+
+#endif
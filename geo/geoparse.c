@@ -0,0 +1,136 @@
+#include "geoparse.h"
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ====================================================================
+ * Coordinate Parsing
+ * ====================================================================
+ * Coordinates arrive as short decimals like "-73.9858072".  Those have at
+ * most 19 significant digits and a small power of ten, so instead of
+ * strtod() (locale lookups, arbitrary precision hard cases) we collect the
+ * digits into an integer mantissa 'm' and a decimal exponent 'e'.
+ *
+ * If m <= 2^53 and |e| <= 22, both m and 10^|e| are exact doubles, so one
+ * IEEE multiply or divide gives the correctly rounded result (Clinger's
+ * fast path).  That covers every coordinate with up to 15 digits.  Anything
+ * else (more digits, big exponents, hex, inf, whitespace, junk) goes
+ * through strtod() with the server's own validation, so results and
+ * errors match getDoubleFromObject() exactly. */
+
+#define GEO_PARSE_MAX_DIGITS 19
+#define GEO_PARSE_MAX_MANTISSA (1ULL << 53)
+#define GEO_PARSE_MAX_EXP10 22
+
+static const double pow10_exact[GEO_PARSE_MAX_EXP10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/* Returns false if 's' isn't a plain decimal we can parse exactly */
+static bool parseFast(const char *s, const char *end, double *value) {
+    const char *p = s;
+    bool negative = false;
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+
+    /* Integer digits; leading zeros aren't significant */
+    const char *start = p;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+        if (mantissa || *p != '0') {
+            if (++digits > GEO_PARSE_MAX_DIGITS)
+                return false;
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    bool seen = p > start;
+
+    /* Fraction digits */
+    if (p < end && *p == '.') {
+        start = ++p;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (mantissa || *p != '0') {
+                if (++digits > GEO_PARSE_MAX_DIGITS)
+                    return false;
+                mantissa = mantissa * 10 + (*p - '0');
+            }
+            exp10--;
+        }
+        seen = seen || p > start;
+    }
+
+    if (!seen)
+        return false;
+
+    /* Exponent */
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        bool exp_negative = false;
+        int exp = 0;
+
+        p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            exp_negative = *p++ == '-';
+        start = p;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (exp > 1000)
+                return false;
+            exp = exp * 10 + (*p - '0');
+        }
+        if (p == start)
+            return false;
+        exp10 += exp_negative ? -exp : exp;
+    }
+
+    if (p != end)
+        return false;
+
+    if (!mantissa) {
+        *value = negative ? -0.0 : 0.0;
+        return true;
+    }
+
+    if (mantissa > GEO_PARSE_MAX_MANTISSA || exp10 < -GEO_PARSE_MAX_EXP10 ||
+        exp10 > GEO_PARSE_MAX_EXP10)
+        return false;
+
+    double v = (double)mantissa;
+    v = exp10 < 0 ? v / pow10_exact[-exp10] : v * pow10_exact[exp10];
+    *value = negative ? -v : v;
+    return true;
+}
+
+bool geoParseDoubleStrtod(const char *s, size_t len, double *value) {
+    char stackbuf[128];
+    char *buf = len < sizeof(stackbuf) ? stackbuf : malloc(len + 1);
+    if (!buf)
+        return false;
+
+    memcpy(buf, s, len);
+    buf[len] = '\0';
+
+    /* Same checks as getDoubleFromObject() */
+    char *eptr;
+    errno = 0;
+    double v = strtod(buf, &eptr);
+    bool ok = !isspace((unsigned char)buf[0]) && eptr[0] == '\0' &&
+              !(errno == ERANGE &&
+                (v == HUGE_VAL || v == -HUGE_VAL || v == 0)) &&
+              errno != EINVAL && !isnan(v);
+
+    if (buf != stackbuf)
+        free(buf);
+
+    if (ok)
+        *value = v;
+    return ok;
+}
+
+bool geoParseDouble(const char *s, size_t len, double *value) {
+    return parseFast(s, s + len, value) ||
+           geoParseDoubleStrtod(s, len, value);
+}
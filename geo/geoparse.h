@@ -0,0 +1,16 @@
+#ifndef __GEOPARSE_H__
+#define __GEOPARSE_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Parse 'len' bytes at 's' as a double.  Accepts exactly what the server's
+ * getDoubleFromObject() accepts from a string (strtod() of the whole
+ * string, no leading space, no overflow, no NaN) and returns false for
+ * everything else.  Doesn't depend on the server so geo-bench can use it. */
+bool geoParseDouble(const char *s, size_t len, double *value);
+
+/* The strtod() path geoParseDouble() falls back to for hard cases */
+bool geoParseDoubleStrtod(const char *s, size_t len, double *value);
+
+#endif
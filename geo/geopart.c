@@ -0,0 +1,425 @@
+#include "geopart.h"
+#include "geohash_helper.h"
+
+/* ====================================================================
+ * Partitioned Geo Sets
+ * ====================================================================
+ * GEOPARTITION key step shards a geo set into one child zset per geohash
+ * cell at 'step', so searches only descend into the small zsets of the
+ * cells they touch and small partitions stay ziplist encoded.
+ *
+ * A partitioned key is made of:
+ *   - key: hash of member -> 52-bit score (for moves and member lookups)
+ *   - "__geodir:{<key>}": directory hash of "step" -> partition step and
+ *     "<cell>" -> member count of every non-empty partition
+ *   - "__geopart:{<key>}:<cell>": zset of the members inside 'cell'
+ *
+ * Partitions are regular keys, so they show up in KEYS and SCAN.  Empty
+ * partitions are deleted.  Hidden keys carry the hash tag of 'key' (keys
+ * without one are wrapped in braces), so a cluster keeps them in the slot
+ * of 'key'.
+ *
+ * The root hash ties the others' lifetime to 'key': partitions whose root
+ * is gone (DEL, RENAME) or isn't a hash anymore are stale.  Reads ignore
+ * stale partitions and the next geo write to 'key' deletes them. */
+
+/* ====================================================================
+ * Helpers
+ * ==================================================================== */
+/* 'prefix' followed by 'key' with a hash tag (its own, if it has one) */
+static sds geoPartHiddenName(const char *prefix, robj *key) {
+    robj *decoded = getDecodedObject(key);
+    sds k = decoded->ptr;
+    size_t len = sdslen(k);
+
+    char *open = memchr(k, '{', len);
+    char *close = open ? memchr(open + 1, '}', len - (open + 1 - k)) : NULL;
+    bool tagged = close && close > open + 1;
+
+    sds name = sdsnew(prefix);
+    if (!tagged)
+        name = sdscatlen(name, "{", 1);
+    name = sdscatsds(name, k);
+    if (!tagged)
+        name = sdscatlen(name, "}", 1);
+
+    decrRefCount(decoded);
+    return name;
+}
+
+static robj *geoPartDirKey(robj *key) {
+    return createObject(REDIS_STRING, geoPartHiddenName("__geodir:", key));
+}
+
+static robj *geoPartChildKey(robj *key, uint64_t cell) {
+    sds name = geoPartHiddenName("__geopart:", key);
+    name = sdscatprintf(name, ":%llu", (unsigned long long)cell);
+    return createObject(REDIS_STRING, name);
+}
+
+/* Is 'root' (the value of a key with a directory) still a partition root? */
+static inline bool geoPartRootValid(robj *root) {
+    return root && root->type == REDIS_HASH;
+}
+
+static inline uint64_t geoPartCell(int step, double score) {
+    return (uint64_t)score >> ((GEO_STEP_MAX - step) * 2);
+}
+
+/* Integer value of 'field' in hash 'o' (0 if missing) */
+static long long hashGetLongLong(robj *o, robj *field) {
+    robj *value = hashTypeGetObject(o, field);
+    long long v = 0;
+
+    if (value) {
+        getLongLongFromObject(value, &v);
+        decrRefCount(value);
+    }
+
+    return v;
+}
+
+static void hashSetLongLong(robj *o, robj *field, long long v) {
+    robj *value = createObject(REDIS_STRING, sdsfromlonglong(v));
+    robj *argv[2] = {field, value};
+
+    hashTypeTryConversion(o, argv, 0, 1);
+    hashTypeSet(o, field, value);
+    decrRefCount(value);
+}
+
+/* Adjust the member count of 'cell' in the directory by 'by'.  Returns the
+ * new count. */
+static long long geoPartCount(robj *dir, uint64_t cell, long long by) {
+    robj *field = createObject(REDIS_STRING, sdsfromlonglong(cell));
+    long long count = hashGetLongLong(dir, field) + by;
+
+    if (count > 0)
+        hashSetLongLong(dir, field, count);
+    else
+        hashTypeDelete(dir, field);
+
+    decrRefCount(field);
+    return count;
+}
+
+/* ====================================================================
+ * Writing
+ * ==================================================================== */
+/* Where a member goes: the root hash and directory of one partitioned key */
+struct geoPartTarget {
+    redisDb *db;
+    robj *key;
+    robj *root;
+    robj *dir;
+    int step;
+    list *replay; /* of struct geoPartCommand, or NULL */
+};
+
+/* Append [cmd, a, b, c] (or [cmd, a, b] if 'c' is NULL) to the replay,
+ * taking references of the arguments */
+static void geoPartReplay(struct geoPartTarget *t, char *cmd, robj *a,
+                          robj *b, robj *c) {
+    struct geoPartCommand *command = zmalloc(sizeof(*command));
+    command->argc = c ? 4 : 3;
+    command->argv = zmalloc(sizeof(robj *) * command->argc);
+    command->argv[0] = createStringObject(cmd, strlen(cmd));
+    command->argv[1] = a;
+    command->argv[2] = b;
+    if (c)
+        command->argv[3] = c;
+
+    for (int i = 1; i < command->argc; i++)
+        incrRefCount(command->argv[i]);
+
+    listAddNodeTail(t->replay, command);
+}
+
+/* Replay the directory count of 'cell' as its new value (HDEL at 0), so
+ * replaying twice is harmless */
+static void geoPartReplayCount(struct geoPartTarget *t, uint64_t cell,
+                               long long count) {
+    robj *dirkey = geoPartDirKey(t->key);
+    robj *field = createObject(REDIS_STRING, sdsfromlonglong(cell));
+
+    if (count > 0) {
+        robj *value = createObject(REDIS_STRING, sdsfromlonglong(count));
+        geoPartReplay(t, "hset", dirkey, field, value);
+        decrRefCount(value);
+    } else {
+        geoPartReplay(t, "hdel", dirkey, field, NULL);
+    }
+
+    decrRefCount(field);
+    decrRefCount(dirkey);
+}
+
+static void geoPartChildRemove(struct geoPartTarget *t, uint64_t cell,
+                               robj *member) {
+    robj *childkey = geoPartChildKey(t->key, cell);
+    robj *child = lookupKeyWrite(t->db, childkey);
+
+    if (child && zsetRemove(child, member)) {
+        long long count = geoPartCount(t->dir, cell, -1);
+        if (t->replay) {
+            /* ZREM of the last member deletes the partition too */
+            geoPartReplay(t, "zrem", childkey, member, NULL);
+            geoPartReplayCount(t, cell, count);
+        }
+        if (!zsetLength(child))
+            dbDelete(t->db, childkey);
+    }
+
+    decrRefCount(childkey);
+}
+
+static bool geoPartTargetAdd(struct geoPartTarget *t, robj *member,
+                             double score, bool *changed) {
+    robj *old = hashTypeGetObject(t->root, member);
+    long long oldscore = 0;
+    uint64_t cell = geoPartCell(t->step, score);
+
+    if (old) {
+        getLongLongFromObject(old, &oldscore);
+        decrRefCount(old);
+
+        if (oldscore == (long long)score) {
+            *changed = false;
+            return false;
+        }
+
+        /* Moving to another cell leaves the old partition */
+        if (geoPartCell(t->step, oldscore) != cell)
+            geoPartChildRemove(t, geoPartCell(t->step, oldscore), member);
+    }
+
+    robj *childkey = geoPartChildKey(t->key, cell);
+    robj *child = lookupKeyWrite(t->db, childkey);
+    if (!child) {
+        child = createZsetZiplistObject();
+        dbAdd(t->db, childkey, child);
+    }
+
+    bool child_changed;
+    long long count = -1;
+    if (zsetAdd(child, member, score, &child_changed))
+        count = geoPartCount(t->dir, cell, 1);
+
+    hashSetLongLong(t->root, member, (long long)score);
+    *changed = true;
+
+    if (t->replay) {
+        robj *scoreobj =
+            createObject(REDIS_STRING, sdsfromlonglong((long long)score));
+        geoPartReplay(t, "zadd", childkey, scoreobj, member);
+        if (count >= 0)
+            geoPartReplayCount(t, cell, count);
+        geoPartReplay(t, "hset", t->key, member, scoreobj);
+        decrRefCount(scoreobj);
+    }
+
+    decrRefCount(childkey);
+    return !old;
+}
+
+bool geoPartAdd(redisDb *db, robj *key, int step, robj *member, double score,
+                bool *changed, list *replay) {
+    robj *dirkey = geoPartDirKey(key);
+    struct geoPartTarget t = {.db = db,
+                              .key = key,
+                              .root = lookupKeyWrite(db, key),
+                              .dir = lookupKeyWrite(db, dirkey),
+                              .step = step,
+                              .replay = replay};
+    decrRefCount(dirkey);
+
+    if (!t.root) {
+        t.root = createHashObject();
+        dbAdd(db, key, t.root);
+    }
+
+    return geoPartTargetAdd(&t, member, score, changed);
+}
+
+static bool geoPartMoveVisit(void *privdata, double score, unsigned char *str,
+                             unsigned int len, long long vlong) {
+    struct geoPartTarget *t = privdata;
+    robj *member = str ? createStringObject((char *)str, len)
+                       : createStringObjectFromLongLong(vlong);
+    bool changed;
+
+    geoPartTargetAdd(t, member, score, &changed);
+    decrRefCount(member);
+    return true;
+}
+
+void geoPartCreate(redisDb *db, robj *key, int step) {
+    robj *dirkey = geoPartDirKey(key);
+    robj *dir = createHashObject();
+    robj *field = createStringObject("step", 4);
+    hashSetLongLong(dir, field, step);
+    decrRefCount(field);
+    dbAdd(db, dirkey, dir);
+    decrRefCount(dirkey);
+
+    /* The root exists even while the key has no members */
+    robj *zobj = lookupKeyWrite(db, key);
+    if (!zobj) {
+        dbAdd(db, key, createHashObject());
+        return;
+    }
+
+    /* Build the member hash aside, then swap it in for the zset */
+    struct geoPartTarget t = {
+        .db = db, .key = key, .root = createHashObject(), .dir = dir,
+        .step = step};
+    geozrangeVisit(zobj, 0, 1ULL << (GEO_STEP_MAX * 2), geoPartMoveVisit,
+                   &t);
+
+    dbDelete(db, key);
+    dbAdd(db, key, t.root);
+}
+
+/* ====================================================================
+ * Dropping
+ * ==================================================================== */
+/* Delete hidden 'key' and propagate the DEL (our callers' commands aren't
+ * propagated in a way that would delete it on replicas). */
+static void geoPartDelete(redisDb *db, robj *key) {
+    if (!dbDelete(db, key))
+        return;
+
+    robj *argv[2] = {createStringObject("del", 3), key};
+    propagate(lookupCommandByCString("del"), db->id, argv, 2,
+              REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+    decrRefCount(argv[0]);
+
+    signalModifiedKey(db, key);
+    notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC, "del", key, db->id);
+}
+
+void geoPartDrop(redisDb *db, robj *key) {
+    robj *dirkey = geoPartDirKey(key);
+    robj *dir = lookupKeyWrite(db, dirkey);
+
+    if (dir && dir->type == REDIS_HASH) {
+        hashTypeIterator *iter = hashTypeInitIterator(dir);
+        while (hashTypeNext(iter) != REDIS_ERR) {
+            robj *field = hashTypeCurrentObject(iter, REDIS_HASH_KEY);
+            long long cell;
+
+            /* Every field but "step" is a partition */
+            if (getLongLongFromObject(field, &cell) == REDIS_OK) {
+                robj *childkey = geoPartChildKey(key, cell);
+                geoPartDelete(db, childkey);
+                decrRefCount(childkey);
+            }
+            decrRefCount(field);
+        }
+        hashTypeReleaseIterator(iter);
+    }
+
+    if (dir)
+        geoPartDelete(db, dirkey);
+    decrRefCount(dirkey);
+}
+
+void geoPartDropStale(redisDb *db, robj *key) {
+    robj *dirkey = geoPartDirKey(key);
+    bool stale = lookupKeyWrite(db, dirkey) &&
+                 !geoPartRootValid(lookupKeyWrite(db, key));
+    decrRefCount(dirkey);
+
+    if (stale)
+        geoPartDrop(db, key);
+}
+
+/* ====================================================================
+ * Reading
+ * ==================================================================== */
+bool geoPartStep(redisDb *db, robj *key, int *step) {
+    robj *dirkey = geoPartDirKey(key);
+    robj *dir = lookupKey(db, dirkey);
+    decrRefCount(dirkey);
+
+    if (!dir || dir->type != REDIS_HASH ||
+        !geoPartRootValid(lookupKey(db, key)))
+        return false;
+
+    robj *field = createStringObject("step", 4);
+    *step = hashGetLongLong(dir, field);
+    decrRefCount(field);
+    return *step > 0;
+}
+
+bool geoPartScore(redisDb *db, robj *key, robj *member, double *score) {
+    robj *root = lookupKey(db, key);
+    if (!root || root->type != REDIS_HASH)
+        return false;
+
+    robj *value = hashTypeGetObject(root, member);
+    if (!value)
+        return false;
+
+    long long v = 0;
+    getLongLongFromObject(value, &v);
+    decrRefCount(value);
+    *score = v;
+    return true;
+}
+
+static int sort_cell_asc(const void *a, const void *b) {
+    uint64_t ca = *(const uint64_t *)a, cb = *(const uint64_t *)b;
+    return ca < cb ? -1 : ca > cb;
+}
+
+bool geoPartVisit(redisDb *db, robj *key, int step, double min, double max,
+                  zsetRangeVisitor *visit, void *privdata) {
+    robj *dirkey = geoPartDirKey(key);
+    robj *dir = lookupKey(db, dirkey);
+    decrRefCount(dirkey);
+
+    if (!dir || max <= min)
+        return true;
+
+    uint64_t lo = geoPartCell(step, min);
+    uint64_t hi = geoPartCell(step, max - 1);
+    unsigned long partitions = hashTypeLength(dir) - 1; /* minus "step" */
+
+    /* Ranges coarser than partitions may span more cells than we have
+     * partitions, in which case we walk the directory instead. */
+    uint64_t *cells;
+    unsigned long count = 0;
+    if (hi - lo < partitions) {
+        cells = zmalloc(sizeof(*cells) * (hi - lo + 1));
+        for (uint64_t cell = lo; cell <= hi; cell++)
+            cells[count++] = cell;
+    } else {
+        cells = zmalloc(sizeof(*cells) * (partitions ? partitions : 1));
+        hashTypeIterator *hi_iter = hashTypeInitIterator(dir);
+        while (hashTypeNext(hi_iter) != REDIS_ERR) {
+            robj *field = hashTypeCurrentObject(hi_iter, REDIS_HASH_KEY);
+            long long cell;
+            if (getLongLongFromObject(field, &cell) == REDIS_OK &&
+                (uint64_t)cell >= lo && (uint64_t)cell <= hi &&
+                count < partitions)
+                cells[count++] = cell;
+            decrRefCount(field);
+        }
+        hashTypeReleaseIterator(hi_iter);
+        qsort(cells, count, sizeof(*cells), sort_cell_asc);
+    }
+
+    bool more = true;
+    for (unsigned long i = 0; more && i < count; i++) {
+        robj *childkey = geoPartChildKey(key, cells[i]);
+        robj *child = lookupKey(db, childkey);
+        decrRefCount(childkey);
+
+        if (child && child->type == REDIS_ZSET)
+            more = geozrangeVisit(child, min, max, visit, privdata);
+    }
+
+    zfree(cells);
+    return more;
+}
@@ -0,0 +1,46 @@
+#ifndef __GEOPART_H__
+#define __GEOPART_H__
+
+#include "redis.h"
+#include "zset.h"
+#include <stdbool.h>
+
+/* Is 'key' partitioned (with its root in place)?  If so, sets *step to its
+ * partition step. */
+bool geoPartStep(redisDb *db, robj *key, int *step);
+
+/* Partition 'key' at 'step', moving the members of an existing geo zset
+ * into partitions.  Callers check 'key' is a zset or doesn't exist. */
+void geoPartCreate(redisDb *db, robj *key, int step);
+
+/* Delete the directory and partitions of 'key' (not 'key' itself),
+ * propagating the DELs.  For writes about to replace 'key'. */
+void geoPartDrop(redisDb *db, robj *key);
+
+/* Drop partitions whose root was deleted, renamed or replaced (called by
+ * writes before they look at 'key') */
+void geoPartDropStale(redisDb *db, robj *key);
+
+/* A command replaying part of a partitioned write on replicas and the AOF.
+ * 'argv' is zmalloc'd and owns its references. */
+struct geoPartCommand {
+    int argc;
+    robj **argv;
+};
+
+/* Add or move 'member'.  Returns true if the member is new.  Sets *changed
+ * if anything changed.  If 'replay' isn't NULL, appends the struct
+ * geoPartCommands (HSET, ZADD, ZREM and HDEL of the root, partitions and
+ * directory) writing the same change without computing cells. */
+bool geoPartAdd(redisDb *db, robj *key, int step, robj *member, double score,
+                bool *changed, list *replay);
+
+/* Score of 'member' of partitioned 'key' */
+bool geoPartScore(redisDb *db, robj *key, robj *member, double *score);
+
+/* Visit members scored in [min, max) of every partition overlapping the
+ * range, in score order.  Returns false if 'visit' stopped us early. */
+bool geoPartVisit(redisDb *db, robj *key, int step, double min, double max,
+                  zsetRangeVisitor *visit, void *privdata);
+
+#endif
@@ -0,0 +1,268 @@
+#include "geostats.h"
+
+/* ====================================================================
+ * GEOSTATS Search Instrumentation
+ * ====================================================================
+ * Counts what GEORADIUS and GEORADIUSBYMEMBER do (cells and ranges
+ * scanned, skiplist descents, candidates examined and accepted, decodes
+ * and haversines) and how long each stage takes, globally and per key.
+ *
+ * Latencies go into log2 histograms: bucket 0 counts stages under 1us and
+ * bucket i counts stages of [2^(i-1), 2^i) us.
+ *
+ * Per-key totals are kept for at most GEO_STATS_MAX_KEYS existing keys
+ * (searching a missing key doesn't take a slot).  Once full, searches of
+ * other keys only count globally.  Totals outlive their keys until
+ * GEOSTATSRESET. */
+
+#define GEO_STATS_BUCKETS 32
+#define GEO_STATS_MAX_KEYS 1024
+
+struct geoStatsTotals {
+    uint64_t searches;
+    struct geoStatsSample sum;
+    uint64_t histogram[GEO_STATS_STAGES][GEO_STATS_BUCKETS];
+};
+
+static struct {
+    struct geoStatsTotals global;
+    dict *keys; /* sds "<db>:<key>" -> struct geoStatsTotals */
+} gs = {{0}};
+
+struct geoStatsSample *geoStatsCurrent = NULL;
+
+static char *stage_names[GEO_STATS_STAGES] = {
+    "scan-us", "filter-us", "sort-us", "reply-us"};
+
+/* ====================================================================
+ * dict types
+ * ==================================================================== */
+static unsigned int geoStatsHash(const void *key) {
+    return dictGenHashFunction(key, sdslen((sds)key));
+}
+
+static int geoStatsKeyCompare(void *privdata, const void *key1,
+                              const void *key2) {
+    size_t l1 = sdslen((sds)key1);
+    size_t l2 = sdslen((sds)key2);
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+static void geoStatsSdsDestructor(void *privdata, void *val) {
+    sdsfree(val);
+}
+
+static void geoStatsFreeDestructor(void *privdata, void *val) {
+    zfree(val);
+}
+
+static dictType geoStatsKeyDictType = {
+    geoStatsHash,          /* hash function */
+    NULL,                  /* key dup */
+    NULL,                  /* val dup */
+    geoStatsKeyCompare,    /* key compare */
+    geoStatsSdsDestructor, /* key destructor */
+    geoStatsFreeDestructor /* val destructor */
+};
+
+/* ====================================================================
+ * Bring up / Teardown
+ * ==================================================================== */
+void geoStatsInit(void) {
+    gs.keys = dictCreate(&geoStatsKeyDictType, NULL);
+}
+
+void geoStatsFree(void) {
+    dictRelease(gs.keys);
+    memset(&gs, 0, sizeof(gs));
+    geoStatsCurrent = NULL;
+}
+
+/* ====================================================================
+ * Counting
+ * ==================================================================== */
+static sds geoStatsKeyId(redisDb *db, robj *key) {
+    robj *decoded = getDecodedObject(key);
+    sds keyid = sdsfromlonglong(db->id);
+    keyid = sdscatlen(keyid, ":", 1);
+    keyid = sdscatsds(keyid, decoded->ptr);
+    decrRefCount(decoded);
+    return keyid;
+}
+
+/* dictFind() rather than lookupKey() so counting doesn't touch the key's
+ * LRU clock */
+static bool geoStatsKeyExists(redisDb *db, robj *key) {
+    robj *decoded = getDecodedObject(key);
+    bool exists = dictFind(db->dict, decoded->ptr) != NULL;
+    decrRefCount(decoded);
+    return exists;
+}
+
+/* Totals of 'key', created if 'key' exists and we still have room (NULL
+ * otherwise) */
+static struct geoStatsTotals *geoStatsKeyTotals(redisDb *db, robj *key,
+                                                bool create) {
+    sds keyid = geoStatsKeyId(db, key);
+    dictEntry *de = dictFind(gs.keys, keyid);
+
+    if (de) {
+        sdsfree(keyid);
+        return dictGetVal(de);
+    }
+
+    if (!create || dictSize(gs.keys) >= GEO_STATS_MAX_KEYS ||
+        !geoStatsKeyExists(db, key)) {
+        sdsfree(keyid);
+        return NULL;
+    }
+
+    struct geoStatsTotals *t = zcalloc(sizeof(*t));
+    dictAdd(gs.keys, keyid, t);
+    return t;
+}
+
+static int geoStatsBucket(long long us) {
+    int bucket = 0;
+    while (us > 0 && bucket < GEO_STATS_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void geoStatsAdd(struct geoStatsTotals *t,
+                        struct geoStatsSample *sample) {
+    t->sum.cells += sample->cells;
+    t->sum.ranges += sample->ranges;
+    t->sum.descents += sample->descents;
+    t->sum.candidates += sample->candidates;
+    t->sum.accepted += sample->accepted;
+    t->sum.decodes += sample->decodes;
+    t->sum.haversines += sample->haversines;
+
+    for (int i = 0; i < GEO_STATS_STAGES; i++) {
+        if (!(sample->stages & (1 << i)))
+            continue;
+        t->sum.stage_us[i] += sample->stage_us[i];
+        t->histogram[i][geoStatsBucket(sample->stage_us[i])]++;
+    }
+}
+
+void geoStatsFold(redisDb *db, robj *key, struct geoStatsSample *sample) {
+    geoStatsAdd(&gs.global, sample);
+
+    struct geoStatsTotals *t = geoStatsKeyTotals(db, key, true);
+    if (t)
+        geoStatsAdd(t, sample);
+}
+
+void geoStatsBegin(struct geoStatsSample *sample) {
+    memset(sample, 0, sizeof(*sample));
+    geoStatsCurrent = sample;
+}
+
+void geoStatsEnd(redisDb *db, robj *key) {
+    struct geoStatsSample *sample = geoStatsCurrent;
+    geoStatsCurrent = NULL;
+
+    if (!sample)
+        return;
+
+    gs.global.searches++;
+    struct geoStatsTotals *t = geoStatsKeyTotals(db, key, true);
+    if (t)
+        t->searches++;
+
+    geoStatsFold(db, key, sample);
+}
+
+long long geoStatsStageStart(void) {
+    return geoStatsCurrent ? ustime() : 0;
+}
+
+void geoStatsSampleStage(struct geoStatsSample *sample, int stage,
+                         long long start) {
+    sample->stage_us[stage] += ustime() - start;
+    sample->stages |= 1 << stage;
+}
+
+void geoStatsStageEnd(int stage, long long start) {
+    if (geoStatsCurrent)
+        geoStatsSampleStage(geoStatsCurrent, stage, start);
+}
+
+/* ====================================================================
+ * Reporting
+ * ==================================================================== */
+/* Non-empty buckets as [upper bound in us, count] pairs */
+static void geoStatsReplyHistogram(redisClient *c, uint64_t *histogram) {
+    int used = 0;
+    for (int i = 0; i < GEO_STATS_BUCKETS; i++)
+        used += histogram[i] > 0;
+
+    addReplyMultiBulkLen(c, used * 2);
+    for (int i = 0; i < GEO_STATS_BUCKETS; i++) {
+        if (!histogram[i])
+            continue;
+        addReplyLongLong(c, 1LL << i);
+        addReplyLongLong(c, histogram[i]);
+    }
+}
+
+static void geoStatsReplyTotals(redisClient *c, struct geoStatsTotals *t) {
+    addReplyMultiBulkLen(c, 16 + GEO_STATS_STAGES * 4);
+    addReplyBulkCString(c, "searches");
+    addReplyLongLong(c, t->searches);
+    addReplyBulkCString(c, "cells");
+    addReplyLongLong(c, t->sum.cells);
+    addReplyBulkCString(c, "ranges");
+    addReplyLongLong(c, t->sum.ranges);
+    addReplyBulkCString(c, "descents");
+    addReplyLongLong(c, t->sum.descents);
+    addReplyBulkCString(c, "candidates");
+    addReplyLongLong(c, t->sum.candidates);
+    addReplyBulkCString(c, "accepted");
+    addReplyLongLong(c, t->sum.accepted);
+    addReplyBulkCString(c, "decodes");
+    addReplyLongLong(c, t->sum.decodes);
+    addReplyBulkCString(c, "haversines");
+    addReplyLongLong(c, t->sum.haversines);
+
+    for (int i = 0; i < GEO_STATS_STAGES; i++) {
+        addReplyBulkCString(c, stage_names[i]);
+        addReplyLongLong(c, t->sum.stage_us[i]);
+        sds name = sdscatprintf(sdsempty(), "%s-histogram", stage_names[i]);
+        addReplyBulkCBuffer(c, name, sdslen(name));
+        sdsfree(name);
+        geoStatsReplyHistogram(c, t->histogram[i]);
+    }
+}
+
+void geoStatsReply(redisClient *c, redisDb *db, robj *key) {
+    if (!key) {
+        geoStatsReplyTotals(c, &gs.global);
+        return;
+    }
+
+    struct geoStatsTotals *t = geoStatsKeyTotals(db, key, false);
+    if (t) {
+        geoStatsReplyTotals(c, t);
+    } else {
+        struct geoStatsTotals empty = {0};
+        geoStatsReplyTotals(c, &empty);
+    }
+}
+
+void geoStatsReset(redisDb *db, robj *key) {
+    if (!key) {
+        memset(&gs.global, 0, sizeof(gs.global));
+        dictRelease(gs.keys);
+        gs.keys = dictCreate(&geoStatsKeyDictType, NULL);
+        return;
+    }
+
+    sds keyid = geoStatsKeyId(db, key);
+    dictDelete(gs.keys, keyid);
+    sdsfree(keyid);
+}
@@ -0,0 +1,68 @@
+#ifndef __GEOSTATS_H__
+#define __GEOSTATS_H__
+
+#include "redis.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Timed stages of a radius search */
+enum geoStatsStage {
+    GEO_STATS_SCAN = 0, /* walking the zset ranges of the search's cells */
+    GEO_STATS_FILTER,   /* decoding candidates and testing their distance */
+    GEO_STATS_SORT,
+    GEO_STATS_REPLY,
+    GEO_STATS_STAGES
+};
+
+/* Counters of one radius search.  Every search counts into its own sample
+ * (the main thread's current search or an async job's), so counting is a
+ * plain increment.  Samples are folded into the key's and global totals
+ * once the search is done. */
+struct geoStatsSample {
+    uint64_t cells;      /* geohash cells searched */
+    uint64_t ranges;     /* score ranges walked */
+    uint64_t descents;   /* skiplist descents to the start of a range */
+    uint64_t candidates; /* members examined */
+    uint64_t accepted;   /* members within the radius */
+    uint64_t decodes;
+    uint64_t haversines;
+    long long stage_us[GEO_STATS_STAGES];
+    unsigned int stages; /* bit per stage that ran */
+};
+
+/* Sample of the radius search running on the main thread, or NULL */
+extern struct geoStatsSample *geoStatsCurrent;
+
+#define GEO_STATS_COUNT(field, n)                                              \
+    do {                                                                       \
+        if (geoStatsCurrent)                                                   \
+            geoStatsCurrent->field += (n);                                     \
+    } while (0)
+
+/* Bring up / Teardown (called from module load/cleanup) */
+void geoStatsInit(void);
+void geoStatsFree(void);
+
+/* Start counting into 'sample' until geoStatsEnd() folds it into the
+ * totals of 'key' */
+void geoStatsBegin(struct geoStatsSample *sample);
+void geoStatsEnd(redisDb *db, robj *key);
+
+/* Fold a finished sample in without counting another search (for work
+ * finished elsewhere, like async jobs) */
+void geoStatsFold(redisDb *db, robj *key, struct geoStatsSample *sample);
+
+/* Stage timing: pass the result of geoStatsStageStart() to
+ * geoStatsStageEnd().  Free when no search is being counted. */
+long long geoStatsStageStart(void);
+void geoStatsStageEnd(int stage, long long start);
+void geoStatsSampleStage(struct geoStatsSample *sample, int stage,
+                         long long start);
+
+/* Reply with global totals (key == NULL) or the totals of 'key' */
+void geoStatsReply(redisClient *c, redisDb *db, robj *key);
+
+/* Reset global and every key's totals (key == NULL) or just 'key' */
+void geoStatsReset(redisDb *db, robj *key);
+
+#endif
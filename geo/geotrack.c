@@ -0,0 +1,317 @@
+#include "geotrack.h"
+
+/* ====================================================================
+ * Trajectory Histories
+ * ====================================================================
+ * GEOTRACK appends (timestamp, 52-bit geohash) points to the history of a
+ * member.  A key holds the histories of many members as a hash of
+ * member -> history string.
+ *
+ * Histories are made of blocks of up to GEO_TRACK_BLOCK points.  A block
+ * stores its first geohash whole, then per point:
+ *   - the delta-of-delta of its timestamp (regular reporting intervals
+ *     cost one byte per point), and
+ *   - the delta of its geohash from the previous point (nearby points
+ *     share their high bits),
+ * both as zigzag varints.  A moving vehicle costs about four bytes per
+ * point.
+ *
+ * Layout (all fixed size integers little-endian):
+ *   header (GEO_TRACK_HEADER bytes):
+ *     "GEOT", u8 version, u8[3] unused, u32 point count,
+ *     u32 offset of the last block (0 without blocks)
+ *   blocks (GEO_TRACK_BLOCK_HEADER bytes each, then their body):
+ *     u32 body bytes, u32 point count, i64 first timestamp,
+ *     i64 last timestamp, i64 last timestamp delta, u64 last geohash
+ *
+ * Appends only touch the last block, whose header remembers what the next
+ * point is encoded against.  Range reads skip whole blocks by their first
+ * and last timestamps.  Retention trims whole blocks from the front. */
+
+#define GEO_TRACK_MAGIC "GEOT"
+#define GEO_TRACK_VERSION 1
+#define GEO_TRACK_HEADER 16
+#define GEO_TRACK_BLOCK_HEADER 40
+#define GEO_TRACK_BLOCK 128
+
+/* Decoded block header */
+struct geoTrackBlock {
+    uint32_t bytes;
+    uint32_t count;
+    int64_t first;
+    int64_t last;
+    int64_t last_delta;
+    uint64_t last_score;
+};
+
+/* ====================================================================
+ * Encoding helpers
+ * ==================================================================== */
+static inline uint32_t get32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    memrev32ifbe(&v);
+    return v;
+}
+
+static inline uint64_t get64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    memrev64ifbe(&v);
+    return v;
+}
+
+static inline void set32(unsigned char *p, uint32_t v) {
+    memrev32ifbe(&v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline void set64(unsigned char *p, uint64_t v) {
+    memrev64ifbe(&v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Wrapping a - b and a + b: deltas of far apart timestamps may overflow,
+ * but wrap back when decoded */
+static inline int64_t sub64(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a - (uint64_t)b);
+}
+
+static inline int64_t add64(int64_t a, int64_t b) {
+    return (int64_t)((uint64_t)a + (uint64_t)b);
+}
+
+/* Encode 'v' into 'buf' (10 bytes).  Returns bytes used. */
+static int putVarint(unsigned char *buf, uint64_t v) {
+    int len = 0;
+
+    do {
+        buf[len] = v & 0x7f;
+        v >>= 7;
+        if (v)
+            buf[len] |= 0x80;
+        len++;
+    } while (v);
+
+    return len;
+}
+
+/* Returns the byte after the varint or NULL if it runs past 'end' */
+static const unsigned char *getVarint(const unsigned char *p,
+                                      const unsigned char *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return p;
+    }
+
+    return NULL;
+}
+
+static void getBlock(const unsigned char *p, struct geoTrackBlock *b) {
+    b->bytes = get32(p);
+    b->count = get32(p + 4);
+    b->first = (int64_t)get64(p + 8);
+    b->last = (int64_t)get64(p + 16);
+    b->last_delta = (int64_t)get64(p + 24);
+    b->last_score = get64(p + 32);
+}
+
+static void setBlock(unsigned char *p, struct geoTrackBlock *b) {
+    set32(p, b->bytes);
+    set32(p + 4, b->count);
+    set64(p + 8, (uint64_t)b->first);
+    set64(p + 16, (uint64_t)b->last);
+    set64(p + 24, (uint64_t)b->last_delta);
+    set64(p + 32, b->last_score);
+}
+
+/* Decode the block at 'offset' if it's within 'len' bytes of 'track' */
+static bool blockAt(const unsigned char *track, size_t len, size_t offset,
+                    struct geoTrackBlock *b) {
+    if (offset < GEO_TRACK_HEADER || offset > len ||
+        len - offset < GEO_TRACK_BLOCK_HEADER)
+        return false;
+
+    getBlock(track + offset, b);
+    return b->count > 0 && b->count <= GEO_TRACK_BLOCK &&
+           b->bytes <= len - offset - GEO_TRACK_BLOCK_HEADER &&
+           b->first <= b->last;
+}
+
+/* ====================================================================
+ * Histories
+ * ==================================================================== */
+sds geoTrackCreate(void) {
+    unsigned char header[GEO_TRACK_HEADER] = {0};
+    memcpy(header, GEO_TRACK_MAGIC, 4);
+    header[4] = GEO_TRACK_VERSION;
+    return sdsnewlen(header, sizeof(header));
+}
+
+bool geoTrackIs(const char *track, size_t len) {
+    return len >= GEO_TRACK_HEADER && !memcmp(track, GEO_TRACK_MAGIC, 4) &&
+           track[4] == GEO_TRACK_VERSION;
+}
+
+uint32_t geoTrackLength(const char *track) {
+    return get32((const unsigned char *)track + 8);
+}
+
+long long geoTrackLast(const char *track) {
+    const unsigned char *t = (const unsigned char *)track;
+    return (int64_t)get64(t + get32(t + 12) + 16);
+}
+
+int geoTrackAppend(sds *track, long long timestamp, uint64_t score) {
+    unsigned char *t = (unsigned char *)*track;
+    size_t len = sdslen(*track);
+    if (!geoTrackIs(*track, len))
+        return GEO_TRACK_CORRUPT;
+
+    uint32_t points = geoTrackLength(*track);
+    uint32_t offset = get32(t + 12);
+    struct geoTrackBlock b = {0};
+    unsigned char buf[20];
+    int used;
+
+    if (points) {
+        /* The last block always runs to the end of the history */
+        if (!blockAt(t, len, offset, &b) ||
+            offset + GEO_TRACK_BLOCK_HEADER + b.bytes != len)
+            return GEO_TRACK_CORRUPT;
+
+        if (timestamp < b.last)
+            return GEO_TRACK_OUT_OF_ORDER;
+    }
+
+    if (!points || b.count == GEO_TRACK_BLOCK) {
+        /* Start a new block with our geohash stored whole */
+        unsigned char header[GEO_TRACK_BLOCK_HEADER];
+        used = putVarint(buf, score);
+        b.bytes = used;
+        b.count = 1;
+        b.first = b.last = timestamp;
+        b.last_delta = 0;
+        b.last_score = score;
+        setBlock(header, &b);
+
+        offset = len;
+        *track = sdscatlen(*track, header, sizeof(header));
+        *track = sdscatlen(*track, buf, used);
+    } else {
+        int64_t delta = sub64(timestamp, b.last);
+        used = putVarint(buf, zigzag(sub64(delta, b.last_delta)));
+        used +=
+            putVarint(buf + used, zigzag((int64_t)(score - b.last_score)));
+
+        b.bytes += used;
+        b.count++;
+        b.last = timestamp;
+        b.last_delta = delta;
+        b.last_score = score;
+
+        *track = sdscatlen(*track, buf, used);
+        setBlock((unsigned char *)*track + offset, &b);
+    }
+
+    t = (unsigned char *)*track;
+    set32(t + 8, points + 1);
+    set32(t + 12, offset);
+    return GEO_TRACK_OK;
+}
+
+long geoTrackTrim(sds *track, long long before) {
+    const unsigned char *t = (const unsigned char *)*track;
+    size_t len = sdslen(*track);
+    if (!geoTrackIs(*track, len))
+        return -1;
+
+    uint32_t points = geoTrackLength(*track);
+    size_t offset = GEO_TRACK_HEADER;
+    long dropped = 0;
+    struct geoTrackBlock b;
+
+    while (offset < len) {
+        if (!blockAt(t, len, offset, &b))
+            return -1;
+        if (b.last >= before)
+            break;
+
+        dropped += b.count;
+        offset += GEO_TRACK_BLOCK_HEADER + b.bytes;
+    }
+
+    if (!dropped)
+        return 0;
+
+    size_t removed = offset - GEO_TRACK_HEADER;
+    uint32_t last = get32(t + 12);
+    bool empty = offset == len;
+
+    memmove(*track + GEO_TRACK_HEADER, *track + offset, len - offset);
+    sdsrange(*track, 0, len - removed - 1);
+
+    unsigned char *h = (unsigned char *)*track;
+    set32(h + 8, points - dropped);
+    set32(h + 12, empty ? 0 : last - removed);
+    return dropped;
+}
+
+bool geoTrackRange(const char *track, size_t len, long long start,
+                   long long end, geoTrackVisitor *visit, void *privdata) {
+    const unsigned char *t = (const unsigned char *)track;
+    size_t offset = GEO_TRACK_HEADER;
+    struct geoTrackBlock b;
+
+    if (!geoTrackIs(track, len))
+        return false;
+
+    while (offset < len) {
+        if (!blockAt(t, len, offset, &b))
+            return false;
+
+        const unsigned char *p = t + offset + GEO_TRACK_BLOCK_HEADER;
+        const unsigned char *body_end = p + b.bytes;
+        offset += GEO_TRACK_BLOCK_HEADER + b.bytes;
+
+        if (b.last < start)
+            continue;
+        if (b.first > end)
+            break;
+
+        uint64_t v, score;
+        int64_t timestamp = b.first, delta = 0;
+        if (!(p = getVarint(p, body_end, &score)))
+            return false;
+
+        for (uint32_t i = 0; i < b.count; i++) {
+            if (i) {
+                if (!(p = getVarint(p, body_end, &v)))
+                    return false;
+                delta = add64(delta, unzigzag(v));
+                timestamp = add64(timestamp, delta);
+                if (!(p = getVarint(p, body_end, &v)))
+                    return false;
+                score += unzigzag(v);
+            }
+
+            if (timestamp > end)
+                return true;
+            if (timestamp >= start && !visit(timestamp, score, privdata))
+                return true;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef __GEOTRACK_H__
+#define __GEOTRACK_H__
+
+#include "redis.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/* geoTrackAppend() results */
+#define GEO_TRACK_OK 0
+#define GEO_TRACK_CORRUPT 1
+#define GEO_TRACK_OUT_OF_ORDER 2
+
+/* Empty history */
+sds geoTrackCreate(void);
+
+/* Is 'track' a history (checks the header only)? */
+bool geoTrackIs(const char *track, size_t len);
+
+/* Points in history 'track' */
+uint32_t geoTrackLength(const char *track);
+
+/* Timestamp of the newest point of 'track' (which must have points) */
+long long geoTrackLast(const char *track);
+
+/* Append a point to '*track' (which may move).  Timestamps of a history
+ * never go backwards. */
+int geoTrackAppend(sds *track, long long timestamp, uint64_t score);
+
+/* Drop every block whose points are all older than 'before'.  Returns
+ * points dropped or -1 if 'track' is corrupt. */
+long geoTrackTrim(sds *track, long long before);
+
+/* Called for every point in range.  Return false to stop. */
+typedef bool geoTrackVisitor(long long timestamp, uint64_t score,
+                             void *privdata);
+
+/* Visit points with timestamps in [start, end] in time order.  Returns
+ * false if 'track' is corrupt. */
+bool geoTrackRange(const char *track, size_t len, long long start,
+                   long long end, geoTrackVisitor *visit, void *privdata);
+
+#endif
@@ -0,0 +1,384 @@
+#include "geottl.h"
+#include "geocache.h"
+#include "zset.h"
+
+/* ====================================================================
+ * Per-member TTLs
+ * ====================================================================
+ * GEOADD ... EX seconds gives members an expire time.  Expire times live in
+ * a companion zset named "__geottl:<key>" mapping member -> unix time in
+ * milliseconds, so the members due for removal are always at the head of
+ * the companion zset.
+ *
+ * Reads skip expired members (see struct geoTtlView), so results never
+ * depend on how far removal has come.  Expired members are removed
+ * incrementally:
+ *   - geo write commands reap up to GEO_TTL_REAP_PER_COMMAND members of
+ *     the key they write before running, and
+ *   - a timer samples random keys with TTLs GEO_TTL_CRON_HZ times per second
+ *     and reaps up to GEO_TTL_REAP_PER_CRON members per run.  It also drops
+ *     companion zsets whose geo key is gone, and GEOADD drops a leftover
+ *     companion when it creates the key, so a new key never inherits
+ *     expire times.
+ *
+ * Writes to the companion zset are propagated to replicas and the AOF as
+ * ZADDs (with absolute expire times, so replicas agree with us) and ZREMs.
+ * Removals are propagated as ZREMs of the geo key and the companion zset.
+ * Replicas never reap on their own.
+ *
+ * We only remember keys with TTLs set since the module loaded.  After a
+ * restart, keys are picked up again by the next geo command reading or
+ * writing them. */
+
+#define GEO_TTL_CRON_HZ 10
+#define GEO_TTL_REAP_PER_CRON 256
+#define GEO_TTL_KEYS_PER_CRON 16
+
+/* A key known to have a companion TTL zset */
+struct geoTtlKeyRef {
+    int dbid;
+    robj *key;
+};
+
+static struct {
+    dict *keys;                /* sds "<db>:<key>" -> struct geoTtlKeyRef */
+    redisClient *client;       /* fake client running zadd/zrem for us */
+    struct redisCommand *zadd; /* for propagating our writes */
+    struct redisCommand *zrem;
+    struct redisCommand *del;
+    robj *zaddcmd;
+    robj *zremcmd;
+    robj *delcmd;
+    long long cron_id;
+    sds member; /* reused by geoTtlExpired() */
+} ttl = {0};
+
+/* ====================================================================
+ * dict type
+ * ==================================================================== */
+static unsigned int geoTtlHash(const void *key) {
+    return dictGenHashFunction(key, sdslen((sds)key));
+}
+
+static int geoTtlKeyCompare(void *privdata, const void *key1,
+                            const void *key2) {
+    size_t l1 = sdslen((sds)key1);
+    size_t l2 = sdslen((sds)key2);
+    return l1 == l2 && memcmp(key1, key2, l1) == 0;
+}
+
+static void geoTtlSdsDestructor(void *privdata, void *val) {
+    sdsfree(val);
+}
+
+static void geoTtlRefDestructor(void *privdata, void *val) {
+    struct geoTtlKeyRef *ref = val;
+    decrRefCount(ref->key);
+    zfree(ref);
+}
+
+static dictType geoTtlKeyDictType = {
+    geoTtlHash,          /* hash function */
+    NULL,                /* key dup */
+    NULL,                /* val dup */
+    geoTtlKeyCompare,    /* key compare */
+    geoTtlSdsDestructor, /* key destructor */
+    geoTtlRefDestructor  /* val destructor */
+};
+
+/* ====================================================================
+ * Helpers
+ * ==================================================================== */
+/* Companion zset holding expire times of 'key' */
+static robj *geoTtlKey(robj *key) {
+    robj *decoded = getDecodedObject(key);
+    sds name = sdsnewlen("__geottl:", 9);
+    name = sdscatsds(name, decoded->ptr);
+    decrRefCount(decoded);
+    return createObject(REDIS_STRING, name);
+}
+
+static sds geoTtlKeyId(redisDb *db, robj *key) {
+    robj *decoded = getDecodedObject(key);
+    sds keyid = sdsfromlonglong(db->id);
+    keyid = sdscatlen(keyid, ":", 1);
+    keyid = sdscatsds(keyid, decoded->ptr);
+    decrRefCount(decoded);
+    return keyid;
+}
+
+/* Remember 'key' so the cron can find it */
+static void geoTtlTrack(redisDb *db, robj *key) {
+    sds keyid = geoTtlKeyId(db, key);
+    if (dictFind(ttl.keys, keyid)) {
+        sdsfree(keyid);
+        return;
+    }
+
+    struct geoTtlKeyRef *ref = zmalloc(sizeof(*ref));
+    ref->dbid = db->id;
+    ref->key = dupStringObject(key);
+    dictAdd(ttl.keys, keyid, ref);
+}
+
+/* Run 'proc' with [cmd, zkey, argv...] on our fake client and propagate
+ * it as 'rcmd' if it changed anything.  'argv' holds 'count' arguments taken
+ * every 'stride' entries.  If 'score' isn't NULL, it's inserted before
+ * every argument (for zadd). */
+static void geoTtlRun(redisDb *db, void (*proc)(redisClient *c),
+                      struct redisCommand *rcmd, robj *cmd, robj *zkey,
+                      robj *score, robj **argv, int stride, int count) {
+    redisClient *client = ttl.client;
+    long long dirty = server.dirty;
+    int per = score ? 2 : 1;
+
+    selectDb(client, db->id);
+    client->argc = 0;
+    client->argv = zmalloc(sizeof(robj *) * (2 + count * per));
+    client->argv[client->argc++] = cmd;
+    client->argv[client->argc++] = zkey;
+    for (int i = 0; i < count; i++) {
+        if (score)
+            client->argv[client->argc++] = score;
+        client->argv[client->argc++] = argv[i * stride];
+    }
+
+    for (int i = 0; i < client->argc; i++)
+        incrRefCount(client->argv[i]);
+
+    proc(client);
+
+    if (server.dirty != dirty)
+        propagate(rcmd, db->id, client->argv, client->argc,
+                  REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+
+    /* proc may have swapped argv entries for encoded versions */
+    for (int i = 0; i < client->argc; i++)
+        decrRefCount(client->argv[i]);
+    zfree(client->argv);
+    client->argv = NULL;
+    client->argc = 0;
+}
+
+/* ====================================================================
+ * Setting / Clearing
+ * ==================================================================== */
+/* Writes to the companion zset are propagated on their own, so we don't
+ * count them as changes of the command causing them. */
+void geoTtlSet(redisDb *db, robj *key, robj **members, int stride, int count,
+               long long when) {
+    long long dirty = server.dirty;
+    robj *ttlkey = geoTtlKey(key);
+    robj *score = createStringObjectFromLongLong(when);
+
+    geoTtlRun(db, zaddCommand, ttl.zadd, ttl.zaddcmd, ttlkey, score, members,
+              stride, count);
+    geoTtlTrack(db, key);
+
+    decrRefCount(score);
+    decrRefCount(ttlkey);
+    server.dirty = dirty;
+}
+
+bool geoTtlExists(redisDb *db, robj *key) {
+    robj *ttlkey = geoTtlKey(key);
+    bool exists = lookupKeyWrite(db, ttlkey) != NULL;
+    decrRefCount(ttlkey);
+    return exists;
+}
+
+/* Members written without EX lose any previous expire time. */
+void geoTtlClear(redisDb *db, robj *key, robj **members, int stride,
+                 int count) {
+    robj *ttlkey = geoTtlKey(key);
+
+    if (lookupKeyWrite(db, ttlkey)) {
+        long long dirty = server.dirty;
+        geoTtlRun(db, zremCommand, ttl.zrem, ttl.zremcmd, ttlkey, NULL,
+                  members, stride, count);
+        server.dirty = dirty;
+    }
+
+    decrRefCount(ttlkey);
+}
+
+/* Drop every expire time of 'key'.  Used by commands replacing the whole
+ * key, which aren't propagated verbatim, so we propagate the DEL ourselves. */
+void geoTtlDelete(redisDb *db, robj *key) {
+    robj *ttlkey = geoTtlKey(key);
+
+    if (dbDelete(db, ttlkey)) {
+        robj *argv[2] = {ttl.delcmd, ttlkey};
+        propagate(ttl.del, db->id, argv, 2,
+                  REDIS_PROPAGATE_AOF | REDIS_PROPAGATE_REPL);
+    }
+
+    decrRefCount(ttlkey);
+}
+
+/* ====================================================================
+ * Reaping
+ * ==================================================================== */
+/* ZREM 'members' from 'zkey' and propagate the ZREM if anything changed. */
+static void geoTtlRemove(redisDb *db, robj *zkey, robj **members, int count) {
+    geoTtlRun(db, zremCommand, ttl.zrem, ttl.zremcmd, zkey, NULL, members, 1,
+              count);
+}
+
+long geoTtlReap(redisDb *db, robj *key, long max) {
+    /* Replicas wait for the master to propagate removals */
+    if (server.masterhost || server.loading || max <= 0)
+        return 0;
+
+    robj *ttlkey = geoTtlKey(key);
+    robj *ttlobj = lookupKeyWrite(db, ttlkey);
+    if (!ttlobj || ttlobj->type != REDIS_ZSET) {
+        decrRefCount(ttlkey);
+        return 0;
+    }
+
+    /* The key has TTLs even if we didn't set them since loading */
+    geoTtlTrack(db, key);
+
+    /* geozrangebyscore excludes max, so ask for everything <= now */
+    list *expired = geozrangebyscore(ttlobj, 0, mstime() + 1, max);
+    long removed = expired ? listLength(expired) : 0;
+
+    if (removed) {
+        robj *members[removed];
+        listIter li;
+        listNode *ln;
+        int i = 0;
+
+        listRewind(expired, &li);
+        while ((ln = listNext(&li))) {
+            struct zipresult *zr = listNodeValue(ln);
+            if (zr->type == ZR_LONG)
+                members[i++] = createStringObjectFromLongLong(zr->val.v);
+            else
+                members[i++] = createStringObject(zr->val.s,
+                                                  sdslen(zr->val.s));
+        }
+
+        /* We propagate our own ZREMs.  Don't let the command we're
+         * running on behalf of get propagated because of us. */
+        long long dirty = server.dirty;
+        geoTtlRemove(db, key, members, removed);
+        geoTtlRemove(db, ttlkey, members, removed);
+        server.dirty = dirty;
+
+        for (i = 0; i < removed; i++)
+            decrRefCount(members[i]);
+
+        geoCacheKeyModified(db, key);
+    }
+
+    if (expired)
+        listRelease(expired);
+    decrRefCount(ttlkey);
+    return removed;
+}
+
+/* ====================================================================
+ * Read-time Expiry
+ * ==================================================================== */
+bool geoTtlViewInit(redisDb *db, robj *key, struct geoTtlView *view) {
+    robj *ttlkey = geoTtlKey(key);
+    view->ttlobj = lookupKey(db, ttlkey);
+    view->now = mstime();
+    decrRefCount(ttlkey);
+
+    if (view->ttlobj && view->ttlobj->type != REDIS_ZSET)
+        view->ttlobj = NULL;
+
+    /* Let the cron remove what this read skips */
+    if (view->ttlobj)
+        geoTtlTrack(db, key);
+
+    return view->ttlobj != NULL;
+}
+
+bool geoTtlExpiredObject(struct geoTtlView *view, robj *member) {
+    double when;
+    return view->ttlobj && zsetScore(view->ttlobj, member, &when) &&
+           when <= view->now;
+}
+
+bool geoTtlExpired(struct geoTtlView *view, unsigned char *str,
+                   unsigned int len, long long vlong) {
+    if (!view->ttlobj)
+        return false;
+
+    if (!ttl.member)
+        ttl.member = sdsempty();
+
+    if (str) {
+        ttl.member = sdscpylen(ttl.member, (char *)str, len);
+    } else {
+        char buf[32];
+        int n = ll2string(buf, sizeof(buf), vlong);
+        ttl.member = sdscpylen(ttl.member, buf, n);
+    }
+
+    robj member;
+    initStaticStringObject(member, ttl.member);
+    return geoTtlExpiredObject(view, &member);
+}
+
+/* Reap random keys until we run out of budget or sampled enough keys. */
+static int geoTtlCron(struct aeEventLoop *el, long long id, void *privdata) {
+    if (server.masterhost || server.loading)
+        return 1000 / GEO_TTL_CRON_HZ;
+
+    long budget = GEO_TTL_REAP_PER_CRON;
+    for (int i = 0; i < GEO_TTL_KEYS_PER_CRON && budget > 0; i++) {
+        if (!dictSize(ttl.keys))
+            break;
+
+        dictEntry *de = dictGetRandomKey(ttl.keys);
+        struct geoTtlKeyRef *ref = dictGetVal(de);
+        redisDb *db = server.db + ref->dbid;
+
+        budget -= geoTtlReap(db, ref->key, budget);
+
+        /* The geo key was deleted (or emptied by reaping): its expire times
+         * must not carry over to a new key of the same name. */
+        if (!lookupKeyWrite(db, ref->key))
+            geoTtlDelete(db, ref->key);
+
+        /* Forget keys without any TTLs left */
+        robj *ttlkey = geoTtlKey(ref->key);
+        if (!lookupKeyWrite(db, ttlkey))
+            dictDelete(ttl.keys, dictGetKey(de));
+        decrRefCount(ttlkey);
+    }
+
+    return 1000 / GEO_TTL_CRON_HZ;
+}
+
+/* ====================================================================
+ * Bring up / Teardown
+ * ==================================================================== */
+void geoTtlInit(void) {
+    ttl.keys = dictCreate(&geoTtlKeyDictType, NULL);
+    ttl.client = createClient(-1);
+    ttl.zadd = lookupCommandByCString("zadd");
+    ttl.zrem = lookupCommandByCString("zrem");
+    ttl.del = lookupCommandByCString("del");
+    ttl.zaddcmd = createStringObject("zadd", 4);
+    ttl.zremcmd = createStringObject("zrem", 4);
+    ttl.delcmd = createStringObject("del", 3);
+    ttl.cron_id = aeCreateTimeEvent(server.el, 1000 / GEO_TTL_CRON_HZ,
+                                    geoTtlCron, NULL, NULL);
+}
+
+void geoTtlFree(void) {
+    aeDeleteTimeEvent(server.el, ttl.cron_id);
+    dictRelease(ttl.keys);
+    freeClient(ttl.client);
+    decrRefCount(ttl.zaddcmd);
+    decrRefCount(ttl.zremcmd);
+    decrRefCount(ttl.delcmd);
+    sdsfree(ttl.member);
+    memset(&ttl, 0, sizeof(ttl));
+}
@@ -0,0 +1,47 @@
+#ifndef __GEOTTL_H__
+#define __GEOTTL_H__
+
+#include "redis.h"
+#include <stdbool.h>
+
+/* Most expired members a write command removes from the key it writes */
+#define GEO_TTL_REAP_PER_COMMAND 16
+
+/* Expire times of one key as seen by a read.  Reads never remove expired
+ * members (they may run on replicas and aren't propagated); they skip
+ * them. */
+struct geoTtlView {
+    robj *ttlobj; /* companion zset or NULL if no member has a TTL */
+    long long now;
+};
+
+/* Bring up / Teardown (called from module load/cleanup) */
+void geoTtlInit(void);
+void geoTtlFree(void);
+
+/* Does any member of 'key' have an expire time? */
+bool geoTtlExists(redisDb *db, robj *key);
+
+/* Set or clear expire times of 'count' members found every 'stride'
+ * entries of 'members' */
+void geoTtlSet(redisDb *db, robj *key, robj **members, int stride, int count,
+               long long when);
+void geoTtlClear(redisDb *db, robj *key, robj **members, int stride,
+                 int count);
+
+/* Drop every expire time of 'key' (propagates a DEL of the companion) */
+void geoTtlDelete(redisDb *db, robj *key);
+
+/* Remove at most 'max' expired members of 'key'.  Returns members removed.
+ * Only for write commands; reads use a geoTtlView. */
+long geoTtlReap(redisDb *db, robj *key, long max);
+
+/* Returns false (and nothing needs skipping) if 'key' has no TTLs */
+bool geoTtlViewInit(redisDb *db, robj *key, struct geoTtlView *view);
+
+/* Has the member (a string, or 'vlong' if 'str' is NULL) expired? */
+bool geoTtlExpired(struct geoTtlView *view, unsigned char *str,
+                   unsigned int len, long long vlong);
+bool geoTtlExpiredObject(struct geoTtlView *view, robj *member);
+
+#endif
@@ -0,0 +1,870 @@
+#define _GNU_SOURCE /* provides getaddrinfo() and getopt() on Linux */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* ====================================================================
+ * geo-loadgen: closed-loop geo command load generator
+ * ====================================================================
+ * Replays a mix of fleet traffic against a running server:
+ *   - add: GEOADD key MOVE <threshold> m lat long member (a vehicle
+ *     reporting its new position after a short random walk)
+ *   - radius: GEORADIUS key lat long <radius> km around a demand point
+ *   - member: GEORADIUSBYMEMBER key member <radius> km of a vehicle
+ *
+ * Vehicles and demand are spread over cities whose popularity follows a
+ * Zipf distribution, so a few cities hold most of the fleet and get most
+ * of the searches, like real fleets do.
+ *
+ * Every connection keeps 'pipeline' requests in flight and sends a new one
+ * as soon as a reply arrives (closed loop).  Latency is measured from
+ * queueing a request to reading its reply, so it includes waiting behind
+ * the rest of the pipeline.  We report throughput and p50/p99/p999/max per
+ * command.
+ *
+ * Build with: make geo-loadgen (then ./geo-loadgen -h for options) */
+
+#define LOADGEN_BUFFER 65536
+#define LOADGEN_PRELOAD_BATCH 256
+#define LOADGEN_MAX_RADII 16
+#define LOADGEN_REPLY_DEPTH 8 /* deepest nesting of multi-bulk replies */
+#define LAT_MAX 85.05112878
+#define METERS_PER_DEGREE 111319.49
+
+enum loadgenOp { OP_ADD = 0, OP_RADIUS, OP_MEMBER, OP_COUNT };
+
+static const char *op_names[OP_COUNT] = {"geoadd", "georadius",
+                                         "georadiusbymember"};
+
+/* Latencies in microseconds go into log-linear buckets: exact below
+ * LATENCY_LINEAR us, then LATENCY_SUB buckets per power of two (under
+ * 0.2% error), up to about 2^34 us. */
+#define LATENCY_LINEAR 1024
+#define LATENCY_SUB 512
+#define LATENCY_POWERS 26
+#define LATENCY_BUCKETS (LATENCY_LINEAR + LATENCY_POWERS * LATENCY_SUB)
+
+struct latency {
+    uint64_t count;
+    uint64_t errors;
+    uint64_t max;
+    double sum;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
+struct pending {
+    enum loadgenOp op;
+    long long queued_us;
+};
+
+struct conn {
+    int fd;
+    char *wbuf;
+    size_t wlen, wpos, wcap;
+    char *rbuf;
+    size_t rlen, rcap;
+    /* Progress through the partial reply at the front of rbuf, so each
+     * read parses only new bytes: 'rpos' bytes are complete elements and
+     * 'rpending' holds the elements left of each open multi-bulk. */
+    size_t rpos;
+    long rpending[LOADGEN_REPLY_DEPTH];
+    int rdepth;
+    struct pending *queue; /* ring of 'pipeline' in-flight requests */
+    int head;
+    int inflight;
+};
+
+struct city {
+    double latitude;
+    double longitude;
+};
+
+static struct {
+    const char *host;
+    int port;
+    const char *socket;
+    const char *key;
+    int connections;
+    int pipeline;
+    int duration;
+    long long requests;
+    long vehicles;
+    int cities;
+    double skew;
+    double spread; /* city radius (sigma) in meters */
+    double step;   /* meters a vehicle moves between updates */
+    double move_threshold;
+    bool move;
+    bool preload;
+    int mix[OP_COUNT];
+    double radii[LOADGEN_MAX_RADII];
+    int radius_count;
+} config = {.host = "127.0.0.1",
+            .port = 6379,
+            .key = "fleet",
+            .connections = 8,
+            .pipeline = 16,
+            .duration = 10,
+            .vehicles = 100000,
+            .cities = 64,
+            .skew = 1.0,
+            .spread = 8000,
+            .step = 30,
+            .move = true,
+            .preload = true,
+            .mix = {80, 15, 5},
+            .radii = {0.5, 1, 5},
+            .radius_count = 3};
+
+static struct {
+    struct city *cities;
+    double *city_cdf;
+    double *latitude; /* per vehicle */
+    double *longitude;
+    struct latency latency[OP_COUNT];
+    char *first_error[OP_COUNT];
+} lg;
+
+/* ====================================================================
+ * Random numbers (xorshift64*, reproducible across platforms)
+ * ==================================================================== */
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dULL;
+}
+
+static double uniform(double lo, double hi) {
+    return lo + (hi - lo) * ((rng() >> 11) * (1.0 / 9007199254740992.0));
+}
+
+static double gaussian(void) {
+    double u = uniform(1e-12, 1), v = uniform(0, 1);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+static double clamp(double v, double lo, double hi) {
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static long long ustime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size);
+    if (!p) {
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+static void *xrealloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* ====================================================================
+ * Fleet model
+ * ==================================================================== */
+/* City 'rank' is chosen with probability proportional to 1/rank^skew */
+static struct city *pickCity(void) {
+    double u = uniform(0, 1);
+    int lo = 0, hi = config.cities - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (lg.city_cdf[mid] < u)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lg.cities + lo;
+}
+
+/* Move 'latitude', 'longitude' by a gaussian offset of 'meters' */
+static void jitter(double *latitude, double *longitude, double meters) {
+    double dlat = gaussian() * meters / METERS_PER_DEGREE;
+    double dlong = gaussian() * meters /
+                   (METERS_PER_DEGREE *
+                    fmax(cos(*latitude * M_PI / 180), 0.01));
+    *latitude = clamp(*latitude + dlat, -LAT_MAX, LAT_MAX);
+    *longitude = clamp(*longitude + dlong, -180, 180);
+}
+
+static void pointNearCity(double *latitude, double *longitude) {
+    struct city *city = pickCity();
+    *latitude = city->latitude;
+    *longitude = city->longitude;
+    jitter(latitude, longitude, config.spread);
+}
+
+static void fleetInit(void) {
+    lg.cities = xmalloc(sizeof(*lg.cities) * config.cities);
+    lg.city_cdf = xmalloc(sizeof(*lg.city_cdf) * config.cities);
+
+    double total = 0;
+    for (int i = 0; i < config.cities; i++) {
+        lg.cities[i].latitude = uniform(-60, 60);
+        lg.cities[i].longitude = uniform(-180, 180);
+        total += 1 / pow(i + 1, config.skew);
+        lg.city_cdf[i] = total;
+    }
+    for (int i = 0; i < config.cities; i++)
+        lg.city_cdf[i] /= total;
+
+    lg.latitude = xmalloc(sizeof(*lg.latitude) * config.vehicles);
+    lg.longitude = xmalloc(sizeof(*lg.longitude) * config.vehicles);
+    for (long i = 0; i < config.vehicles; i++)
+        pointNearCity(lg.latitude + i, lg.longitude + i);
+}
+
+/* ====================================================================
+ * Latency histograms
+ * ==================================================================== */
+static int latencyBucket(uint64_t us) {
+    if (us < LATENCY_LINEAR)
+        return us;
+
+    /* Shift 'us' down to [LATENCY_SUB, 2 * LATENCY_SUB) */
+    int shift = 0;
+    while ((us >> shift) >= 2 * LATENCY_SUB)
+        shift++;
+
+    if (shift > LATENCY_POWERS)
+        return LATENCY_BUCKETS - 1;
+    return LATENCY_LINEAR + (shift - 1) * LATENCY_SUB +
+           (int)((us >> shift) - LATENCY_SUB);
+}
+
+/* Upper bound of bucket 'b' in us */
+static uint64_t latencyBucketValue(int b) {
+    if (b < LATENCY_LINEAR)
+        return b;
+
+    int shift = (b - LATENCY_LINEAR) / LATENCY_SUB + 1;
+    uint64_t sub = (b - LATENCY_LINEAR) % LATENCY_SUB + LATENCY_SUB;
+    return ((sub + 1) << shift) - 1;
+}
+
+static void latencyRecord(struct latency *l, uint64_t us) {
+    l->count++;
+    l->sum += us;
+    if (us > l->max)
+        l->max = us;
+    l->buckets[latencyBucket(us)]++;
+}
+
+static uint64_t latencyPercentile(struct latency *l, double p) {
+    uint64_t rank = (uint64_t)ceil(p * l->count), seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += l->buckets[b];
+        if (seen >= rank && seen)
+            return latencyBucketValue(b) < l->max ? latencyBucketValue(b)
+                                                  : l->max;
+    }
+    return l->max;
+}
+
+/* ====================================================================
+ * Connections and protocol
+ * ==================================================================== */
+static int connectServer(void) {
+    int fd;
+
+    if (config.socket) {
+        struct sockaddr_un sa = {.sun_family = AF_UNIX};
+        strncpy(sa.sun_path, config.socket, sizeof(sa.sun_path) - 1);
+        if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+            connect(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+            perror(config.socket);
+            exit(EXIT_FAILURE);
+        }
+        return fd;
+    }
+
+    char port[16];
+    struct addrinfo hints = {.ai_family = AF_UNSPEC,
+                             .ai_socktype = SOCK_STREAM},
+                    *servinfo, *p;
+    snprintf(port, sizeof(port), "%d", config.port);
+    int rv = getaddrinfo(config.host, port, &hints, &servinfo);
+    if (rv) {
+        fprintf(stderr, "%s: %s\n", config.host, gai_strerror(rv));
+        exit(EXIT_FAILURE);
+    }
+
+    for (p = servinfo; p; p = p->ai_next) {
+        if ((fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+            continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        close(fd);
+    }
+    freeaddrinfo(servinfo);
+
+    if (!p) {
+        fprintf(stderr, "Could not connect to %s:%d: %s\n", config.host,
+                config.port, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    return fd;
+}
+
+static void connInit(struct conn *c) {
+    memset(c, 0, sizeof(*c));
+    c->fd = connectServer();
+    c->wcap = c->rcap = LOADGEN_BUFFER;
+    c->wbuf = xmalloc(c->wcap);
+    c->rbuf = xmalloc(c->rcap);
+    c->queue = xmalloc(sizeof(*c->queue) * config.pipeline);
+}
+
+static void connFree(struct conn *c) {
+    close(c->fd);
+    free(c->wbuf);
+    free(c->rbuf);
+    free(c->queue);
+}
+
+static void connAppend(struct conn *c, const char *buf, size_t len) {
+    if (c->wlen + len > c->wcap) {
+        while (c->wlen + len > c->wcap)
+            c->wcap *= 2;
+        c->wbuf = xrealloc(c->wbuf, c->wcap);
+    }
+    memcpy(c->wbuf + c->wlen, buf, len);
+    c->wlen += len;
+}
+
+/* Append one command in the unified request protocol */
+static void connCommand(struct conn *c, int argc, char **argv) {
+    char header[32];
+    connAppend(c, header, snprintf(header, sizeof(header), "*%d\r\n", argc));
+    for (int i = 0; i < argc; i++) {
+        size_t len = strlen(argv[i]);
+        connAppend(c, header,
+                   snprintf(header, sizeof(header), "$%zu\r\n", len));
+        connAppend(c, argv[i], len);
+        connAppend(c, "\r\n", 2);
+    }
+}
+
+/* Returns false on a write error */
+static bool connFlush(struct conn *c) {
+    while (c->wpos < c->wlen) {
+        ssize_t n = write(c->fd, c->wbuf + c->wpos, c->wlen - c->wpos);
+        if (n == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                return true;
+            return false;
+        }
+        c->wpos += n;
+    }
+    c->wpos = c->wlen = 0;
+    return true;
+}
+
+/* Length of the complete reply at rbuf + 'start', 0 if we haven't read all
+ * of it yet or -1 if it's malformed.  Parsing resumes where the previous
+ * call stopped, so a large reply arriving over many reads is parsed once. */
+static long replyParse(struct conn *c, size_t start) {
+    const char *p = c->rbuf + start;
+    size_t len = c->rlen - start;
+
+    do {
+        size_t pos = c->rpos;
+        const char *cr = pos < len ? memchr(p + pos, '\r', len - pos) : NULL;
+        if (!cr || (size_t)(cr - p) + 2 > len)
+            return 0;
+        size_t line = cr - p + 2;
+        long n;
+
+        switch (p[pos]) {
+        case '+':
+        case '-':
+        case ':':
+            pos = line;
+            break;
+        case '$':
+            n = strtol(p + pos + 1, NULL, 10);
+            if (n >= 0 && line + n + 2 > len)
+                return 0;
+            pos = n < 0 ? line : line + n + 2;
+            break;
+        case '*':
+            n = strtol(p + pos + 1, NULL, 10);
+            pos = line;
+            if (n > 0) {
+                if (c->rdepth == LOADGEN_REPLY_DEPTH)
+                    return -1;
+                c->rpending[c->rdepth++] = n;
+                c->rpos = pos;
+                continue;
+            }
+            break;
+        default:
+            return -1;
+        }
+
+        /* One more element done, which may finish its enclosing replies */
+        c->rpos = pos;
+        while (c->rdepth && --c->rpending[c->rdepth - 1] == 0)
+            c->rdepth--;
+    } while (c->rdepth);
+
+    long length = c->rpos;
+    c->rpos = 0;
+    return length;
+}
+
+/* Read what's available and account every complete reply.  Returns false
+ * on a read or protocol error. */
+static bool connRead(struct conn *c) {
+    if (c->rcap - c->rlen < LOADGEN_BUFFER / 2) {
+        c->rcap *= 2;
+        c->rbuf = xrealloc(c->rbuf, c->rcap);
+    }
+
+    ssize_t n = read(c->fd, c->rbuf + c->rlen, c->rcap - c->rlen);
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR))
+        return false;
+    if (n > 0)
+        c->rlen += n;
+
+    size_t offset = 0;
+    long long now = ustime();
+    while (c->inflight) {
+        long len = replyParse(c, offset);
+        if (len < 0)
+            return false;
+        if (len == 0)
+            break;
+
+        struct pending *p = c->queue + c->head;
+        struct latency *l = lg.latency + p->op;
+        latencyRecord(l, now - p->queued_us);
+        if (c->rbuf[offset] == '-') {
+            l->errors++;
+            if (!lg.first_error[p->op])
+                lg.first_error[p->op] = strndup(
+                    c->rbuf + offset + 1, strcspn(c->rbuf + offset, "\r") - 1);
+        }
+
+        c->head = (c->head + 1) % config.pipeline;
+        c->inflight--;
+        offset += len;
+    }
+
+    memmove(c->rbuf, c->rbuf + offset, c->rlen - offset);
+    c->rlen -= offset;
+    return true;
+}
+
+/* ====================================================================
+ * Traffic
+ * ==================================================================== */
+static enum loadgenOp pickOp(void) {
+    int total =
+        config.mix[OP_ADD] + config.mix[OP_RADIUS] + config.mix[OP_MEMBER];
+    int u = rng() % total;
+    for (int i = 0; i < OP_COUNT; i++) {
+        if (u < config.mix[i])
+            return i;
+        u -= config.mix[i];
+    }
+    return OP_ADD;
+}
+
+static void queueRequest(struct conn *c) {
+    enum loadgenOp op = pickOp();
+    char latitude[32], longitude[32], member[32], radius[32], threshold[32];
+    long vehicle = rng() % config.vehicles;
+    char *argv[10];
+    int argc = 0;
+
+    snprintf(member, sizeof(member), "v%ld", vehicle);
+    snprintf(radius, sizeof(radius), "%g",
+             config.radii[rng() % config.radius_count]);
+
+    switch (op) {
+    case OP_ADD:
+        jitter(lg.latitude + vehicle, lg.longitude + vehicle, config.step);
+        snprintf(latitude, sizeof(latitude), "%.7f", lg.latitude[vehicle]);
+        snprintf(longitude, sizeof(longitude), "%.7f", lg.longitude[vehicle]);
+        argv[argc++] = "geoadd";
+        argv[argc++] = (char *)config.key;
+        if (config.move) {
+            snprintf(threshold, sizeof(threshold), "%g", config.move_threshold);
+            argv[argc++] = "move";
+            argv[argc++] = threshold;
+            argv[argc++] = "m";
+        }
+        argv[argc++] = latitude;
+        argv[argc++] = longitude;
+        argv[argc++] = member;
+        break;
+    case OP_RADIUS: {
+        double lat, lng;
+        pointNearCity(&lat, &lng);
+        snprintf(latitude, sizeof(latitude), "%.7f", lat);
+        snprintf(longitude, sizeof(longitude), "%.7f", lng);
+        argv[argc++] = "georadius";
+        argv[argc++] = (char *)config.key;
+        argv[argc++] = latitude;
+        argv[argc++] = longitude;
+        argv[argc++] = radius;
+        argv[argc++] = "km";
+        break;
+    }
+    case OP_MEMBER:
+    default:
+        argv[argc++] = "georadiusbymember";
+        argv[argc++] = (char *)config.key;
+        argv[argc++] = member;
+        argv[argc++] = radius;
+        argv[argc++] = "km";
+        break;
+    }
+
+    connCommand(c, argc, argv);
+    struct pending *p = c->queue + (c->head + c->inflight) % config.pipeline;
+    p->op = op;
+    p->queued_us = ustime();
+    c->inflight++;
+}
+
+/* Blocking: wait for every reply of 'c' */
+static void drain(struct conn *c) {
+    while (c->wlen && connFlush(c))
+        ;
+    while (c->inflight) {
+        if (!connRead(c)) {
+            fprintf(stderr, "Connection lost while preloading\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* GEOADD every vehicle's starting position */
+static void preload(void) {
+    struct conn c;
+    int pipeline = config.pipeline;
+    config.pipeline = 1;
+    connInit(&c);
+
+    char **argv = xmalloc(sizeof(*argv) * (2 + LOADGEN_PRELOAD_BATCH * 3));
+    char *strings = xmalloc(LOADGEN_PRELOAD_BATCH * 3 * 32);
+
+    for (long first = 0; first < config.vehicles;
+         first += LOADGEN_PRELOAD_BATCH) {
+        int argc = 0;
+        argv[argc++] = "geoadd";
+        argv[argc++] = (char *)config.key;
+        for (long v = first;
+             v < config.vehicles && v < first + LOADGEN_PRELOAD_BATCH; v++) {
+            char *s = strings + (v - first) * 3 * 32;
+            snprintf(s, 32, "%.7f", lg.latitude[v]);
+            snprintf(s + 32, 32, "%.7f", lg.longitude[v]);
+            snprintf(s + 64, 32, "v%ld", v);
+            argv[argc++] = s;
+            argv[argc++] = s + 32;
+            argv[argc++] = s + 64;
+        }
+
+        connCommand(&c, argc, argv);
+        c.queue[0].op = OP_ADD;
+        c.queue[0].queued_us = ustime();
+        c.inflight = 1;
+        drain(&c);
+    }
+
+    free(argv);
+    free(strings);
+    connFree(&c);
+    config.pipeline = pipeline;
+
+    /* Preloading isn't part of the measured run */
+    memset(&lg.latency[OP_ADD], 0, sizeof(lg.latency[OP_ADD]));
+    free(lg.first_error[OP_ADD]);
+    lg.first_error[OP_ADD] = NULL;
+}
+
+static void run(void) {
+    struct conn *conns = xmalloc(sizeof(*conns) * config.connections);
+    struct pollfd *pfds = xmalloc(sizeof(*pfds) * config.connections);
+    long long issued = 0;
+    long long start = ustime();
+    long long deadline = start + config.duration * 1000000LL;
+    bool stopping = false;
+
+    for (int i = 0; i < config.connections; i++)
+        connInit(conns + i);
+
+    for (;;) {
+        long long now = ustime();
+        if ((config.requests && issued >= config.requests) ||
+            (!config.requests && now >= deadline))
+            stopping = true;
+
+        int inflight = 0;
+        for (int i = 0; i < config.connections; i++) {
+            struct conn *c = conns + i;
+            while (!stopping && c->inflight < config.pipeline &&
+                   (!config.requests || issued < config.requests)) {
+                queueRequest(c);
+                issued++;
+            }
+            if (c->wlen && !connFlush(c)) {
+                fprintf(stderr, "Write error: %s\n", strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+
+            inflight += c->inflight;
+            pfds[i].fd = c->fd;
+            pfds[i].events = POLLIN | (c->wlen ? POLLOUT : 0);
+            pfds[i].revents = 0;
+        }
+
+        if (stopping && !inflight)
+            break;
+
+        if (poll(pfds, config.connections, 100) == -1 && errno != EINTR) {
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < config.connections; i++) {
+            if ((pfds[i].revents & (POLLIN | POLLERR | POLLHUP)) &&
+                !connRead(conns + i)) {
+                fprintf(stderr, "Connection %d lost (read error, protocol "
+                                "error or server closed it)\n",
+                        i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    double elapsed = (ustime() - start) / 1e6;
+    uint64_t total = 0;
+
+    printf("%d connections, pipeline %d, %ld vehicles in %d cities "
+           "(skew %g), %.2f seconds\n",
+           config.connections, config.pipeline, config.vehicles,
+           config.cities, config.skew, elapsed);
+    printf("%-18s %10s %10s %8s %8s %8s %8s %8s %8s\n", "command", "requests",
+           "ops/sec", "errors", "mean", "p50", "p99", "p999", "max");
+    for (int i = 0; i < OP_COUNT; i++) {
+        struct latency *l = lg.latency + i;
+        total += l->count;
+        if (!l->count)
+            continue;
+        printf("%-18s %10" PRIu64 " %10.0f %8" PRIu64 " %8.0f %8" PRIu64
+               " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+               op_names[i], l->count, l->count / elapsed, l->errors,
+               l->sum / l->count, latencyPercentile(l, 0.50),
+               latencyPercentile(l, 0.99), latencyPercentile(l, 0.999),
+               l->max);
+    }
+    printf("%-18s %10" PRIu64 " %10.0f  (latencies in microseconds)\n",
+           "total", total, total / elapsed);
+
+    for (int i = 0; i < OP_COUNT; i++)
+        if (lg.first_error[i])
+            printf("first %s error: %s\n", op_names[i], lg.first_error[i]);
+
+    for (int i = 0; i < config.connections; i++)
+        connFree(conns + i);
+    free(conns);
+    free(pfds);
+}
+
+/* ====================================================================
+ * Options
+ * ==================================================================== */
+/* "add=80,radius=15,member=5" */
+static bool parseMix(char *spec) {
+    int mix[OP_COUNT] = {0};
+    char *saveptr, *item;
+    for (item = strtok_r(spec, ",", &saveptr); item;
+         item = strtok_r(NULL, ",", &saveptr)) {
+        char *eq = strchr(item, '=');
+        if (!eq)
+            return false;
+        *eq = '\0';
+        int weight = atoi(eq + 1);
+        if (!strcasecmp(item, "add"))
+            mix[OP_ADD] = weight;
+        else if (!strcasecmp(item, "radius"))
+            mix[OP_RADIUS] = weight;
+        else if (!strcasecmp(item, "member"))
+            mix[OP_MEMBER] = weight;
+        else
+            return false;
+        if (weight < 0)
+            return false;
+    }
+
+    if (mix[OP_ADD] + mix[OP_RADIUS] + mix[OP_MEMBER] <= 0)
+        return false;
+    memcpy(config.mix, mix, sizeof(mix));
+    return true;
+}
+
+/* "0.5,1,5" */
+static bool parseRadii(char *spec) {
+    char *saveptr, *item;
+    config.radius_count = 0;
+    for (item = strtok_r(spec, ",", &saveptr); item;
+         item = strtok_r(NULL, ",", &saveptr)) {
+        if (config.radius_count == LOADGEN_MAX_RADII)
+            return false;
+        double radius = strtod(item, NULL);
+        if (radius <= 0)
+            return false;
+        config.radii[config.radius_count++] = radius;
+    }
+    return config.radius_count > 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -H host       server host (default %s)\n"
+            "  -p port       server port (default %d)\n"
+            "  -s socket     unix socket instead of host/port\n"
+            "  -k key        geoset key (default %s)\n"
+            "  -c clients    connections (default %d)\n"
+            "  -P depth      requests in flight per connection (default %d)\n"
+            "  -d seconds    run time (default %d)\n"
+            "  -n requests   run for a number of requests instead\n"
+            "  -v vehicles   fleet size (default %ld)\n"
+            "  -C cities     cities (default %d)\n"
+            "  -z skew       Zipf exponent of city popularity (default %g)\n"
+            "  -S meters     city spread (default %g)\n"
+            "  -m mix        weights, e.g. add=80,radius=15,member=5\n"
+            "  -r radii      search radii in km, e.g. 0.5,1,5\n"
+            "  -t meters     GEOADD MOVE threshold (default %g)\n"
+            "  -M            plain GEOADD instead of GEOADD MOVE\n"
+            "  -x            don't preload the fleet\n"
+            "  -R seed       random seed\n",
+            prog, config.host, config.port, config.key, config.connections,
+            config.pipeline, config.duration, config.vehicles, config.cities,
+            config.skew, config.spread, config.move_threshold);
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "H:p:s:k:c:P:d:n:v:C:z:S:m:r:t:MxR:h")) !=
+           -1) {
+        switch (opt) {
+        case 'H':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = atoi(optarg);
+            break;
+        case 's':
+            config.socket = optarg;
+            break;
+        case 'k':
+            config.key = optarg;
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'P':
+            config.pipeline = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atoi(optarg);
+            break;
+        case 'n':
+            config.requests = atoll(optarg);
+            break;
+        case 'v':
+            config.vehicles = atol(optarg);
+            break;
+        case 'C':
+            config.cities = atoi(optarg);
+            break;
+        case 'z':
+            config.skew = strtod(optarg, NULL);
+            break;
+        case 'S':
+            config.spread = strtod(optarg, NULL);
+            break;
+        case 'm':
+            if (!parseMix(optarg)) {
+                fprintf(stderr,
+                        "Invalid mix: expected add=N,radius=N,member=N\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            if (!parseRadii(optarg)) {
+                fprintf(stderr, "Invalid radii: expected positive km, "
+                                "comma separated\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            config.move_threshold = strtod(optarg, NULL);
+            break;
+        case 'M':
+            config.move = false;
+            break;
+        case 'x':
+            config.preload = false;
+            break;
+        case 'R':
+            rng_state = strtoull(optarg, NULL, 10) | 1;
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    if (config.connections <= 0 || config.pipeline <= 0 ||
+        config.vehicles <= 0 || config.cities <= 0 ||
+        (config.duration <= 0 && config.requests <= 0) ||
+        config.move_threshold < 0) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    fleetInit();
+    if (config.preload)
+        preload();
+    run();
+
+    exit(EXIT_SUCCESS);
+}
@@ -1,6 +1,11 @@
 #include "redis.h"
+#include "geoasync.h"
+#include "geocache.h"
+#include "geofilter.h"
 #include "geohash_helper.h"
 #include "geojson.h"
+#include "geostats.h"
+#include "geottl.h"
 #include "geo.h"
 #include "zset.h"
 
@@ -8,12 +13,21 @@
  * Bring up / Teardown
  * ==================================================================== */
 void *load() {
+    geoCacheInit();
+    geoTtlInit();
+    geoAsyncInit();
+    geoStatsInit();
     return NULL;
 }
 
 /* If you reload the module *without* freeing things you allocate in load(),
  * then you *will* introduce memory leaks. */
 void cleanup(void *privdata) {
+    geoAsyncFree();
+    geoStatsFree();
+    geoTtlFree();
+    geoCacheFree();
+    geoFilterFree();
 }
 
 /* ====================================================================
@@ -31,10 +45,33 @@ struct redisModule redisModuleDetail = {
 struct redisCommand redisCommandTable[] = {
     {"geoadd", geoAddCommand, -5, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"georadius", geoRadiusCommand, -6, "r", 0, NULL, 1, 1, 1, 0, 0},
-    {"georadiusbymember", geoRadiusByMemberCommand, -5, "r", 0, NULL, 1, 1, 1,
-     0, 0},
+    {"georadiusbymember", geoRadiusByMemberCommand, -5, "r", 0, NULL, 1, 1,
+     1, 0, 0},
+    /* Keys are the destination, then the searched key */
+    {"georadiusstore", geoRadiusStoreCommand, -7, "wm", 0, NULL, 1, 2, 1, 0,
+     0},
+    {"georadiusbymemberstore", geoRadiusByMemberStoreCommand, -6, "wm", 0,
+     NULL, 1, 2, 1, 0, 0},
+    {"georadiusmulti", geoRadiusMultiCommand, -6, "r", 0, NULL, 1, 1, 1, 0,
+     0},
+    {"geoscan", geoScanCommand, -6, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"geoalong", geoAlongCommand, -8, "r", 0, NULL, 1, 1, 1, 0, 0},
+    {"geojoin", geoJoinCommand, -5, "r", 0, NULL, 1, 2, 1, 0, 0},
+    {"geodistmatrix", geoDistMatrixCommand, -4, "r", 0, NULL, 1, 1, 1, 0,
+     0},
+    {"geoaddbin", geoAddBinCommand, -3, "wm", 0, NULL, 1, 1, 1, 0, 0},
+    {"geoload", geoLoadCommand, -3, "wms", 0, NULL, 1, 1, 1, 0, 0},
+    {"geopartition", geoPartitionCommand, 3, "wm", 0, NULL, 1, 1, 1, 0, 0},
+    {"geofreeze", geoFreezeCommand, -2, "w", 0, NULL, 1, 1, 1, 0, 0},
+    {"geothaw", geoThawCommand, 2, "wm", 0, NULL, 1, 1, 1, 0, 0},
     {"geoencode", geoEncodeCommand, -3, "r", 0, NULL, 0, 0, 0, 0, 0},
     {"geodecode", geoDecodeCommand, -2, "r", 0, NULL, 0, 0, 0, 0, 0},
+    {"geocache", geoCacheCommand, -2, "a", 0, NULL, 0, 0, 0, 0, 0},
+    {"geostats", geoStatsCommand, -1, "r", 0, NULL, 0, 0, 0, 0, 0},
+    {"geostatsreset", geoStatsResetCommand, -1, "a", 0, NULL, 0, 0, 0, 0,
+     0},
+    {"geotrack", geoTrackCommand, -6, "wm", 0, NULL, 1, 1, 1, 0, 0},
+    {"geotrackrange", geoTrackRangeCommand, -5, "r", 0, NULL, 1, 1, 1, 0, 0},
     {0} /* Always end your command table with {0}
            * If you forget, you will be reminded with a segfault on load. */
 };
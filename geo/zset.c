@@ -1,8 +1,10 @@
 #include "zset.h"
+#include "geostats.h"
 
 /* t_zset.c prototypes (there's no t_zset.h) */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range);
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score);
+unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr);
 int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec);
 
 /* Converted from static in t_zset.c: */
@@ -24,7 +26,9 @@ bool zsetScore(robj *zobj, robj *member, double *score) {
         zset *zs = zobj->ptr;
         dictEntry *de;
 
-        member = tryObjectEncoding(member);
+        /* The zset dict hashes and compares both raw and integer encoded
+         * objects, so we don't need tryObjectEncoding() (which may free
+         * 'member' out from under our caller's argv). */
         de = dictFind(zs->dict, member);
         if (de != NULL) {
             *score = *(double *)dictGetVal(de);
@@ -36,6 +40,145 @@ bool zsetScore(robj *zobj, robj *member, double *score) {
     return true;
 }
 
+/* The element loop of zaddGenericCommand() in t_zset.c, for a raw
+ * (sds encoded) 'member'. */
+static bool zsetAddDecoded(robj *zobj, robj *member, double score,
+                           bool *changed) {
+    *changed = false;
+
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *eptr;
+        double curscore;
+
+        if ((eptr = zzlFind(zobj->ptr, member, &curscore)) != NULL) {
+            if (score != curscore) {
+                zobj->ptr = zzlDelete(zobj->ptr, eptr);
+                zobj->ptr = zzlInsert(zobj->ptr, member, score);
+                *changed = true;
+            }
+            return false;
+        }
+
+        zobj->ptr = zzlInsert(zobj->ptr, member, score);
+        if (zzlLength(zobj->ptr) > server.zset_max_ziplist_entries ||
+            sdslen(member->ptr) > server.zset_max_ziplist_value)
+            zsetConvert(zobj, REDIS_ENCODING_SKIPLIST);
+        *changed = true;
+        return true;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        zskiplistNode *znode;
+        dictEntry *de = dictFind(zs->dict, member);
+
+        if (de) {
+            robj *curobj = dictGetKey(de);
+            double curscore = *(double *)dictGetVal(de);
+
+            if (score != curscore) {
+                /* zslDelete() releases the skiplist's reference */
+                zslDelete(zs->zsl, curscore, curobj);
+                znode = zslInsert(zs->zsl, score, curobj);
+                incrRefCount(curobj);
+                dictGetVal(de) = &znode->score;
+                *changed = true;
+            }
+            return false;
+        }
+
+        znode = zslInsert(zs->zsl, score, member);
+        incrRefCount(member);
+        dictAdd(zs->dict, member, &znode->score);
+        incrRefCount(member);
+        *changed = true;
+        return true;
+    }
+
+    return false;
+}
+
+/* Add 'member' with 'score' without going through a client.  Returns true
+ * if the member is new.  Sets *changed if the zset changed. */
+bool zsetAdd(robj *zobj, robj *member, double score, bool *changed) {
+    /* The ziplist branch needs member->ptr to be an sds, but members built
+     * from ziplist integers (or shared integers) are INT encoded. */
+    member = getDecodedObject(member);
+    bool added = zsetAddDecoded(zobj, member, score, changed);
+    decrRefCount(member);
+    return added;
+}
+
+/* Remove 'member' without going through a client, following zremCommand().
+ * Returns true if the member existed. */
+bool zsetRemove(robj *zobj, robj *member) {
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *eptr;
+
+        if ((eptr = zzlFind(zobj->ptr, member, NULL)) == NULL)
+            return false;
+
+        zobj->ptr = zzlDelete(zobj->ptr, eptr);
+        return true;
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        dictEntry *de = dictFind(zs->dict, member);
+
+        if (!de)
+            return false;
+
+        double score = *(double *)dictGetVal(de);
+        zslDelete(zs->zsl, score, member);
+        dictDelete(zs->dict, member);
+        if (htNeedsResize(zs->dict))
+            dictResize(zs->dict);
+        return true;
+    }
+
+    return false;
+}
+
+/* Update the score of an existing skiplist member without removing and
+ * re-inserting its node.  This only works when the new score keeps the node
+ * ordered between its current neighbors.  Returns false (and changes nothing)
+ * if the member would have to move, doesn't exist, or zobj is a ziplist. */
+bool zsetUpdateScoreInPlace(robj *zobj, robj *member, double score) {
+    if (!zobj || zobj->encoding != REDIS_ENCODING_SKIPLIST)
+        return false;
+
+    zset *zs = zobj->ptr;
+    dictEntry *de = dictFind(zs->dict, member);
+    if (!de)
+        return false;
+
+    /* The dict key is the same object stored in the skiplist node */
+    robj *ele = dictGetKey(de);
+    double curscore = *(double *)dictGetVal(de);
+
+    /* Find the node: first node with our score, then walk equal scores. */
+    zrangespec range = {
+        .min = curscore, .max = curscore, .minex = 0, .maxex = 0};
+    zskiplistNode *x = zslFirstInRange(zs->zsl, &range);
+    while (x && x->score == curscore && x->obj != ele)
+        x = x->level[0].forward;
+
+    if (!x || x->obj != ele)
+        return false;
+
+    /* Equal scores are ordered by member, same as zslInsert() */
+    zskiplistNode *prev = x->backward;
+    zskiplistNode *next = x->level[0].forward;
+    if (prev && (prev->score > score ||
+                 (prev->score == score && compareStringObjects(prev->obj, ele) > 0)))
+        return false;
+
+    if (next && (next->score < score ||
+                 (next->score == score && compareStringObjects(next->obj, ele) < 0)))
+        return false;
+
+    /* The dict value points at x->score, so this updates both structures. */
+    x->score = score;
+    return true;
+}
+
 /* Largely extracted from genericZrangebyscoreCommand() in t_zset.c */
 /* The zrangebyscoreCommand expects to only operate on a live redisClient,
  * but we need results returned to us, not sent over an async socket. */
@@ -83,6 +226,7 @@ list *geozrangebyscore(robj *zobj, double min, double max, int limit) {
         zskiplist *zsl = zs->zsl;
         zskiplistNode *ln;
 
+        GEO_STATS_COUNT(descents, 1);
         if ((ln = zslFirstInRange(zsl, &range)) == NULL) {
             /* Nothing exists starting at our min.  No results. */
             return NULL;
@@ -113,6 +257,59 @@ list *geozrangebyscore(robj *zobj, double min, double max, int limit) {
     return l;
 }
 
+/* Call 'visit' for every member with min <= score < max in score order
+ * without building a result list.  Members are passed either as a string
+ * (str, len) or, if str is NULL, as an integer (vlong).  Stops early if
+ * 'visit' returns false.  Returns false if we stopped early. */
+bool geozrangeVisit(robj *zobj, double min, double max,
+                    zsetRangeVisitor *visit, void *privdata) {
+    zrangespec range = {.min = min, .max = max, .minex = 0, .maxex = 1};
+
+    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        unsigned char *zl = zobj->ptr;
+        unsigned char *eptr, *sptr;
+        unsigned char *vstr = NULL;
+        unsigned int vlen = 0;
+        long long vlong = 0;
+
+        if ((eptr = zzlFirstInRange(zl, &range)) == NULL)
+            return true;
+
+        sptr = ziplistNext(zl, eptr);
+        while (eptr) {
+            double score = zzlGetScore(sptr);
+            if (!zslValueLteMax(score, &range))
+                break;
+
+            ziplistGet(eptr, &vstr, &vlen, &vlong);
+            if (!visit(privdata, score, vstr, vlen, vlong))
+                return false;
+
+            zzlNext(zl, &eptr, &sptr);
+        }
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        zset *zs = zobj->ptr;
+        GEO_STATS_COUNT(descents, 1);
+        zskiplistNode *ln = zslFirstInRange(zs->zsl, &range);
+
+        while (ln && zslValueLteMax(ln->score, &range)) {
+            robj *o = ln->obj;
+            bool more;
+            if (o->encoding == REDIS_ENCODING_INT)
+                more = visit(privdata, ln->score, NULL, 0, (long)o->ptr);
+            else
+                more = visit(privdata, ln->score, o->ptr, sdslen(o->ptr), 0);
+
+            if (!more)
+                return false;
+
+            ln = ln->level[0].forward;
+        }
+    }
+
+    return true;
+}
+
 /* ====================================================================
  * Helpers
  * ==================================================================== */
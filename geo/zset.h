@@ -16,9 +16,18 @@ struct zipresult {
     char type;       /* access type for the union */
 };
 
+/* Range visitor: return false to stop visiting */
+typedef bool zsetRangeVisitor(void *privdata, double score, unsigned char *str,
+                              unsigned int len, long long vlong);
+
 /* Redis DB Access */
 bool zsetScore(robj *zobj, robj *member, double *score);
+bool zsetAdd(robj *zobj, robj *member, double score, bool *changed);
+bool zsetRemove(robj *zobj, robj *member);
+bool zsetUpdateScoreInPlace(robj *zobj, robj *member, double score);
 list *geozrangebyscore(robj *zobj, double min, double max, int limit);
+bool geozrangeVisit(robj *zobj, double min, double max,
+                    zsetRangeVisitor *visit, void *privdata);
 
 /* New list operation: append one list to another */
 void listJoin(list *join_to, list *join);
@@ -0,0 +1,637 @@
+#include "i_simd.h"
+#include "i_yajl.h"
+
+/* ====================================================================
+ * Structural Index JSON Decoding
+ * ====================================================================
+ * Documents are decoded in two passes, after simdjson:
+ *   1. Sixty-four bytes at a time, SSE2 compares turn quotes, backslashes,
+ *      {}[]:, and whitespace into bitmasks.  Escaped quotes and string
+ *      contents are masked off and what's left ({}[]:, outside strings,
+ *      opening quotes and the first byte of every number and literal) is
+ *      flattened into an index of offsets.  Blocks with bytes >= 0x80 are
+ *      checked for valid UTF-8 on the way; ASCII blocks cost nothing.
+ *      Blocks are indexed in batches as stage 2 needs them, so the index
+ *      is a fixed 16KB whatever the document's size.
+ *   2. One walk over the index builds the jsonObj tree directly, keeping
+ *      open containers on an explicit stack.  Strings are copied (and
+ *      unescaped) with SSE2 scans for the next quote or backslash.
+ *
+ * Only strict JSON is decoded here.  Anything else (comments, lone
+ * surrogate escapes, syntax errors) is handed to yajl_decode(), so trees
+ * and error messages are exactly what yajl gives.  Builds without SSE2
+ * always use yajl. */
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Bitmasks of one 64 byte block, bit i for byte i */
+struct simdBlock {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;    /* {}[]:, */
+    uint64_t space; /* ' ', \t, \n and \r */
+    uint64_t high;  /* bytes >= 0x80 */
+};
+
+/* ====================================================================
+ * Stage 1: Structural Index
+ * ==================================================================== */
+static void classifyBlock(const char *p, struct simdBlock *b) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i curly_open = _mm_set1_epi8('{');
+    const __m128i curly_close = _mm_set1_epi8('}');
+    const __m128i colon = _mm_set1_epi8(':');
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i lower = _mm_set1_epi8(0x20);
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+
+    memset(b, 0, sizeof(*b));
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+        /* [ and ] are { and } with bit 5 set */
+        __m128i folded = _mm_or_si128(v, lower);
+        __m128i op = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(folded, curly_open),
+                         _mm_cmpeq_epi8(folded, curly_close)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, colon), _mm_cmpeq_epi8(v, comma)));
+        __m128i ws = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, newline), _mm_cmpeq_epi8(v, cr)));
+        int shift = i * 16;
+
+        b->quote |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                        _mm_cmpeq_epi8(v, quote))
+                    << shift;
+        b->backslash |= (uint64_t)(uint16_t)_mm_movemask_epi8(
+                            _mm_cmpeq_epi8(v, backslash))
+                        << shift;
+        b->op |= (uint64_t)(uint16_t)_mm_movemask_epi8(op) << shift;
+        b->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(ws) << shift;
+        b->high |= (uint64_t)(uint16_t)_mm_movemask_epi8(v) << shift;
+    }
+}
+
+/* Bit i of the result is the xor of bits 0..i of 'x' */
+static inline uint64_t prefixXor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/* Bytes escaped by a backslash: the byte after every odd length run of
+ * backslashes.  '*carry' is set if the block's last byte escapes the next
+ * block's first byte. */
+static inline uint64_t findEscaped(uint64_t backslash, uint64_t *carry) {
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~*carry;
+    uint64_t follows_escape = backslash << 1 | *carry;
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t even_runs = odd_starts + backslash;
+    *carry = even_runs < odd_starts;
+    uint64_t invert = even_runs << 1;
+    return (even_bits ^ invert) & follows_escape;
+}
+
+/* Check UTF-8 from '*next' (a character boundary) through at least
+ * 'end'.  Sequences crossing 'end' are checked whole, so '*next' may end
+ * up past it. */
+static bool validUtf8(const unsigned char *s, size_t len, size_t *next,
+                      size_t end) {
+    size_t i = *next;
+
+    while (i < end) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+
+        uint32_t cp;
+        size_t n;
+        if (c >= 0xc2 && c <= 0xdf) {
+            n = 1;
+            cp = c & 0x1f;
+        } else if ((c & 0xf0) == 0xe0) {
+            n = 2;
+            cp = c & 0x0f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+            cp = c & 0x07;
+        } else {
+            return false;
+        }
+
+        if (len - i <= n)
+            return false;
+
+        for (size_t k = 1; k <= n; k++) {
+            if ((s[i + k] & 0xc0) != 0x80)
+                return false;
+            cp = cp << 6 | (s[i + k] & 0x3f);
+        }
+
+        /* No overlong forms, surrogates or code points past U+10FFFF */
+        if ((n == 2 && (cp < 0x800 || (cp >= 0xd800 && cp <= 0xdfff))) ||
+            (n == 3 && (cp < 0x10000 || cp > 0x10ffff)))
+            return false;
+
+        i += n + 1;
+    }
+
+    *next = i;
+    return true;
+}
+
+/* Stage 1 runs in batches of blocks just ahead of stage 2, so a document
+ * of any size is indexed in a fixed buffer of offsets. */
+#define INDEX_BATCH 4096 /* offsets; a block adds at most 64 */
+
+struct structuralIndex {
+    const char *json;
+    size_t len;
+    size_t base; /* next block to index */
+    uint64_t escape_carry, in_string_carry, scalar_carry;
+    size_t utf8_next;
+    bool failed; /* unterminated string or invalid UTF-8 */
+    size_t count, at;
+    uint32_t idx[INDEX_BATCH];
+};
+
+/* Index the next blocks into the (consumed) buffer.  Returns false at the
+ * end of the document or if it turned out invalid. */
+static bool indexStructurals(struct structuralIndex *ix) {
+    const char *json = ix->json;
+    size_t len = ix->len;
+    struct simdBlock b;
+    char tail[64];
+
+    ix->count = ix->at = 0;
+    if (ix->failed)
+        return false;
+
+    while (ix->base < len && ix->count + 64 <= INDEX_BATCH) {
+        size_t base = ix->base;
+        const char *p = json + base;
+        if (len - base < 64) {
+            /* Pad the last block with whitespace */
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, p, len - base);
+            p = tail;
+        }
+
+        classifyBlock(p, &b);
+
+        if (b.high) {
+            size_t end = len - base < 64 ? len : base + 64;
+            if (ix->utf8_next < base)
+                ix->utf8_next = base;
+            if (!validUtf8((const unsigned char *)json, len, &ix->utf8_next,
+                           end)) {
+                ix->failed = true;
+                ix->count = 0;
+                return false;
+            }
+        }
+
+        uint64_t escaped = findEscaped(b.backslash, &ix->escape_carry);
+        uint64_t quote = b.quote & ~escaped;
+
+        /* Opening quotes and string contents, but not closing quotes */
+        uint64_t in_string = prefixXor(quote) ^ ix->in_string_carry;
+        ix->in_string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+        /* Numbers and literals start after anything but their own bytes */
+        uint64_t scalar = ~(b.op | b.space | quote) & ~in_string;
+        uint64_t follows_scalar = scalar << 1 | ix->scalar_carry;
+        ix->scalar_carry = scalar >> 63;
+
+        uint64_t structurals = (b.op & ~in_string) | (quote & in_string) |
+                               (scalar & ~follows_scalar);
+        while (structurals) {
+            ix->idx[ix->count++] = base + __builtin_ctzll(structurals);
+            structurals &= structurals - 1;
+        }
+
+        ix->base += 64;
+    }
+
+    if (ix->base >= len && ix->in_string_carry) {
+        ix->failed = true;
+        ix->count = 0;
+    }
+
+    return ix->count > 0;
+}
+
+/* Offset of the next structural byte without consuming it.  Returns false
+ * at the end of the document (or if it's invalid, see 'failed'). */
+static inline bool peekStructural(struct structuralIndex *ix, size_t *pos) {
+    if (ix->at == ix->count && !indexStructurals(ix))
+        return false;
+
+    *pos = ix->idx[ix->at];
+    return true;
+}
+
+static inline bool nextStructural(struct structuralIndex *ix, size_t *pos) {
+    if (!peekStructural(ix, pos))
+        return false;
+
+    ix->at++;
+    return true;
+}
+
+/* ====================================================================
+ * Stage 2: Scalars
+ * ==================================================================== */
+/* Can a number or literal end at 'pos'? */
+static inline bool isTerminator(const char *json, size_t len, size_t pos) {
+    if (pos == len)
+        return true;
+
+    switch (json[pos]) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+    case ',':
+    case ':':
+    case ']':
+    case '}':
+    case '[':
+    case '{':
+        return true;
+    }
+
+    return false;
+}
+
+/* First quote, backslash or control character at or after 'p' */
+static const char *scanString(const char *p, const char *end) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        __m128i stop = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote),
+                         _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        int mask = _mm_movemask_epi8(stop);
+        if (mask)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+
+    while (p < end && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20)
+        p++;
+
+    return p;
+}
+
+static bool hex4(const char *p, uint32_t *value) {
+    *value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = p[i];
+        *value <<= 4;
+        if (c >= '0' && c <= '9')
+            *value |= c - '0';
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            *value |= (c | 0x20) - 'a' + 10;
+        else
+            return false;
+    }
+
+    return true;
+}
+
+static int utf8Encode(uint32_t cp, char *buf) {
+    if (cp < 0x80) {
+        buf[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        buf[0] = 0xc0 | (cp >> 6);
+        buf[1] = 0x80 | (cp & 0x3f);
+        return 2;
+    } else if (cp < 0x10000) {
+        buf[0] = 0xe0 | (cp >> 12);
+        buf[1] = 0x80 | ((cp >> 6) & 0x3f);
+        buf[2] = 0x80 | (cp & 0x3f);
+        return 3;
+    }
+
+    buf[0] = 0xf0 | (cp >> 18);
+    buf[1] = 0x80 | ((cp >> 12) & 0x3f);
+    buf[2] = 0x80 | ((cp >> 6) & 0x3f);
+    buf[3] = 0x80 | (cp & 0x3f);
+    return 4;
+}
+
+/* Unescape the string whose opening quote is at 'pos'.  Returns NULL if
+ * it's invalid (or has escapes we leave to yajl). */
+static sds parseString(const char *json, size_t len, size_t pos) {
+    const char *end = json + len;
+    const char *start = json + pos + 1;
+    const char *p = scanString(start, end);
+
+    /* Most strings have no escapes: one copy and we're done */
+    if (p < end && *p == '"')
+        return jsonObjSdsNewLen(start, p - start);
+
+    sds s = sdsnewlen(start, p - start);
+    while (p < end && *p == '\\') {
+        char buf[4];
+        int used = 1;
+        uint32_t cp, low;
+
+        if (end - p < 2)
+            break;
+
+        switch (p[1]) {
+        case '"':
+        case '\\':
+        case '/':
+            buf[0] = p[1];
+            break;
+        case 'b':
+            buf[0] = '\b';
+            break;
+        case 'f':
+            buf[0] = '\f';
+            break;
+        case 'n':
+            buf[0] = '\n';
+            break;
+        case 'r':
+            buf[0] = '\r';
+            break;
+        case 't':
+            buf[0] = '\t';
+            break;
+        case 'u':
+            if (end - p < 6 || !hex4(p + 2, &cp))
+                goto invalid;
+
+            if (cp >= 0xd800 && cp <= 0xdbff) {
+                /* Only complete surrogate pairs */
+                if (end - p < 12 || p[6] != '\\' || p[7] != 'u' ||
+                    !hex4(p + 8, &low) || low < 0xdc00 || low > 0xdfff)
+                    goto invalid;
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+                goto invalid;
+            }
+
+            used = utf8Encode(cp, buf);
+            p += 4;
+            break;
+        default:
+            goto invalid;
+        }
+
+        s = sdscatlen(s, buf, used);
+        p += 2;
+
+        const char *run = p;
+        p = scanString(p, end);
+        s = sdscatlen(s, run, p - run);
+    }
+
+    if (p < end && *p == '"')
+        return jsonObjSdsTake(s);
+
+invalid:
+    sdsfree(s);
+    return NULL;
+}
+
+/* Length of the number at 'pos' or 0 if it isn't a valid number */
+static size_t numberLength(const char *json, size_t len, size_t pos) {
+    size_t i = pos;
+
+#define DIGIT(_i) ((_i) < len && json[_i] >= '0' && json[_i] <= '9')
+    if (i < len && json[i] == '-')
+        i++;
+
+    if (i < len && json[i] == '0') {
+        i++;
+    } else if (DIGIT(i)) {
+        while (DIGIT(i))
+            i++;
+    } else {
+        return 0;
+    }
+
+    if (i < len && json[i] == '.') {
+        i++;
+        if (!DIGIT(i))
+            return 0;
+        while (DIGIT(i))
+            i++;
+    }
+
+    if (i < len && (json[i] | 0x20) == 'e') {
+        i++;
+        if (i < len && (json[i] == '+' || json[i] == '-'))
+            i++;
+        if (!DIGIT(i))
+            return 0;
+        while (DIGIT(i))
+            i++;
+    }
+#undef DIGIT
+
+    return isTerminator(json, len, i) ? i - pos : 0;
+}
+
+static bool isLiteral(const char *json, size_t len, size_t pos,
+                      const char *literal, size_t literal_len) {
+    return len - pos >= literal_len &&
+           !memcmp(json + pos, literal, literal_len) &&
+           isTerminator(json, len, pos + literal_len);
+}
+
+/* Decode the string, number or literal at 'pos' */
+static struct jsonObj *parseScalar(const char *json, size_t len, size_t pos) {
+    struct jsonObj *o = NULL;
+    size_t number;
+    sds s;
+
+    switch (json[pos]) {
+    case '"':
+        if ((s = parseString(json, len, pos)))
+            o = jsonObjStringTake(s);
+        break;
+    case 't':
+        if (isLiteral(json, len, pos, "true", 4)) {
+            o = jsonObjCreate();
+            o->type = JSON_TYPE_TRUE;
+        }
+        break;
+    case 'f':
+        if (isLiteral(json, len, pos, "false", 5)) {
+            o = jsonObjCreate();
+            o->type = JSON_TYPE_FALSE;
+        }
+        break;
+    case 'n':
+        if (isLiteral(json, len, pos, "null", 4)) {
+            o = jsonObjCreate();
+            o->type = JSON_TYPE_NULL;
+        }
+        break;
+    default:
+        if ((number = numberLength(json, len, pos)))
+            o = jsonObjNumberAsStringLen((char *)json + pos, number);
+        break;
+    }
+
+    return o;
+}
+
+/* ====================================================================
+ * Stage 2: Tree Building
+ * ==================================================================== */
+/* Build the tree of 'json' from its structural index.  Returns NULL if
+ * 'json' isn't strict JSON. */
+static struct jsonObj *buildTree(struct structuralIndex *ix) {
+    const char *json = ix->json;
+    size_t len = ix->len;
+    struct jsonObj *root = NULL, *o;
+    struct jsonObj **stack = NULL; /* open containers */
+    int depth = 0, stack_sz = 0;
+    sds name = NULL;
+    size_t pos, peek;
+    char c;
+
+#define NEXT()                                                                 \
+    do {                                                                       \
+        if (!nextStructural(ix, &pos))                                         \
+            goto invalid;                                                      \
+        c = json[pos];                                                         \
+    } while (0)
+
+value:
+    /* A value (named 'name' inside maps) */
+    NEXT();
+    if (c == '{')
+        o = jsonObjCreateMap();
+    else if (c == '[')
+        o = jsonObjCreateList();
+    else if (!(o = parseScalar(json, len, pos)))
+        goto invalid;
+
+    o->name = name;
+    name = NULL;
+
+    if (!root)
+        root = o;
+    else
+        jsonObjAddField(stack[depth - 1], o);
+
+    if (c == '{' || c == '[') {
+        if (depth == stack_sz) {
+            stack_sz = stack_sz ? stack_sz * 2 : 16;
+            stack = zrealloc(stack, sizeof(*stack) * stack_sz);
+        }
+        stack[depth++] = o;
+
+        /* Empty containers close right away */
+        if (peekStructural(ix, &peek) &&
+            json[peek] == (c == '{' ? '}' : ']')) {
+            ix->at++;
+            depth--;
+        } else if (c == '{') {
+            NEXT();
+            goto key;
+        } else {
+            goto value;
+        }
+    }
+
+next:
+    /* After a value: end of document, next element or end of container */
+    if (!depth)
+        goto done;
+
+    NEXT();
+    if (stack[depth - 1]->type == JSON_TYPE_MAP) {
+        if (c == ',') {
+            NEXT();
+            goto key;
+        } else if (c != '}') {
+            goto invalid;
+        }
+    } else {
+        if (c == ',')
+            goto value;
+        else if (c != ']')
+            goto invalid;
+    }
+
+    depth--;
+    goto next;
+
+key:
+    /* A map key ('c' is its first byte) then its value */
+    if (c != '"' || !(name = parseString(json, len, pos)))
+        goto invalid;
+    NEXT();
+    if (c != ':')
+        goto invalid;
+    goto value;
+
+done:
+    /* One value per document (and the rest of it must index cleanly) */
+    if (peekStructural(ix, &peek) || ix->failed)
+        goto invalid;
+
+    zfree(stack);
+    return root;
+
+invalid:
+    jsonObjSdsFree(name);
+    jsonObjFree(root);
+    zfree(stack);
+    return NULL;
+#undef NEXT
+}
+
+/* ====================================================================
+ * Interface
+ * ==================================================================== */
+struct jsonObj *simd_decode(sds json, sds *error) {
+    size_t len = sdslen(json);
+
+    /* Offsets are 32 bits */
+    if (len < UINT32_MAX) {
+        struct structuralIndex *ix = zcalloc(sizeof(*ix));
+        ix->json = json;
+        ix->len = len;
+        struct jsonObj *root = buildTree(ix);
+        zfree(ix);
+        if (root)
+            return root;
+    }
+
+    /* Let yajl decide what to make of it */
+    return yajl_decode(json, error);
+}
+
+#else
+struct jsonObj *simd_decode(sds json, sds *error) {
+    return yajl_decode(json, error);
+}
+#endif
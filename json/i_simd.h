@@ -0,0 +1,11 @@
+#ifndef __I_SIMD_H__
+#define __I_SIMD_H__
+
+#include "json.h"
+#include "jsonobj.h"
+
+/* Same contract as yajl_decode(): returns the decoded tree or NULL (with
+ * yajl's error appended to *error if 'error' isn't NULL). */
+struct jsonObj *simd_decode(sds json, sds *error);
+
+#endif
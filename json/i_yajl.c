@@ -89,7 +89,7 @@ static int redis_parse_string(void *ctx, const unsigned char *stringVal,
 static int redis_parse_map_key(void *ctx, const unsigned char *stringVal,
                                size_t stringLen) {
     struct ctxstate *state = ctx;
-    state->keyname = sdsnewlen(stringVal, stringLen);
+    state->keyname = jsonObjSdsNewLen(stringVal, stringLen);
     D("Parsed key name [%s]\n", state->keyname);
     return true;
 }
@@ -1,9 +1,11 @@
 #include "json.h"
 #include "jsonobj.h"
+#include "jsonobj_arena.h"
 #include "jsonobj_box.h"
 #include "jsonobj_get.h"
 #include "jsonobj_set.h"
 #include "jsonobj_delete.h"
+#include "i_simd.h"
 #include "i_yajl.h"
 
 /* ====================================================================
@@ -175,7 +177,9 @@ static int jsonObjAddToDB(robj *key, struct jsonObj *root) {
 void jsonwrapCommand(redisClient *c) {
     /* args 0-N: ["jsonwrap", targetCommand, arg1, arg2, ..., argn] */
     jsonSyncClients(c);
+    jsonArenaOpen();
     genericWrapCommandAndReply(c);
+    jsonArenaClose();
 }
 
 /* More efficient version of jsonwrap for hgetall only */
@@ -183,9 +187,11 @@ void hgetalljsonCommand(redisClient *c) {
     addReplyMultiBulkLen(c, c->argc - 1);
 
     jsonSyncClients(c);
+    jsonArenaOpen();
     for (int i = 1; i < c->argc; i++) {
         hgetallToJsonAndAndReply(c, c->argv[i]->ptr);
     }
+    jsonArenaClose();
 }
 
 void jsondocsetCommand(redisClient *c) {
@@ -216,9 +222,12 @@ void jsondocsetCommand(redisClient *c) {
 
     int documents = (c->argc - 1) / 2;
 
+    /* Every tree (and its boxing on the way into the DB) is built in the
+     * command arena and released with it */
+    jsonArenaOpen();
     struct jsonObj *additions[documents];
     for (int i = 1; i < c->argc; i += 2) {
-        struct jsonObj *root = yajl_decode(c->argv[i + 1]->ptr, NULL);
+        struct jsonObj *root = simd_decode(c->argv[i + 1]->ptr, NULL);
 
         additions[i / 2] = root;
 
@@ -230,6 +239,7 @@ void jsondocsetCommand(redisClient *c) {
             addReplyErrorFormat(c, "Invalid JSON at document %d.  Use "
                                    "JSONDOCVALIDATE [json] for complete error.",
                                 i / 2);
+            jsonArenaClose();
             return;
         }
     }
@@ -244,6 +254,7 @@ void jsondocsetCommand(redisClient *c) {
         jsonObjFree(root);
         D("Parsed Json %d!\n", i);
     }
+    jsonArenaClose();
 
     /* Reply += 1 if the document is new; reply += 0 if the document updated
      * (where an update is a full Delete/Create cycle) */
@@ -256,7 +267,8 @@ void jsondocvalidateCommand(redisClient *c) {
     /* args 0-1: ["jsondocvalidate", json] */
 
     sds err = sdsempty();
-    struct jsonObj *root = yajl_decode(c->argv[1]->ptr, &err);
+    jsonArenaOpen();
+    struct jsonObj *root = simd_decode(c->argv[1]->ptr, &err);
 
     if (!root) {
         int sz;
@@ -270,6 +282,7 @@ void jsondocvalidateCommand(redisClient *c) {
     } else {
         addReply(c, shared.ok);
     }
+    jsonArenaClose();
     sdsfree(err);
 }
 
@@ -279,10 +292,12 @@ void jsondocsetbyjsonCommand(redisClient *c) {
     jsonSyncClients(c);
 
     sds field_name = c->argv[1]->ptr;
-    struct jsonObj *root = yajl_decode(c->argv[2]->ptr, NULL);
+    jsonArenaOpen();
+    struct jsonObj *root = simd_decode(c->argv[2]->ptr, NULL);
 
     if (!root) {
         addReply(c, g.err_parse);
+        jsonArenaClose();
         return;
     }
 
@@ -307,6 +322,7 @@ void jsondocsetbyjsonCommand(redisClient *c) {
                     c,
                     "field '%s' not found or unusable as key for document %d",
                     field_name, i);
+                jsonArenaClose();
                 return;
             }
         }
@@ -336,6 +352,7 @@ void jsondocsetbyjsonCommand(redisClient *c) {
     }
 
     jsonObjFree(root);
+    jsonArenaClose();
 }
 
 void jsondocdelCommand(redisClient *c) {
@@ -380,7 +397,9 @@ void jsondocgetCommand(redisClient *c) {
     if (!validateKeyFormatAndReply(c, c->argv[1]->ptr))
         return;
 
+    jsonArenaOpen();
     findJsonAndReply(c, c->argv[1]->ptr);
+    jsonArenaClose();
 }
 
 void jsondocmgetCommand(redisClient *c) {
@@ -391,9 +410,11 @@ void jsondocmgetCommand(redisClient *c) {
         return;
 
     addReplyMultiBulkLen(c, c->argc - 1);
+    jsonArenaOpen();
     for (int i = 1; i < c->argc; i++) {
         findJsonAndReply(c, c->argv[i]->ptr);
     }
+    jsonArenaClose();
 }
 
 void jsonfieldgetCommand(redisClient *c) {
@@ -407,7 +428,9 @@ void jsonfieldgetCommand(redisClient *c) {
     sds field = c->argv[c->argc - 1]->ptr;
 
     D("Asking for Key [%s] and Field [%s]\n", key, field);
+    jsonArenaOpen();
     findJsonFieldAndReply(c, key, field);
+    jsonArenaClose();
 
     sdsfree(key);
 }
@@ -442,6 +465,7 @@ void jsonfieldincrbyGeneric(redisClient *c, bool use_incrbyfloat) {
         return;
     } else if (decode_as == DECODE_INDIVIDUAL) {
         /* 'field' is the second to last argv[] element */
+        jsonArenaOpen();
         struct jsonObj *f =
             hgetToJsonObj(found, decode_as, c->argv[c->argc - 2]->ptr);
         switch (f->type) {
@@ -464,6 +488,7 @@ void jsonfieldincrbyGeneric(redisClient *c, bool use_incrbyfloat) {
             break;
         }
         jsonObjFree(f);
+        jsonArenaClose();
         return;
     }
 
@@ -523,10 +548,12 @@ void jsonfieldrpushxCommand(redisClient *c) {
     }
 
     /* json is last argument */
-    struct jsonObj *o = yajl_decode(c->argv[c->argc - 1]->ptr, NULL);
+    jsonArenaOpen();
+    struct jsonObj *o = simd_decode(c->argv[c->argc - 1]->ptr, NULL);
     if (!o) {
         addReply(c, g.err_parse);
         sdsfree(found);
+        jsonArenaClose();
         return;
     } else if (o->type == JSON_TYPE_MAP || o->type == JSON_TYPE_LIST) {
         /* Implementation outline:
@@ -539,6 +566,7 @@ void jsonfieldrpushxCommand(redisClient *c) {
                          "this feature.");
         jsonObjFree(o);
         sdsfree(found);
+        jsonArenaClose();
         return;
     } else if (decode_as == DECODE_ALL_NUMBER &&
                (o->type != JSON_TYPE_NUMBER &&
@@ -553,6 +581,7 @@ void jsonfieldrpushxCommand(redisClient *c) {
         addReplyError(c, "You must add only numbers to your number-only list.");
         jsonObjFree(o);
         sdsfree(found);
+        jsonArenaClose();
         return;
     } else if (decode_as == JSON_TYPE_STRING && (o->type != JSON_TYPE_STRING)) {
         /* Complete implementation outline:
@@ -560,6 +589,7 @@ void jsonfieldrpushxCommand(redisClient *c) {
         addReplyError(c, "You must add only strings to your string-only list.");
         jsonObjFree(o);
         sdsfree(found);
+        jsonArenaClose();
         return;
     } else if (decode_as == DECODE_INDIVIDUAL) {
         jsonObjBoxBasicType(o);
@@ -576,9 +606,9 @@ void jsonfieldrpushxCommand(redisClient *c) {
      * at least four argument pointers available to us, and we only
      * need to have three allocated.  Perfecto. */
     c->argv[1] = dbstrTake(found);
-    c->argv[2] = dbstrTake(o->content.string);
-    o->content.string = NULL;
+    c->argv[2] = dbstr(o->content.string); /* o's string lives in the arena */
     jsonObjFree(o);
+    jsonArenaClose();
 
     /* Target args: 0-3: [_, LIST, RAW-STR-OR-NUMBER] */
     rpushxCommand(c);
@@ -600,7 +630,9 @@ void jsonfieldrpopCommand(redisClient *c) {
         return;
     }
 
+    jsonArenaOpen();
     rpopRecursiveAndReply(c, found, decode_as);
+    jsonArenaClose();
     sdsfree(found);
     sdsfree(key);
 }
@@ -638,6 +670,7 @@ void cleanup(void *privdata) {
     freeClient(g.c);
     freeClient(g.c_noreturn);
     decrRefCount(g.err_parse);
+    jsonArenaFree();
 }
 
 /* ====================================================================
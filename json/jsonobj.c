@@ -1,10 +1,48 @@
 #include "jsonobj.h"
+#include "jsonobj_arena.h"
+
+/* ====================================================================
+ * jsonObj Strings
+ * ==================================================================== */
+sds jsonObjSdsNewLen(const void *init, size_t len) {
+    if (jsonArenaIsOpen())
+        return jsonArenaSdsNewLen(init, len);
+
+    return sdsnewlen(init, len);
+}
+
+sds jsonObjSdsDup(const sds s) {
+    return jsonObjSdsNewLen(s, sdslen(s));
+}
+
+sds jsonObjSdsFromLongLong(long long value) {
+    char buf[32];
+    int len = ll2string(buf, sizeof(buf), value);
+
+    return jsonObjSdsNewLen(buf, len);
+}
+
+sds jsonObjSdsTake(sds s) {
+    if (!s || !jsonArenaIsOpen())
+        return s;
+
+    sds adopted = jsonArenaSdsNewLen(s, sdslen(s));
+    sdsfree(s);
+    return adopted;
+}
+
+void jsonObjSdsFree(sds s) {
+    if (!jsonArenaIsOpen())
+        sdsfree(s);
+}
 
 /* ====================================================================
  * jsonObj Constructors
  * ==================================================================== */
 struct jsonObj *jsonObjCreate() {
-    struct jsonObj *root = zmalloc(sizeof(*root));
+    struct jsonObj *root = jsonArenaIsOpen()
+                               ? jsonArenaAlloc(sizeof(*root))
+                               : zmalloc(sizeof(*root));
     root->name = NULL;
     root->type = JSON_TYPE_NOTSET;
 
@@ -22,8 +60,15 @@ struct jsonObj *jsonObjCreateMap() {
     root->content.obj.homogeneous = false; /* Irrelevant with zero contents */
     root->content.obj.subtype = JSON_TYPE_NOTSET;
     root->content.obj.elements = 0;
-    root->content.obj.fields = zcalloc(sizeof(*root->content.obj.fields) *
-                                       root->content.obj.fields_sz);
+
+    size_t fields_bytes =
+        sizeof(*root->content.obj.fields) * root->content.obj.fields_sz;
+    if (jsonArenaIsOpen()) {
+        root->content.obj.fields = jsonArenaAlloc(fields_bytes);
+        memset(root->content.obj.fields, 0, fields_bytes);
+    } else {
+        root->content.obj.fields = zcalloc(fields_bytes);
+    }
 
     return root;
 }
@@ -44,17 +89,17 @@ struct jsonObj *jsonObjNumberAsStringTake(sds number) {
 }
 
 struct jsonObj *jsonObjNumberAsString(sds number) {
-    return jsonObjNumberAsStringTake(sdsdup(number));
+    return jsonObjNumberAsStringTake(jsonObjSdsDup(number));
 }
 
 struct jsonObj *jsonObjNumberLongLong(long long number) {
-    return jsonObjNumberAsStringTake(sdsfromlonglong(number));
+    return jsonObjNumberAsStringTake(jsonObjSdsFromLongLong(number));
 }
 
 struct jsonObj *jsonObjNumber(double number) {
     /* If we can represent this double as an integer, do that instead. */
     if (isfinite(number) && (long long)number == number) {
-        return jsonObjNumberAsStringTake(sdsfromlonglong(number));
+        return jsonObjNumberAsStringTake(jsonObjSdsFromLongLong(number));
     } else {
         /* else, create a normal double number object. */
         struct jsonObj *o = jsonObjCreate();
@@ -67,7 +112,7 @@ struct jsonObj *jsonObjNumber(double number) {
 }
 
 struct jsonObj *jsonObjNumberAsStringLen(char *str, size_t len) {
-    return jsonObjNumberAsStringTake(sdsnewlen(str, len));
+    return jsonObjNumberAsStringTake(jsonObjSdsNewLen(str, len));
 }
 
 struct jsonObj *jsonObjStringTake(sds string) {
@@ -80,11 +125,11 @@ struct jsonObj *jsonObjStringTake(sds string) {
 }
 
 struct jsonObj *jsonObjString(sds string) {
-    return jsonObjStringTake(sdsdup(string));
+    return jsonObjStringTake(jsonObjSdsDup(string));
 }
 
 struct jsonObj *jsonObjStringLen(char *string, size_t len) {
-    return jsonObjStringTake(sdsnewlen(string, len));
+    return jsonObjStringTake(jsonObjSdsNewLen(string, len));
 }
 
 /* ====================================================================
@@ -92,13 +137,13 @@ struct jsonObj *jsonObjStringLen(char *string, size_t len) {
  * ==================================================================== */
 void jsonObjTakeName(struct jsonObj *f, sds new_name) {
     if (f->name)
-        sdsfree(f->name);
+        jsonObjSdsFree(f->name);
 
     f->name = new_name;
 }
 
 void jsonObjUpdateName(struct jsonObj *f, sds new_name) {
-    jsonObjTakeName(f, sdsdup(new_name));
+    jsonObjTakeName(f, jsonObjSdsDup(new_name));
 }
 
 bool jsonObjAddField(struct jsonObj *o, struct jsonObj *field) {
@@ -127,10 +172,16 @@ bool jsonObjAddField(struct jsonObj *o, struct jsonObj *field) {
 
     /* If we are at max size, double the pointer allocation. */
     if (o->content.obj.elements == o->content.obj.fields_sz) {
+        size_t field_sz = sizeof(*o->content.obj.fields);
+
         o->content.obj.fields_sz *= 2;
-        o->content.obj.fields =
-            zrealloc(o->content.obj.fields,
-                     sizeof(*o->content.obj.fields) * o->content.obj.fields_sz);
+        if (jsonArenaIsOpen())
+            o->content.obj.fields = jsonArenaRealloc(
+                o->content.obj.fields, field_sz * o->content.obj.elements,
+                field_sz * o->content.obj.fields_sz);
+        else
+            o->content.obj.fields = zrealloc(
+                o->content.obj.fields, field_sz * o->content.obj.fields_sz);
     }
 
     o->content.obj.fields[o->content.obj.elements++] = field;
@@ -140,8 +191,9 @@ bool jsonObjAddField(struct jsonObj *o, struct jsonObj *field) {
 /* ====================================================================
  * jsonObj Destructor (recursive)
  * ==================================================================== */
+/* Arena trees are released all at once by jsonArenaClose() */
 void jsonObjFree(struct jsonObj *f) {
-    if (!f)
+    if (!f || jsonArenaIsOpen())
         return;
 
     switch (f->type) {
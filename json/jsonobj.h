@@ -38,6 +38,19 @@ struct jsonObj {
 #define JSON_TYPE_NUMBER_AS_STRING 8
 #define JSON_TYPE_PTR 9
 
+/* ====================================================================
+ * jsonObj Strings
+ * ====================================================================
+ * Names and strings owned by a jsonObj come from the command's arena while
+ * it's open (see jsonobj_arena.h) and from the heap otherwise.  Anything
+ * handed to a *Take function must be created (or adopted) here, and
+ * released with jsonObjSdsFree() if it never joins a tree. */
+sds jsonObjSdsNewLen(const void *init, size_t len);
+sds jsonObjSdsDup(const sds s);
+sds jsonObjSdsFromLongLong(long long value);
+sds jsonObjSdsTake(sds s); /* Adopt heap sds 's' */
+void jsonObjSdsFree(sds s);
+
 /* ====================================================================
  * jsonObj Manipulators
  * ==================================================================== */
@@ -489,4 +489,63 @@ start_server {tags {"jsonobj"}} {
     test {JSONDOC - verify remove cleaned all keys} {
         r keys *
     } {}
+
+    test {JSONDOC - set with escapes and comments} {
+        r jsondocset esc {{"s": "a\"b\\c\u0041", /* yajl */ "t": "x"}}
+        list [r jsonfieldget esc s] [r jsonfieldget esc t] [r jsondocdel esc]
+    } {{"a\"b\\cA"} {"x"} 1}
+
+    test {JSONDOC - set with escapes and no comments} {
+        r jsondocset esc {{"s": "q\"b\\s\/n\nu\u0041", "t": "x"}}
+        list [r jsonfieldget esc s] [r jsonfieldget esc t] [r jsondocdel esc]
+    } {{"q\"b\\s/n\nuA"} {"x"} 1}
+
+    test {JSONDOC - surrogate pair escapes decode to UTF-8} {
+        r jsondocset smile {{"s": "a\ud83d\ude00b"}}
+        list [expr {[r jsonfieldget smile s] eq "\"a\xf0\x9f\x98\x80b\""}] \
+             [r jsondocdel smile]
+    } {1 1}
+
+    test {JSONDOC - multibyte UTF-8 round trips} {
+        # U+00E9, U+20AC and U+4E2D as raw UTF-8 bytes
+        set s "caf\xc3\xa9 \xe2\x82\xac \xe4\xb8\xad"
+        r jsondocset mb "{\"s\":\"$s\"}"
+        list [expr {[r jsonfieldget mb s] eq "\"$s\""}] [r jsondocdel mb]
+    } {1 1}
+
+    test {JSONDOC - invalid UTF-8 is a parse error} {
+        set errs {}
+        # Stray continuation byte, truncated sequence, overlong '/'
+        foreach s [list "a\x80b" "a\xe2\x82" "\xc0\xaf"] {
+            catch {r jsondocset bad "{\"s\":\"$s\"}"} err
+            lappend errs [string match "*Parse Error*" $err]
+        }
+        list $errs [r exists bad]
+    } {{1 1 1} 0}
+
+    test {JSONDOC - documents bigger than one index batch} {
+        set items {}
+        for {set i 0} {$i < 5000} {incr i} {
+            lappend items "\"v$i\""
+        }
+        set doc "\{\"l\":\[[join $items ,]\],\"s\":\"\xc3\xa9\"\}"
+        r jsondocset bigdoc $doc
+        set same [expr {[r jsondocget bigdoc] eq $doc}]
+
+        # Invalid UTF-8 far past the first batch still fails the parse
+        catch {r jsondocset badbig [string map {"v4999" "v\xff"} $doc]} err
+        list $same [r jsondocdel bigdoc] [string match "*Parse Error*" $err]
+    } {1 1 1}
+
+    test {JSONDOC - wide containers round trip} {
+        set fields {}
+        set items {}
+        for {set i 0} {$i < 40} {incr i} {
+            lappend fields "\"k$i\":[expr {$i % 2 ? $i : "\"v$i\""}]"
+            lappend items $i
+        }
+        set doc "\{[join $fields ,],\"l\":\[[join $items ,]\]\}"
+        r jsondocset wide $doc
+        list [expr {[r jsondocget wide] eq $doc}] [r jsondocdel wide]
+    } {1 1}
 }
@@ -0,0 +1,142 @@
+#include "jsonobj_arena.h"
+
+/* ====================================================================
+ * Arena Chunks
+ * ====================================================================
+ * The arena is a stack of chunks.  Allocations bump 'used' in the
+ * newest chunk; when it's full we push a chunk twice its size (up to
+ * ARENA_MAX_CHUNK, or larger for one oversized allocation).
+ *
+ * Closing the arena frees every chunk except the newest, which is kept
+ * (emptied) for the next command so steady traffic doesn't malloc at
+ * all.  Chunks bigger than ARENA_MAX_CHUNK aren't kept. */
+#define ARENA_MIN_CHUNK (16 * 1024)
+#define ARENA_MAX_CHUNK (1024 * 1024)
+#define ARENA_ALIGN(sz) (((sz) + 7) & ~(size_t)7)
+
+struct arenaChunk {
+    struct arenaChunk *prev;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+static struct {
+    struct arenaChunk *current;
+    int depth; /* nested opens */
+} arena = {0};
+
+static struct arenaChunk *arenaChunkPush(size_t size) {
+    size_t sz = ARENA_MIN_CHUNK;
+
+    if (arena.current && arena.current->size < ARENA_MAX_CHUNK)
+        sz = arena.current->size * 2;
+    else if (arena.current)
+        sz = ARENA_MAX_CHUNK;
+
+    if (sz < size)
+        sz = size;
+
+    struct arenaChunk *chunk = zmalloc(sizeof(*chunk) + sz);
+    chunk->prev = arena.current;
+    chunk->size = sz;
+    chunk->used = 0;
+    arena.current = chunk;
+
+    return chunk;
+}
+
+static void arenaChunksRelease(struct arenaChunk *chunk) {
+    while (chunk) {
+        struct arenaChunk *prev = chunk->prev;
+        zfree(chunk);
+        chunk = prev;
+    }
+}
+
+/* ====================================================================
+ * Open / Close
+ * ==================================================================== */
+void jsonArenaOpen(void) {
+    arena.depth++;
+}
+
+void jsonArenaClose(void) {
+    if (--arena.depth > 0)
+        return;
+
+    struct arenaChunk *keep = arena.current;
+    if (!keep)
+        return;
+
+    arenaChunksRelease(keep->prev);
+    keep->prev = NULL;
+    keep->used = 0;
+
+    if (keep->size > ARENA_MAX_CHUNK) {
+        zfree(keep);
+        arena.current = NULL;
+    }
+}
+
+bool jsonArenaIsOpen(void) {
+    return arena.depth > 0;
+}
+
+void jsonArenaFree(void) {
+    arenaChunksRelease(arena.current);
+    arena.current = NULL;
+    arena.depth = 0;
+}
+
+/* ====================================================================
+ * Allocation
+ * ==================================================================== */
+void *jsonArenaAlloc(size_t size) {
+    struct arenaChunk *chunk = arena.current;
+
+    size = ARENA_ALIGN(size);
+    if (!chunk || chunk->size - chunk->used < size)
+        chunk = arenaChunkPush(size);
+
+    void *ptr = chunk->data + chunk->used;
+    chunk->used += size;
+
+    return ptr;
+}
+
+void *jsonArenaRealloc(void *ptr, size_t old_size, size_t size) {
+    struct arenaChunk *chunk = arena.current;
+    size_t old_aligned = ARENA_ALIGN(old_size);
+    size_t aligned = ARENA_ALIGN(size);
+
+    if (ptr && size <= old_size)
+        return ptr;
+
+    /* The newest allocation can grow into the rest of its chunk */
+    if (ptr && (char *)ptr + old_aligned == chunk->data + chunk->used &&
+        chunk->size - chunk->used >= aligned - old_aligned) {
+        chunk->used += aligned - old_aligned;
+        return ptr;
+    }
+
+    void *grown = jsonArenaAlloc(size);
+    if (ptr)
+        memcpy(grown, ptr, old_size);
+
+    return grown;
+}
+
+sds jsonArenaSdsNewLen(const void *init, size_t len) {
+    struct sdshdr *sh = jsonArenaAlloc(sizeof(*sh) + len + 1);
+
+    sh->len = len;
+    sh->free = 0;
+    if (init)
+        memcpy(sh->buf, init, len);
+    else
+        memset(sh->buf, 0, len);
+    sh->buf[len] = '\0';
+
+    return sh->buf;
+}
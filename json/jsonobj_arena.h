@@ -0,0 +1,34 @@
+#ifndef __JSONOBJ_ARENA_H__
+#define __JSONOBJ_ARENA_H__
+
+#include "json.h"
+
+/* ====================================================================
+ * Per-command jsonObj Arena
+ * ====================================================================
+ * While the arena is open, jsonObj nodes, names, strings and field
+ * arrays are bump allocated from it instead of zmalloc'd one by one.
+ * Closing the arena releases all of them at once, so jsonObjFree() of
+ * an arena tree does nothing.
+ *
+ * Commands open the arena before building trees and close it after
+ * their reply.  Opens nest; only the outermost close releases memory. */
+void jsonArenaOpen(void);
+void jsonArenaClose(void);
+bool jsonArenaIsOpen(void);
+
+/* 8 byte aligned, uninitialized memory living until the arena closes */
+void *jsonArenaAlloc(size_t size);
+
+/* Grow 'ptr' (from jsonArenaAlloc) from 'old_size' to 'size' bytes.
+ * Extends in place when 'ptr' was the most recent allocation. */
+void *jsonArenaRealloc(void *ptr, size_t old_size, size_t size);
+
+/* sds with its header in the arena.  sdslen() and friends work, but it
+ * must never be grown, sdsfree'd or stored past the arena closing. */
+sds jsonArenaSdsNewLen(const void *init, size_t len);
+
+/* Teardown (called from module cleanup) */
+void jsonArenaFree(void);
+
+#endif
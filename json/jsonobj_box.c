@@ -13,6 +13,17 @@ sds boxgen(unsigned char box, sds key) {
     return result;
 }
 
+/* Like boxgen(), but allocated for a jsonObj (see jsonObjSdsNewLen()) */
+static sds boxgenForObj(unsigned char box, const char *key, size_t len) {
+    sds result = jsonObjSdsNewLen(NULL, len + 1);
+
+    result[0] = box;
+    if (key)
+        memcpy(result + 1, key, len);
+
+    return result;
+}
+
 static unsigned char jsonObjTagHomogeneous(struct jsonObj *t) {
     unsigned char boxtype = 0;
 
@@ -114,7 +125,7 @@ static sds jsonObjGenerateBox(struct jsonObj *o) {
 
     char boxtype = jsonObjBoxType(o);
 
-    return boxgen(boxtype, NULL);
+    return boxgenForObj(boxtype, NULL, 0);
 }
 
 struct jsonObj *jsonObjConvertToPtr(struct jsonObj *o) {
@@ -139,13 +150,14 @@ static bool jsonObjBoxNumber(struct jsonObj *o) {
 
     switch (o->type) {
     case JSON_TYPE_NUMBER:
-        o->content.string =
-            boxgen(box, sdscatprintf(sdsempty(), "%f", o->content.number));
+        n = sdscatprintf(sdsempty(), "%f", o->content.number);
+        o->content.string = boxgenForObj(box, n, sdslen(n));
+        sdsfree(n);
         break;
     case JSON_TYPE_NUMBER_AS_STRING:
         n = o->content.string;
-        o->content.string = boxgen(box, n);
-        sdsfree(n);
+        o->content.string = boxgenForObj(box, n, sdslen(n));
+        jsonObjSdsFree(n);
         break;
     default:
         D("ERROR - Attempted to turn non-number type (%d) into number "
@@ -165,8 +177,8 @@ static bool jsonObjBoxString(struct jsonObj *o) {
     box = jsonObjBoxType(o);
     o->type = JSON_TYPE_PTR;
 
-    o->content.string = boxgen(box, orig_str);
-    sdsfree(orig_str);
+    o->content.string = boxgenForObj(box, orig_str, sdslen(orig_str));
+    jsonObjSdsFree(orig_str);
 
     return true;
 }
@@ -192,7 +204,7 @@ bool jsonObjBoxBasicType(struct jsonObj *o) {
     case JSON_TYPE_NULL:
         box = jsonObjBoxType(o);
         o->type = JSON_TYPE_PTR;
-        o->content.string = boxgen(box, NULL);
+        o->content.string = boxgenForObj(box, NULL, 0);
         break;
     default:
         D("ERROR - Tried to box invalid type (%d)\n", o->type);
@@ -59,7 +59,7 @@ static struct jsonObj *jsonObjCreateMapFromBuffer(char *buf,
         next += SZ_CRLF;
 
         sds bulk_data;
-        bulk_data = sdsnewlen(next, sz);
+        bulk_data = jsonObjSdsNewLen(next, sz);
         if (i % 2 == 0) {
             name = bulk_data;
         } else {
@@ -119,7 +119,7 @@ static struct jsonObj *redisKVProtocolToJSONContainer(sds reply, sds key,
         return jsonObjNumber(sz);
         break;
     case '$': /* Bulk */
-        snext = sdsnewlen(next, sz);
+        snext = jsonObjSdsNewLen(next, sz);
         switch (decode_as) {
         case DECODE_ALL_STRING:
             o = jsonObjStringTake(snext);
@@ -131,7 +131,7 @@ static struct jsonObj *redisKVProtocolToJSONContainer(sds reply, sds key,
             o = jsonObjFromBoxedBuffer(snext, key);
             break;
         default:
-            sdsfree(snext);
+            jsonObjSdsFree(snext);
             break;
         }
         return o;
@@ -425,15 +425,15 @@ static struct jsonObj *jsonObjFromBox(unsigned char box, sds buffer,
           openBoxAction(box));
         break;
     }
-    sdsfree(buffer);
+    jsonObjSdsFree(buffer);
     return o;
 }
 
 /* Given a boxed Redis value, use the box to retrieve the proper
  * JSON value we're going to return. */
-/* NOTE: 'buffer' is now owned by this function and is modified along
- * the way.  If you need to keep your original value, send BoxedBuffer
- * a copy. */
+/* NOTE: 'buffer' (from jsonObjSdsNewLen()) is now owned by this function
+ * and is modified along the way.  If you need to keep your original value,
+ * send BoxedBuffer a copy. */
 struct jsonObj *jsonObjFromBoxedBuffer(sds buffer, sds populate_as) {
     unsigned char box = buffer[0];
 
@@ -516,7 +516,7 @@ static struct jsonObj *jsonObjFromRedisListByPosition(robj *key, int decode_as,
                     break;
                 case DECODE_INDIVIDUAL:
                     populate_as = sdsAppendColonInteger(key->ptr, i);
-                    buffer = sdsnewlen(vstr, vlen);
+                    buffer = jsonObjSdsNewLen(vstr, vlen);
                     member = jsonObjFromBoxedBuffer(buffer, populate_as);
                     sdsfree(populate_as);
                     break;
@@ -529,7 +529,8 @@ static struct jsonObj *jsonObjFromRedisListByPosition(robj *key, int decode_as,
                     member = jsonObjNumberLongLong(vlong);
                     break;
                 case DECODE_ALL_STRING:
-                    member = jsonObjStringTake(sdsfromlonglong(vlong));
+                    member =
+                        jsonObjStringTake(jsonObjSdsFromLongLong(vlong));
                     break;
                 case DECODE_INDIVIDUAL:
                     D("ERROR - Trying to decode NUMBER as individual member.  "
@@ -574,7 +575,8 @@ static struct jsonObj *jsonObjFromRedisListByPosition(robj *key, int decode_as,
             case DECODE_INDIVIDUAL:
                 /* parse as box then create sub-type */
                 populate_as = sdsAppendColonInteger(key->ptr, i);
-                member = jsonObjFromBoxedBuffer(sdsdup(ln->value), populate_as);
+                member = jsonObjFromBoxedBuffer(jsonObjSdsDup(ln->value),
+                                                populate_as);
                 sdsfree(populate_as);
                 break;
             }
@@ -656,7 +658,7 @@ static struct jsonObj *localrpop(sds key, int decode_as) {
     int sz = strtol(fake_client_buffer + 1, &next, 10);
     next += SZ_CRLF;
 
-    sds pop_result = sdsnewlen(next, sz);
+    sds pop_result = jsonObjSdsNewLen(next, sz);
     freeFakeClientResultBuffer(c, fake_client_buffer);
 
     /* If we know this is a number or string, quickly return without